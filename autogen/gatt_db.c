@@ -28,9 +28,10 @@ GATT_DATA(const uint8_t gattdb_uuidtable_128_map[]) =
   0x74, 0x71, 0x7d, 0x8d, 0xaf, 0xee, 0x02, 0xab, 0x01, 0x44, 0x8b, 0x36, 0x06, 0x1b, 0x06, 0x4a, 
   0x9e, 0x02, 0x43, 0xab, 0xf1, 0x23, 0x5c, 0xa7, 0x55, 0x4b, 0xf8, 0x91, 0xcc, 0xf3, 0xaa, 0xb8, 
   0x77, 0xe9, 0xa4, 0x05, 0x7a, 0x08, 0x7e, 0x96, 0x7e, 0x4c, 0xf5, 0xbd, 0xfd, 0x03, 0x91, 0xe2, 
+  0xf0, 0xe3, 0xa9, 0x41, 0x7d, 0x2b, 0x6e, 0x9c, 0x8a, 0x4f, 0x41, 0x3e, 0x7a, 0x0b, 0x2c, 0x5d, 
   0x63, 0x60, 0x32, 0xe0, 0x37, 0x5e, 0xa4, 0x88, 0x53, 0x4e, 0x6d, 0xfb, 0x64, 0x35, 0xbf, 0xf7, 
 };
-GATT_DATA(const sli_bt_gattdb_value_t gattdb_attribute_field_27) = {
+GATT_DATA(const sli_bt_gattdb_value_t gattdb_attribute_field_29) = {
   .len = 16,
   .data = { 0xf0, 0x19, 0x21, 0xb4, 0x47, 0x8f, 0xa4, 0xbf, 0xa1, 0x4f, 0x63, 0xfd, 0xee, 0xd6, 0x14, 0x1d, }
 };
@@ -112,21 +113,23 @@ GATT_DATA(const sli_bt_gattdb_attribute_t gattdb_attributes_map[]) = {
   { .handle = 0x19, .uuid = 0x8002, .permissions = 0x802, .caps = 0xffff, .state = 0x00, .datatype = 0x07, .dynamicdata = NULL },
   { .handle = 0x1a, .uuid = 0x0002, .permissions = 0x801, .caps = 0xffff, .state = 0x00, .datatype = 0x05, .characteristic = { .properties = 0x08, .char_uuid = 0x8003 } },
   { .handle = 0x1b, .uuid = 0x8003, .permissions = 0x802, .caps = 0xffff, .state = 0x00, .datatype = 0x07, .dynamicdata = NULL },
-  { .handle = 0x1c, .uuid = 0x0000, .permissions = 0x801, .caps = 0xffff, .state = 0x00, .datatype = 0x00, .constdata = &gattdb_attribute_field_27 },
-  { .handle = 0x1d, .uuid = 0x0002, .permissions = 0x801, .caps = 0xffff, .state = 0x00, .datatype = 0x05, .characteristic = { .properties = 0x08, .char_uuid = 0x8004 } },
-  { .handle = 0x1e, .uuid = 0x8004, .permissions = 0x802, .caps = 0xffff, .state = 0x00, .datatype = 0x07, .dynamicdata = NULL },
+  { .handle = 0x1c, .uuid = 0x0002, .permissions = 0x801, .caps = 0xffff, .state = 0x00, .datatype = 0x05, .characteristic = { .properties = 0x08, .char_uuid = 0x8004 } },
+  { .handle = 0x1d, .uuid = 0x8004, .permissions = 0x802, .caps = 0xffff, .state = 0x00, .datatype = 0x07, .dynamicdata = NULL },
+  { .handle = 0x1e, .uuid = 0x0000, .permissions = 0x801, .caps = 0xffff, .state = 0x00, .datatype = 0x00, .constdata = &gattdb_attribute_field_29 },
+  { .handle = 0x1f, .uuid = 0x0002, .permissions = 0x801, .caps = 0xffff, .state = 0x00, .datatype = 0x05, .characteristic = { .properties = 0x08, .char_uuid = 0x8005 } },
+  { .handle = 0x20, .uuid = 0x8005, .permissions = 0x802, .caps = 0xffff, .state = 0x00, .datatype = 0x07, .dynamicdata = NULL },
 };
 
 GATT_HEADER(const sli_bt_gattdb_t gattdb) = {
   .attributes = gattdb_attributes_map,
-  .attribute_table_size = 30,
-  .attribute_num = 30,
+  .attribute_table_size = 32,
+  .attribute_num = 32,
   .uuid16 = gattdb_uuidtable_16_map,
   .uuid16_table_size = 11,
   .uuid16_num = 11,
   .uuid128 = gattdb_uuidtable_128_map,
-  .uuid128_table_size = 5,
-  .uuid128_num = 5,
+  .uuid128_table_size = 6,
+  .uuid128_num = 6,
   .num_ccfg = 1,
   .caps_mask = 0xffff,
   .enabled_caps = 0xffff,
@@ -22,8 +22,9 @@ extern const sli_bt_gattdb_t gattdb;
 #define gattdb_cmd_ota_control                23
 #define gattdb_cmd_beacon_rate_setting        25
 #define gattdb_cmd_tag_features_control       27
-#define gattdb_ota                            28
-#define gattdb_ota_control                    30
+#define gattdb_cmd_tag_config                 29
+#define gattdb_ota                            30
+#define gattdb_ota_control                    32
 
 
 #endif // __GATT_DB_H
@@ -9,7 +9,9 @@
 #ifndef BLE_MANAGER_MACHINE_H_
 #define BLE_MANAGER_MACHINE_H_
 
+#include "stdint.h"
 #include "stdbool.h"
+#include "tag_defines.h"
 #include "tag_main_machine.h"
 
 //******************************************************************************
@@ -17,6 +19,36 @@
 //******************************************************************************
 #define BLE_MSG_MAX_DATASIZE         (23)
 
+/** BLE spec. limits for advertising interval (ms) **/
+#define BMM_ADV_MIN_INTERVAL_MS      (20)
+#define BMM_ADV_MAX_INTERVAL_MS      (10000)
+
+/** BLE Stack external signals (sl_bt_external_signal) **/
+#define BMM_EXT_SIGNAL_START_ADV     (1 << 0)
+#define BMM_EXT_SIGNAL_UPDATE_ADV_DATA (1 << 1)
+#define BMM_EXT_SIGNAL_RESTART_ADV   (1 << 2)
+#define BMM_EXT_SIGNAL_SCAN_WINDOW_END (1 << 3)
+#define BMM_EXT_SIGNAL_CONN_TIMEOUT  (1 << 4)
+
+/** Scan windows opened after advertising (reader ack, downlink) **/
+#define BMM_SCAN_WINDOW_MIN_MS       (10)
+#define BMM_SCAN_WINDOW_MAX_MS       (500)
+
+/** Reader acknowledgment: Service Data (GuardRFID UUID) | BMM_ACK_FRAME_TYPE | Tag identity address (LE) |
+ *  Counter (LE, of the acknowledged ADV_PDU) | MIC (CMAC over BD_ADDR | frame with K_ack, see tag_beacon_auth.h) **/
+#define BMM_ACK_FRAME_TYPE           (0xAC)
+#define BMM_ACK_WINDOW_DEFAULT_MS    (30)               /* Scan window opened after each advertising attempt */
+
+/** Downlink slots (see tag_command.h for the command frame) **/
+#define BMM_DL_WINDOW_DEFAULT_MS     (15)               /* Scan window opened once advertising set is over */
+#define BMM_DL_PERIOD_DEFAULT        (8)                /* One downlink window every 8 advertising sets */
+
+/** GATT provisioning (see tag_configuration.h for the configuration batch) **/
+#define BMM_PROV_WINDOW_MAX_SEC      (600)
+#define BMM_PROV_BOOT_WINDOW_SEC     (30)               /* Advertising sets are connectable right after a power-up (or manufacturing boot) */
+#define BMM_PROV_CONN_TIMEOUT_MS     (3000)             /* Link is dropped if no configuration was written meanwhile */
+#define BMM_PROV_CLOSE_DELAY_MS      (100)              /* Write response goes out before tag closes the link */
+
 //******************************************************************************
 // Extern global variables
 //******************************************************************************
@@ -30,6 +62,7 @@ typedef enum bmm_states_t {
     BMM_PROCESS_CFG_REQ,
     BMM_PROCESS_MSG_EVENTS,
     BMM_START_ADV,
+    BMM_PROCESS_URGENT_MSG,
     BMM_START,
     BMM_EXIT
 } bmm_states_t;
@@ -39,6 +72,21 @@ typedef struct bmm_fsm_t {
     bmm_states_t return_state;
 } bmm_fsm_t;
 
+/** BLE Manager message queues **/
+typedef enum bmm_msg_priority_t {
+    BMM_MSG_CRITICAL = 0,             /* Async events (e.g. entering LF field), always advertised first */
+    BMM_MSG_PERIODIC,                 /* Sync events, oldest message is dropped when queue is full */
+    BMM_MSG_PRIORITY_MAX
+} bmm_msg_priority_t;
+
+/** RF profiles by message class (higher value is higher class) **/
+typedef enum bmm_rf_profile_t {
+    BMM_RF_PROFILE_ROUTINE = 0,       /* Periodic reports (temperature, uptime, fw rev, ext. status) */
+    BMM_RF_PROFILE_STANDARD,          /* Tag status, command ack, periodic alarm reports (e.g. staying in field) */
+    BMM_RF_PROFILE_ALARM,             /* Urgent alarms (e.g. entering LF field) */
+    BMM_RF_PROFILE_MAX
+} bmm_rf_profile_t;
+
 /** BLE Tag Beacon Message Types **/
 enum bmm_msg_type_enum {
     BLE_MSG_TAG_STATUS       = 0x01,  /* Tag Status: Motion, Tamper, Ambient Light, etc */
@@ -49,17 +97,18 @@ enum bmm_msg_type_enum {
     BLE_MSG_TEMPERATURE      = 0x07,  /* Temperature message */
     BLE_MSG_TAG_EXT_STATUS   = 0x08,  /* Tag Extended Status message */
     BLE_MSG_UPTIME           = 0x09,  /* Tag Uptime message */
-                                      /* Range 0x0A to 0xFD for future use */
+    BLE_MSG_POWER_STATS      = 0x0A,  /* Power stats telemetry message */
+                                      /* Range 0x0B to 0xFD for future use */
     BLE_MSG_COMMAND_ACK      = 0xFE,  /* ACK for received commands */
     BLE_MSG_FIRMWARE_REV     = 0xFF,  /* BLE Tag FW Revision message */
 };
 
-/** BLE Tag Beacon Message Container **/
+/** BLE Tag Beacon Message Record (overlaid on BLE Manager message ring) **/
 typedef struct bmm_msg_t {
-    uint8_t type;
-    uint8_t data[BLE_MSG_MAX_DATASIZE];
     /* Note: length = (msg_type + msg_data) */
     uint8_t length;
+    uint8_t type;
+    uint8_t data[];
 } bmm_msg_t;
 
 /** BLE Advertising Types (Generic Access Profile) **/
@@ -77,8 +126,48 @@ typedef enum bmm_ble_adv_types_t {
 //******************************************************************************
 void ble_manager_run(void);
 uint32_t bmm_init(void);
-bool bmm_queue_is_empty(void);
-bool bmm_queue_is_full(void);
-uint32_t bmm_enqueue_msg(bmm_msg_t *msg);
+bool bmm_queue_is_empty(bmm_msg_priority_t priority);
+bool bmm_is_idle(void);
+bmm_msg_t* bmm_reserve_msg(bmm_msg_priority_t priority, uint8_t type, uint8_t data_len);
+uint32_t bmm_commit_msg(bmm_msg_priority_t priority, bmm_msg_t *msg);
+void bmm_adv_timeout_handler(void);
+void bmm_external_signal_handler(uint32_t signals);
+bool bmm_is_adv_config_valid(bmm_rf_profile_t profile,
+                             uint8_t retransmissions,
+                             uint16_t min_interval_ms,
+                             uint16_t max_interval_ms,
+                             uint8_t channel_map,
+                             int16_t tx_power);
+uint32_t bmm_set_adv_config(bmm_rf_profile_t profile,
+                            uint8_t retransmissions,
+                            uint16_t min_interval_ms,
+                            uint16_t max_interval_ms,
+                            uint8_t channel_map,
+                            int16_t tx_power);
+void bmm_print_stats(void);
+void bmm_reset_stats(void);
+#if defined(TAG_BLE_EXT_ADV_PRESENT)
+void bmm_set_ext_adv(bool enable);
+bool bmm_is_ext_adv_enabled(void);
+#endif
+#if defined(TAG_ADV_SCAN_RSP_PRESENT)
+void bmm_set_scan_rsp(bool enable);
+bool bmm_is_scan_rsp_enabled(void);
+#endif
+#if defined(TAG_SCAN_WINDOW_PRESENT)
+void bmm_scan_report_handler(const uint8_t *data, uint8_t len);
+#endif
+#if defined(TAG_READER_ACK_PRESENT)
+uint32_t bmm_set_ack_config(bool enable, uint16_t window_ms, uint8_t max_attempts);
+#endif
+#if defined(TAG_DOWNLINK_PRESENT)
+uint32_t bmm_set_dl_config(bool enable, uint16_t window_ms, uint8_t period);
+#endif
+#if defined(TAG_GATT_PROVISIONING_PRESENT)
+uint32_t bmm_open_prov_window(uint16_t window_sec);
+void bmm_on_connection_opened(uint8_t connection);
+void bmm_on_connection_closed(uint8_t connection);
+void bmm_on_config_written(void);
+#endif
 
 #endif /* BLE_MANAGER_MACHINE_H_ */
@@ -361,6 +361,13 @@ typedef struct as39_settings_container_t * as39_settings_handle_t;
  */
 uint32_t as39_init(SPIDRV_Handle_t as39_spi);
 
+/*!
+ *  @brief Attach device driver to an AS393x that kept its settings (EM4 wake-up)
+ *  @param SPIDRV_Handle_t <as39_spi>
+ *  @return @ref AS39_OK on success, otherwise on failure.
+ */
+uint32_t as39_attach(SPIDRV_Handle_t as39_spi);
+
 /*!
  *  @brief Return device driver instance (AS393x register mapping)
  *  @return @ref AS39_OK on success, otherwise on failure.
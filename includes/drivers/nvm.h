@@ -6,6 +6,7 @@
 #define DRIVERS_NVM_H_
 
 #include "tag_beacon_machine.h"
+#include "tag_configuration.h"
 
 //******************************************************************************
 // Defines
@@ -33,4 +34,31 @@ uint32_t nvm_write_mac_address(uint8_t *mac);
 uint32_t nvm_read_tbm_settings(tbm_nvm_data_t *b);
 uint32_t nvm_write_tbm_settings(tbm_nvm_data_t *b);
 
+/**
+ * @brief Read/Write functions for beacon authentication key and counter reservation
+ */
+uint32_t nvm_read_tba_key(uint8_t *key);
+uint32_t nvm_write_tba_key(const uint8_t *key);
+uint32_t nvm_read_tba_counter(uint32_t *counter);
+uint32_t nvm_write_tba_counter(uint32_t counter);
+
+/**
+ * @brief Read/Write functions for last accepted downlink command counter (replay protection)
+ */
+uint32_t nvm_read_tcm_dl_counter(uint32_t *counter);
+uint32_t nvm_write_tcm_dl_counter(uint32_t counter);
+
+/**
+ * @brief Read/Write functions for tag operation mode (@ref tpm_op_mode_t, shelf mode)
+ */
+uint32_t nvm_read_tag_op_mode(uint8_t *op_mode);
+uint32_t nvm_write_tag_op_mode(uint8_t op_mode);
+
+/**
+ * @brief Read/Write functions for provisioned tag configuration
+ * @note Write stores the whole batch (beacon rates optional) with a single repack.
+ */
+uint32_t nvm_read_tag_configuration(tcf_nvm_data_t *c);
+uint32_t nvm_write_tag_configuration(const tcf_nvm_data_t *c, const tbm_nvm_data_t *b);
+
 #endif /* DRIVERS_NVM_H_ */
@@ -7,6 +7,11 @@
 #define DRIVERS_RTCC_H_
 
 #include "em_rtcc.h"
+#include "em_core.h"
+
+/*! @brief Highest priority still masked by CORE atomic sections (LF decoder edges must not wait for
+ *  Tag Main Machine, see TMM_SW_IRQ_PRIORITY) */
+#define RTCC_IRQ_PRIORITY            (CORE_ATOMIC_BASE_PRIORITY_LEVEL)
 
 void rtcc_init(void);
 
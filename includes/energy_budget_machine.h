@@ -0,0 +1,75 @@
+/*
+ * energy_budget_machine.h
+ *
+ *  This module runs from Tag Main Machine ISR context (slow task).
+ *
+ *  Keeps track of the charge drawn from the battery by counting energy relevant
+ *  events (adverts, retransmissions, HFXO on-time, LF wake-ups) and converting
+ *  them using the per-event charge constants below. Projects the remaining battery
+ *  life and stretches the slow beacon rate when the projection falls below target.
+ *
+ */
+
+#ifndef ENERGY_BUDGET_MACHINE_H_
+#define ENERGY_BUDGET_MACHINE_H_
+
+#include "stdint.h"
+#include "stdbool.h"
+#include "tag_defines.h"
+
+//******************************************************************************
+// Defines
+//******************************************************************************
+/** Battery and contracted lifetime **/
+#define EBM_BATTERY_CAPACITY_MAH             (220)      /* Usable battery capacity (mAh) */
+#define EBM_TARGET_LIFETIME_DAYS             (1095)     /* Contracted battery lifetime (3 years) */
+
+/** Per-event charge constants (nano-Coulombs) **/
+#define EBM_CHARGE_ADV_NC                    (10000)    /* Advertising set start (API calls + first adv. event on 3 channels) */
+#define EBM_CHARGE_ADV_RETX_NC               (8000)     /* Each additional adv. event (retransmission on 3 channels) */
+#define EBM_CHARGE_HFXO_NC_PER_MS            (1000)     /* EM0/EM1 running on HFXO (~1 mA) */
+#define EBM_CHARGE_LF_WAKEUP_NC              (100)      /* LF decoder wake-up (preamble edge detection) */
+#define EBM_CHARGE_RX_NC_PER_MS              (3600)     /* Radio RX (scanning for reader ack), on top of HFXO on-time */
+#define EBM_SLEEP_CURRENT_NA                 (4500)     /* Baseline: EM2 + LFXO + RTCC + AS393x listening mode */
+
+/** Governor settings **/
+#if defined(TAG_DEV_MODE_PRESENT)
+#define EBM_GOVERNOR_PERIOD_SEC              (300)      /* Re-evaluate lifetime projection every 5 minutes */
+#else
+#define EBM_GOVERNOR_PERIOD_SEC              (3600)     /* Re-evaluate lifetime projection every hour */
+#endif
+#define EBM_STRETCH_MIN_PCT                  (100)      /* Slow beacon rate is never shortened by the governor */
+#define EBM_STRETCH_MAX_PCT                  (400)      /* Slow beacon rate can be stretched up to 4x */
+#define EBM_STRETCH_STEP_PCT                 (25)
+#define EBM_STRETCH_HYSTERESIS_PCT           (10)       /* Projection must beat target by this margin before relaxing */
+
+/** Energy accounting size in 32-bit words (kept over EM4 in retention registers, see shelf mode) **/
+#define EBM_RETAINED_WORDS                   (4)
+
+//******************************************************************************
+// Data types
+//******************************************************************************
+typedef enum ebm_events_t {
+    EBM_EVT_ADV = 0,
+    EBM_EVT_ADV_RETX,
+    EBM_EVT_LF_WAKEUP,
+    EBM_EVT_RX_MS,                     /* counted per ms of RX */
+    EBM_EVT_MAX
+} ebm_events_t;
+
+//******************************************************************************
+// Interface
+//******************************************************************************
+void ebm_count_event(ebm_events_t event, uint32_t count);
+void ebm_add_hfxo_time(uint32_t time_ms);
+uint16_t ebm_get_remaining_life_days(void);
+uint16_t ebm_get_slow_rate_stretch(void);
+void energy_budget_run(void);
+uint32_t ebm_init(void);
+void ebm_preinit(void);
+#if defined(TAG_SHELF_MODE_PRESENT)
+void ebm_retained_save(volatile uint32_t *regs);
+void ebm_retained_restore(const volatile uint32_t *regs);
+#endif
+
+#endif /* ENERGY_BUDGET_MACHINE_H_ */
@@ -55,6 +55,8 @@ void lf_decoder_compare_isr(void);
 void lf_decoder_capture_isr(void);
 bool lf_decoder_is_enabled(void);
 void lf_decoder_enable(bool enable);
+void lf_decoder_print_stats(void);
+void lf_decoder_reset_stats(void);
 void lf_decoder_init(void);
 
 #endif /* LF_DECODER_H_ */
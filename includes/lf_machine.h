@@ -11,6 +11,7 @@
 #ifndef LF_MACHINE_H_
 #define LF_MACHINE_H_
 
+#include "tag_defines.h"
 #include "lf_decoder.h"
 
 //******************************************************************************
@@ -21,6 +22,11 @@
 #define LFM_STAYING_IN_FIELD_FLAG              (0x04)
 #define LFM_ENTERING_FIELD_FLAG                (0x08)
 
+/** LF policy limits (see lfm_set_policy) **/
+#define LFM_EXIT_FIELD_MIN_MS                  (1000)
+#define LFM_EXIT_FIELD_MAX_MS                  (60000)
+#define LFM_TA_CONFIRM_MAX                     (10)
+
 //******************************************************************************
 // Extern global variables
 //******************************************************************************
@@ -47,11 +53,27 @@ typedef struct lfm_lf_beacon_t {
     };
 } lfm_lf_beacon_t;
 
+#if defined(TAG_RETAINED_STATE_PRESENT)
+//! @brief LF field membership kept over warm resets (see tag_retained_state)
+typedef struct lfm_retained_t {
+    uint8_t status;
+    uint8_t command;                  /* current LF field */
+    uint16_t id;
+    uint16_t exit_ticks;              /* Exiting Field timeout left (0: not in a field) */
+    lfm_lf_beacon_t beacon;           /* last LF message (sent again if it was not advertised) */
+} lfm_retained_t;
+#endif
+
 //******************************************************************************
 // Interface
 //******************************************************************************
 lfm_lf_beacon_t* lfm_get_beacon_data(void);
 uint8_t lfm_get_lf_status(void);
+uint32_t lfm_set_policy(uint16_t exit_field_ms, uint8_t ta_confirm_n_times);
+#if defined(TAG_RETAINED_STATE_PRESENT)
+void lfm_get_retained(lfm_retained_t *r);
+void lfm_restore(const lfm_retained_t *r);
+#endif
 void lf_run(void);
 uint32_t lfm_init(void);
 
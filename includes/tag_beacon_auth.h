@@ -0,0 +1,77 @@
+/*
+ * tag_beacon_auth.h
+ *
+ *  Authenticated (encrypted + signed) beacon payloads.
+ *
+ *  Beacon messages in the Service Data are encrypted with AES-CTR and signed
+ *  with a truncated AES-CMAC (hardware AES engine through PSA Crypto). Each
+ *  frame uses a new value of a monotonic counter persisted in NVM, keystream
+ *  for the next frame is precomputed in idle time so sealing a frame only
+ *  costs a XOR and the MIC computation.
+ *
+ *  Secured Service Data layout (see tools/beacon_decoder.py):
+ *
+ *      | Tag Type ID | Counter (LE) | Beacon messages (encrypted) | MIC |
+ *      |  1 (bit 7)  |      4       |             N               |  4  |
+ *
+ *  Keystream block i = AES(K, BD_ADDR[6] | Counter[4] (LE) | 0[5] | i)
+ *  MIC = CMAC(K_mac, BD_ADDR[6] | Tag Type ID | Counter | Ciphertext) truncated to 4 bytes
+ *  K_mac = AES(K, TBA_MAC_KEY_LABEL repeated 16 times)
+ *
+ *  Frames received from readers are signed the same way, each kind with its own key so a
+ *  MIC computed for one kind of frame is never valid for another:
+ *  K_dl = AES(K, "DL" | 0[14])         downlink commands (@ref tba_verify, tag_command.h)
+ *  K_ack = AES(K, "AK" | 0[14])        reader acknowledgments (ble_manager_machine.h)
+ *  K_cfg = AES(K, "CF" | 0[14])        GATT configuration batches (@ref tba_verify_config, tag_configuration.h)
+ *
+ */
+
+#ifndef TAG_BEACON_AUTH_H_
+#define TAG_BEACON_AUTH_H_
+
+#include "stdint.h"
+#include "stdbool.h"
+#include "tag_defines.h"
+
+//******************************************************************************
+// Defines
+//******************************************************************************
+#define TBA_KEY_LEN                  (16)               /* AES-128 */
+#define TBA_COUNTER_LEN              (4)
+#define TBA_MIC_LEN                  (4)
+#define TBA_OVERHEAD_LEN             (TBA_COUNTER_LEN + TBA_MIC_LEN)
+#define TBA_FRAME_SECURED            (0x80)             /* Set in Tag Type ID byte of secured frames */
+#define TBA_MAC_KEY_LABEL            (0xA5)
+#define TBA_DL_KEY_LABEL             "DL"               /* zero padded to one AES block */
+#define TBA_ACK_KEY_LABEL            "AK"               /* zero padded to one AES block */
+#define TBA_CFG_KEY_LABEL            "CF"               /* zero padded to one AES block */
+#define TBA_COUNTER_BLOCK            (256)              /* Counter values reserved in NVM per write */
+
+#if defined(TAG_BLE_EXT_ADV_PRESENT)
+#define TBA_KEYSTREAM_LEN            (256)              /* Covers extended ADV_PDU beacon messages */
+#else
+#define TBA_KEYSTREAM_LEN            (32)               /* Covers legacy ADV_PDU beacon messages */
+#endif
+
+#define TBA_BENCH_ITERATIONS         (100)
+#define TBA_BENCH_PLAIN_LEN          (18)               /* Legacy ADV_PDU with local name, fully packed */
+
+//******************************************************************************
+// Data types
+//******************************************************************************
+
+//******************************************************************************
+// Interface
+//******************************************************************************
+bool tba_is_enabled(void);
+uint32_t tba_seal(uint8_t *frame, uint16_t plain_len);
+void tba_unseal(uint8_t *frame, uint16_t plain_len);
+uint32_t tba_verify(const uint8_t *frame, uint16_t len);
+uint32_t tba_verify_ack(const uint8_t *frame, uint16_t len);
+uint32_t tba_verify_config(const uint8_t *frame, uint16_t len);
+void tba_process(void);
+void tba_print_stats(void);
+void tba_benchmark(void);
+uint32_t tba_init(const uint8_t *address);
+
+#endif /* TAG_BEACON_AUTH_H_ */
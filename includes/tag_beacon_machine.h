@@ -12,6 +12,8 @@
 #define TAG_BEACON_MACHINE_H_
 
 #include "stdbool.h"
+#include "stdint.h"
+#include "tag_defines.h"
 
 //******************************************************************************
 // Defines
@@ -24,6 +26,7 @@
 
 #define TBM_SLOW_BEACON_RATE_SEC              (600)                             // Default is 10 minutes
 #define TBM_SLOW_BEACON_RATE_RELOAD           ((TBM_SLOW_BEACON_RATE_SEC * 1000) / TMM_RTCC_TIMER_PERIOD_MS)
+#define TBM_SLOW_BEACON_RATE_RELOAD_MAX       ((0xFFFFUL * 1000) / TMM_RTCC_TIMER_PERIOD_MS)   // Upper bound for stretched slow rate
 
 //******************************************************************************
 // Data types
@@ -37,9 +40,19 @@ typedef enum tbm_beacon_events_t {
     TBM_CMD_ACK_EVT        = (1 << 7),
     TBM_TEMPERATURE_EVT    = (1 << 8),
     TBM_FIRMWARE_REV_EVT   = (1 << 9),
-    TBM_UPTIME_EVT         = (1 << 10)
+    TBM_UPTIME_EVT         = (1 << 10),
+    TBM_POWER_STATS_EVT    = (1 << 11)
 } tbm_beacon_events_t;
 
+#if defined(TAG_RETAINED_STATE_PRESENT)
+//! @brief Pending events and beacon schedule kept over warm resets (see tag_retained_state)
+typedef struct tbm_retained_t {
+    uint32_t events;
+    uint32_t async_events;            /* critical events, including those not advertised yet */
+    uint16_t beacon_ticks;            /* ticks to next sync beacon (0: sync beacon is held) */
+} tbm_retained_t;
+#endif
+
 typedef struct tbm_nvm_data_t {
     bool is_erased;           /* if is_erased = "true" factory defined values will be loaded instead during machine init */
     uint16_t fast_rate;
@@ -51,8 +64,14 @@ typedef struct tbm_nvm_data_t {
 //******************************************************************************
 void tbm_set_event(tbm_beacon_events_t event, bool is_async);
 void tbm_apply_new_settings(tbm_nvm_data_t *b);
+void tbm_set_slow_rate_stretch(uint16_t stretch_pct);
 uint16_t tbm_get_fast_beacon_rate(void);
 uint16_t tbm_get_slow_beacon_rate(void);
+bool tbm_get_sync_beacon_tick(uint32_t *tick);
+#if defined(TAG_RETAINED_STATE_PRESENT)
+void tbm_get_retained(tbm_retained_t *r);
+void tbm_restore(const tbm_retained_t *r);
+#endif
 void tag_beacon_run(void);
 uint32_t tbm_init(void);
 
@@ -1,20 +1,70 @@
 /*
  * tag_command_.h
  *
+ *  Tag commands, shared by CLI and connectionless downlink.
+ *
+ *  Downlink commands are sent by readers in a Service Data AD (GuardRFID UUID) while
+ *  the tag listens in a short scan window right after its own advertising set (see
+ *  ble_manager_machine). They are signed with a key derived from the beacon auth. key (@ref tba_verify)
+ *  and carry a counter that must increase from one command to the next.
+ *
+ *      | Frame Type | Tag Address (LE) | Counter (LE) | Command ID | Parameters | MIC |
+ *      |     1      |        6         |      4       |     1      |   0 to 8   |  4  |
+ *
+ *  MIC = CMAC(K_dl, BD_ADDR[6] | Frame Type .. Parameters) truncated to 4 bytes (K_dl, see tag_beacon_auth.h)
+ *
+ *  Commands run from Tag Main Machine ISR context (@ref tcm_run) and are answered with
+ *  a BLE_MSG_COMMAND_ACK beacon message. NVM writes are left to main context (see
+ *  @ref tcm_external_signal_handler). Commands taking the tag off air (deep sleep,
+ *  current draw) are executed once their ack was advertised.
  */
 
 #ifndef TAG_COMMAND_H_
 #define TAG_COMMAND_H_
 
+#include "stdint.h"
 #include "stdbool.h"
+#include "tag_defines.h"
 
 //******************************************************************************
 // Defines
 //******************************************************************************
+#define TCM_DL_FRAME_TYPE            (0xDC)
+#define TCM_DL_ADDRESS_LEN           (6)
+#define TCM_DL_COUNTER_LEN           (4)
+#define TCM_DL_MIC_LEN               (4)
+#define TCM_DL_HEADER_LEN            (1 + TCM_DL_ADDRESS_LEN + TCM_DL_COUNTER_LEN + 1)
+#define TCM_DL_MIN_LEN               (TCM_DL_HEADER_LEN + TCM_DL_MIC_LEN)
+#define TCM_DL_MAX_PARAMS_LEN        (8)
+
+/** BLE Stack external signals (sl_bt_external_signal, bits 0 to 4 are BMM_EXT_SIGNAL_*) **/
+#define TCM_EXT_SIGNAL_SAVE_BEACON_RATE (1 << 5)
+#define TCM_EXT_SIGNAL_DEEP_SLEEP    (1 << 6)
 
 //******************************************************************************
 // Data types
 //******************************************************************************
+/** Downlink Command IDs (parameters are little-endian) **/
+typedef enum tcm_cmd_id_t {
+    TCM_CMD_BEACON_RATE      = 0x01,  /* slow rate (sec, 2 bytes), fast rate (x250 ms, 2 bytes) */
+    TCM_CMD_DEEP_SLEEP       = 0x02,  /* no parameters */
+    TCM_CMD_CURRENT_DRAW     = 0x03,  /* reset delay (ms, 4 bytes), 0: stays until HW reset */
+    TCM_CMD_PROVISIONING     = 0x04,  /* GATT provisioning window (sec, 2 bytes), 0 closes it */
+} tcm_cmd_id_t;
+
+typedef enum tcm_cmd_status_t {
+    TCM_CMD_OK = 0,
+    TCM_CMD_INVALID_PARAM,
+    TCM_CMD_NOT_SUPPORTED,
+    TCM_CMD_FAILED
+} tcm_cmd_status_t;
+
+/** Command Ack beacon message data **/
+typedef struct tcm_cmd_ack_t {
+    uint8_t cmd_id;
+    uint8_t status;                   /* @ref tcm_cmd_status_t */
+    uint16_t counter;                 /* low 16 bits of the command counter */
+} tcm_cmd_ack_t;
 
 //******************************************************************************
 // Extern global variables
@@ -23,7 +73,16 @@
 //******************************************************************************
 // Interface
 //******************************************************************************
-void tcm_cmd_enter_deep_sleep_mode(void);
-void tcm_cmd_enter_current_draw_mode(void);
+uint32_t tcm_cmd_set_beacon_rate(uint16_t slow_rate, uint16_t fast_rate);
+uint32_t tcm_cmd_enter_deep_sleep_mode(void);
+uint32_t tcm_cmd_enter_current_draw_mode(uint32_t reset_delay_ms);
+void tcm_external_signal_handler(uint32_t signals);
+#if defined(TAG_DOWNLINK_PRESENT)
+uint32_t tcm_post_downlink_cmd(const uint8_t *frame, uint8_t len);
+tcm_cmd_ack_t* tcm_get_cmd_ack_beacon_data(void);
+void tcm_print_stats(void);
+void tcm_run(void);
+uint32_t tcm_init(void);
+#endif
 
 #endif /* TAG_COMMAND_H_ */
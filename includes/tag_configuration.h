@@ -1,14 +1,42 @@
 /*
  * tag_configuration.h
  *
+ *  Tag configuration written by a provisioning station over GATT (cmd_tag_config
+ *  characteristic), see ble_manager_machine for the connectable provisioning window.
+ *
+ *  The whole configuration is a batch of TLV settings sent in a single write request
+ *  (station negotiates an ATT MTU of TCF_BATCH_MAX_LEN + 3 or more, long writes are
+ *  not supported). Batch is checked as a whole before anything is applied, stored
+ *  into NVM at once and the tag closes the link right after the write response.
+ *
+ *      | Counter (LE) | Type | Length | Value  | Type | Length | Value  | ... | MIC |
+ *      |      4       |  1   |   1    | Length |  1   |   1    | Length |     |  4  |
+ *
+ *  MIC = CMAC(K_cfg, BD_ADDR[6] | Counter .. last TLV) truncated to 4 bytes (K_cfg, see
+ *  tag_beacon_auth.h). Counter must be above the one of the last applied batch (kept in
+ *  NVM with the configuration), so a batch cannot be replayed.
+ *
+ *  Settings not present in the batch keep their provisioned (or default) value.
+ *  Multi-byte values are little-endian. Write response carries @ref tcf_status_t
+ *  as ATT error code.
  */
 
 #ifndef TAG_CONFIGURATION_H_
 #define TAG_CONFIGURATION_H_
 
+#include "stdint.h"
+#include "stdbool.h"
+#include "tag_defines.h"
+#include "ble_manager_machine.h"
+
 //******************************************************************************
 // Defines
 //******************************************************************************
+#define TCF_BATCH_MAX_LEN            (128)              /* cmd_tag_config characteristic length */
+#define TCF_BATCH_COUNTER_LEN        (4)
+#define TCF_BATCH_MIC_LEN            (4)
+#define TCF_BATCH_OVERHEAD_LEN       (TCF_BATCH_COUNTER_LEN + TCF_BATCH_MIC_LEN)
+#define TCF_TLV_HEADER_LEN           (2)
 
 //******************************************************************************
 // Extern global variables
@@ -17,9 +45,64 @@
 //******************************************************************************
 // Data types
 //******************************************************************************
+/** Configuration TLV types **/
+typedef enum tcf_tlv_type_t {
+    TCF_TLV_BEACON_RATE      = 0x01,  /* slow rate (sec, 2 bytes), fast rate (x250 ms, 2 bytes) */
+    TCF_TLV_RF_PROFILE       = 0x02,  /* profile, events, min ms (2 bytes), max ms (2 bytes), channel map, tx power (0.1 dBm, 2 bytes) */
+    TCF_TLV_LF_POLICY        = 0x03,  /* exit field timeout (ms, 2 bytes), TA command confirmations */
+    TCF_TLV_READER_ACK       = 0x04,  /* enable, window (ms, 2 bytes), max attempts */
+    TCF_TLV_DOWNLINK         = 0x05,  /* enable, window (ms, 2 bytes), period (adv. sets) */
+    TCF_TLV_SCAN_RSP         = 0x06,  /* enable */
+    TCF_TLV_EXT_ADV          = 0x07,  /* enable */
+    TCF_TLV_MAX
+} tcf_tlv_type_t;
+
+/** Batch status (ATT error codes, 0x80 and above are application errors) **/
+typedef enum tcf_status_t {
+    TCF_OK                   = 0x00,
+    TCF_ERR_NOT_SUPPORTED    = 0x06,  /* ATT Request Not Supported (other characteristics, long writes) */
+    TCF_ERR_LENGTH           = 0x0D,  /* ATT Invalid Attribute Value Length (empty batch, truncated TLV) */
+    TCF_ERR_UNKNOWN_TLV      = 0x80,  /* TLV type unknown or not built in this firmware */
+    TCF_ERR_TLV_LENGTH       = 0x81,  /* TLV length does not match its type */
+    TCF_ERR_VALUE            = 0x82,  /* setting out of range */
+    TCF_ERR_NVM              = 0x83,  /* batch could not be stored, nothing was applied */
+    TCF_ERR_AUTH             = 0x84   /* MIC not valid or counter not above last batch one */
+} tcf_status_t;
+
+/** Provisioned RF profile (see @ref bmm_set_adv_config) **/
+typedef struct tcf_rf_profile_t {
+    uint16_t min_interval_ms;
+    uint16_t max_interval_ms;
+    int16_t tx_power;
+    uint8_t events;
+    uint8_t channel_map;
+} tcf_rf_profile_t;
+
+/** Tag configuration NVM record (beacon rates are stored by Tag Beacon Machine) **/
+typedef struct tcf_nvm_data_t {
+    uint32_t counter;                 /* counter of the last applied batch */
+    uint16_t fields;                  /* bit n: TLV type n was provisioned */
+    uint8_t rf_profiles;              /* bit n: RF profile n was provisioned */
+    uint8_t scan_rsp;
+    tcf_rf_profile_t rf_profile[BMM_RF_PROFILE_MAX];
+    uint16_t lf_exit_field_ms;
+    uint8_t lf_ta_confirm_n_times;
+    uint8_t ext_adv;
+    uint16_t ack_window_ms;
+    uint8_t ack_enabled;
+    uint8_t ack_max_attempts;
+    uint16_t dl_window_ms;
+    uint8_t dl_enabled;
+    uint8_t dl_period;
+} tcf_nvm_data_t;
 
 //******************************************************************************
 // Interface
 //******************************************************************************
+#if defined(TAG_GATT_PROVISIONING_PRESENT)
+tcf_status_t tcf_apply_batch(const uint8_t *batch, uint16_t len);
+void tcf_print_stats(void);
+uint32_t tcf_init(void);
+#endif
 
 #endif /* TAG_CONFIGURATION_H_ */
@@ -44,6 +44,58 @@
 /** Development Mode **/
 #define TAG_DEV_MODE_PRESENT
 
+/** BLE Advertising Local Name (comment out to reclaim its payload bytes for beacon messages) **/
+#define TAG_ADV_LOCAL_NAME_PRESENT
+//#define TAG_ADV_LOCAL_NAME_SHORTENED
+#define TAG_ADV_SHORT_NAME_LEN       (1)
+
+/** BLE 5 Extended Advertising (off by default, used only when pending messages do not fit a legacy ADV_PDU) **/
+/** Note: requires bluetooth_feature_extended_advertiser component **/
+#define TAG_BLE_EXT_ADV_PRESENT
+
+/** Scan Response (Firmware Revision and Tag Extended Status served on scan request instead of every ADV_PDU, not used with beacon auth. on since it is not sealed) **/
+#define TAG_ADV_SCAN_RSP_PRESENT
+
+/** Authenticated Beacons (AES-CTR + truncated CMAC, only active once a key is provisioned in NVM) **/
+#define TAG_BEACON_AUTH_PRESENT
+
+/** Reader Acknowledgment (scan window after critical adverts, retransmissions cancelled once a signed ack is received, requires beacon auth.) **/
+#define TAG_READER_ACK_PRESENT
+
+/** Downlink Commands (signed reader commands received in a scan window after advertising) **/
+#define TAG_DOWNLINK_PRESENT
+
+/** GATT Provisioning (connectable window, signed tag configuration written in a single GATT write, requires beacon auth.) **/
+#define TAG_GATT_PROVISIONING_PRESENT
+
+/** Tickless Tag Main Machine (runs on next machine deadline instead of every tick while BLE is idle) **/
+#define TAG_TICKLESS_PRESENT
+
+/** Tag Main Machine profiler (DWT cycles per machine, development builds only) **/
+#define TAG_PROFILER_PRESENT
+
+/** Energy modes residency and wake-up sources accounting (CLI report) **/
+#define TAG_POWER_STATS_PRESENT
+
+/** Power stats telemetry beacon message (sent with Tag Extended Status) **/
+#define TAG_POWER_STATS_BEACON_PRESENT
+
+/** HFXO pre-warm (crystal started ahead of scheduled sync beacons) **/
+/** Note: off until its saving is measured ("power stats", ready on advert vs. EM1 time added) **/
+//#define TAG_HFXO_PREWARM_PRESENT
+
+/** Shelf Mode (deep sleep command, EM4 until RFSENSE or LF activation, fast resume) **/
+#define TAG_SHELF_MODE_PRESENT
+
+/** Boot tracer (boot phases timestamps, printed when a CLI session starts) **/
+#define TAG_BOOT_TRACE_PRESENT
+
+/** Fast Boot (first beacon right away, diagnostics prints wait for it, silent watchdog/brown-out resets) **/
+#define TAG_FAST_BOOT_PRESENT
+
+/** Retained State (LF field, pending critical events, beacon phase kept over warm resets) **/
+#define TAG_RETAINED_STATE_PRESENT
+
 // Compilation Switches Dependencies -------------------------------------------
 #if defined(TAG_CLI_PRESENT)
 #ifndef TAG_LOG_PRESENT
@@ -53,6 +105,35 @@
 
 #ifndef TAG_DEV_MODE_PRESENT
 #undef TAG_TRAP_PRESENT
+#undef TAG_PROFILER_PRESENT
+#endif
+
+#ifndef TAG_ADV_LOCAL_NAME_PRESENT
+#undef TAG_ADV_LOCAL_NAME_SHORTENED
+#endif
+
+#ifndef TAG_POWER_STATS_PRESENT
+#undef TAG_POWER_STATS_BEACON_PRESENT
+#endif
+
+// Fast boot waits for the boot tracer first advert mark
+#if defined(TAG_FAST_BOOT_PRESENT)
+#ifndef TAG_BOOT_TRACE_PRESENT
+#define TAG_BOOT_TRACE_PRESENT
+#endif
+#endif
+
+// Downlink commands, reader acks and configuration batches are only accepted once signed
+// with a key derived from the beacon auth. key
+#ifndef TAG_BEACON_AUTH_PRESENT
+#undef TAG_DOWNLINK_PRESENT
+#undef TAG_READER_ACK_PRESENT
+#undef TAG_GATT_PROVISIONING_PRESENT
+#endif
+
+// Scan window after advertising (shared by reader ack and downlink)
+#if defined(TAG_READER_ACK_PRESENT) || defined(TAG_DOWNLINK_PRESENT)
+#define TAG_SCAN_WINDOW_PRESENT
 #endif
 
 //******************************************************************************
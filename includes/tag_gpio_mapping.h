@@ -28,6 +28,9 @@
 #define TAG_GPIO_AS39_DATA_PIN                 (0)
 #define TAG_GPIO_AS39_LF_WAKEUP_PORT
 #define TAG_GPIO_AS39_LF_WAKEUP_PIN
+/* AS393x WAKE routed to an EM4 wake-up pin (EM4WUx mask) ends shelf mode on LF activation.
+ * Not routed on this board, RFSENSE only. */
+//#define TAG_GPIO_AS39_LF_WAKEUP_EM4WU          (GPIO_IEN_EM4WUIEN0)
 
 /* UART - USART1 */
 #define TAG_GPIO_UART_TX_PORT                  (gpioPortA)
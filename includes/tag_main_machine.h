@@ -7,6 +7,17 @@
  * It is cooperative multitasking which means every Machine called is responsible
  * to yield back to the main machine super loop.
  *
+ * RTCC CC1 interrupt only posts a run, machines run from TMM_SW_IRQn with interrupts
+ * enabled so LF decoder edges (RTCC CC0) are not held back by them.
+ *
+ * With TAG_TICKLESS_PRESENT the RTCC compare is programmed for the earliest machine
+ * deadline instead (whole ticks only, so time keeps the TMM_RTCC_TIMER_PERIOD_MS grid)
+ * while BLE Manager is idle. Asynchronous sources call tmm_wakeup().
+ *
+ * Machines register themselves with TMM_MACHINE() (linker section .tmm_machines, sorted
+ * by init order). Slow tasks declare a period and a phase so they do not all run in the
+ * same tick.
+ *
  */
 
 #ifndef TAG_MAIN_MACHINE_H_
@@ -14,6 +25,7 @@
 
 #include "stdio.h"
 #include "stdbool.h"
+#include "stdint.h"
 
 //******************************************************************************
 // Defines
@@ -22,13 +34,50 @@
 #define TMM_RTCC_TIMER_PERIOD_MS                    (250)
 #define TMM_RTCC_TIMER_RELOAD                       ((32768 * TMM_RTCC_TIMER_PERIOD_MS)/1000)
 
-/*! @brief Tag Main Machine slow task tick period (in mS) */
-#define TMM_SLOW_TASK_TIMER_PERIOD_MS               (1000)
-#define TMM_SLOW_TASK_TIMER_RELOAD                  (TMM_SLOW_TASK_TIMER_PERIOD_MS / TMM_RTCC_TIMER_PERIOD_MS)
+#define TMM_TICKS_PER_SEC                           (1000 / TMM_RTCC_TIMER_PERIOD_MS)
+#define TMM_SEC_TO_TICKS(sec)                       ((uint32_t)(sec) * TMM_TICKS_PER_SEC)
+
+/*! @brief Tickless mode, longest sleep between two ticks (in sec) */
+#define TMM_TICKLESS_MAX_SLEEP_SEC                  (600)
+#define TMM_TICKLESS_MAX_SLEEP_TICKS                (TMM_SEC_TO_TICKS(TMM_TICKLESS_MAX_SLEEP_SEC))
+
+/*! @brief Shortest RTCC compare offset (in RTCC counts) */
+#define TMM_RTCC_MIN_OFFSET                         (3)
 
 /*! @brief Tag Main Machine RTCC channel */
 #define TMM_RTCC_CC1                                (1)
 
+/*! @brief Most machines TMM_MACHINE() can register (Tag Main Machine state is kept in RAM) */
+#define TMM_MACHINES_MAX                            (16)
+
+/*! @brief Slow tasks period (ticks), each slow task takes its own phase (0 to TMM_TICKS_PER_SEC - 1) */
+#define TMM_SLOW_TASK_PERIOD                        (TMM_TICKS_PER_SEC)
+
+/**
+ * @brief Register a machine into Tag Main Machine
+ * @param order init order, two digits (machines are initialized in ascending order)
+ * @param id C identifier, unique
+ * @param name_str profiler name
+ * @param init_fn called once by @ref tmm_start, or NULL
+ * @param run_fn slow task, or NULL for machines Tag Main Machine calls on its own
+ * @param period_ticks ticks between two runs of run_fn
+ * @param phase_ticks tick offset inside period_ticks (less than period_ticks)
+ */
+#define TMM_MACHINE(order, id, name_str, init_fn, run_fn, period_ticks, phase_ticks)     \
+    static const tmm_machine_t tmm_machine_##id                                         \
+    __attribute__ ((used, section(".tmm_machines." #order))) = {                        \
+        .name = (name_str),                                                             \
+        .init = (init_fn),                                                              \
+        .run = (run_fn),                                                                \
+        .period = (period_ticks),                                                       \
+        .phase = (phase_ticks),                                                         \
+    }
+
+/*! @brief Tag Main Machine deferred context (unused peripheral IRQ, pended by software) */
+#define TMM_SW_IRQn                                 LETIMER0_IRQn
+#define TMM_SW_IRQHandler                           LETIMER0_IRQHandler
+#define TMM_SW_IRQ_PRIORITY                         (CORE_ATOMIC_BASE_PRIORITY_LEVEL + 1)   /* below RTCC (LF decoder) */
+
 //******************************************************************************
 // Extern global variables
 //******************************************************************************
@@ -42,6 +91,15 @@ typedef enum tmm_modes_t {
     TMM_PAUSED,
 } tmm_modes_t;
 
+//! @brief Tag Main Machine registry entry (see @ref TMM_MACHINE)
+typedef struct tmm_machine_t {
+    const char *name;
+    uint32_t (*init)(void);
+    void (*run)(void);
+    uint16_t period;                  /* ticks */
+    uint16_t phase;                   /* ticks */
+} tmm_machine_t;
+
 //******************************************************************************
 // Interface
 //******************************************************************************
@@ -51,6 +109,12 @@ void tmm_resume(void);
 tmm_modes_t tmm_get_mode(void);
 void tmm_start(tmm_modes_t mode);
 uint32_t tmm_get_tick_period_ms(void);
-uint32_t tmm_get_slow_tick_period(void);
+uint32_t tmm_get_tick(void);
+uint32_t tmm_get_elapsed_sec(void);
+void tmm_wakeup(void);
+#if defined(TAG_PROFILER_PRESENT)
+void tmm_prof_print_stats(void);
+void tmm_prof_reset_stats(void);
+#endif
 
 #endif /* TAG_MAIN_MACHINE_H_ */
@@ -8,10 +8,28 @@
 
 #include "stdio.h"
 #include "stdbool.h"
+#include "stdint.h"
+
+#include "tag_defines.h"
 
 //******************************************************************************
 // Defines
 //******************************************************************************
+/*! @brief HFXO pre-warm lead time (us), crystal start-up plus Power Manager clock restore margin.
+ *  sl_hfxo_manager_config.h has no start-up time setting in this SDK, check "ble stats" start latency */
+#define TPM_HFXO_PREWARM_US          (600)
+#define TPM_HFXO_PREWARM_COUNTS      (((TPM_HFXO_PREWARM_US * 32768UL) + 999999UL) / 1000000UL)
+
+/*! @brief HFXO pre-warm RTCC channel */
+#define TPM_RTCC_CC2                 (2)
+
+/*! @brief Shelf mode retention registers (BURAM keeps them in EM4, RAM does not) */
+#define TPM_BURAM_SHELF_REG          (0)                /* TPM_SHELF_MAGIC while tag is shelved */
+#define TPM_BURAM_EBM_REG            (1)                /* energy accounting, EBM_RETAINED_WORDS registers */
+#define TPM_SHELF_MAGIC              (0x53484C46)       /* "SHLF" */
+
+/*! @brief Power stats telemetry length (Power Stats beacon message) */
+#define TPM_POWER_TELEMETRY_LEN      (5)
 
 //******************************************************************************
 // Extern global variables
@@ -21,6 +39,29 @@ extern volatile bool sleep_on_isr_exit;
 //******************************************************************************
 // Data types
 //******************************************************************************
+//! @brief Tag operation modes (kept in NVM so shelf mode survives battery swaps)
+typedef enum tpm_op_mode_t {
+    TPM_OP_MODE_ACTIVE = 0,
+    TPM_OP_MODE_SHELF,                /* EM4, woken up by RFSENSE or LF activation */
+} tpm_op_mode_t;
+
+//! @brief Wake-up sources (first pending interrupt found right after wake-up)
+typedef enum tpm_wake_src_t {
+    TPM_WAKE_LF,                      /* RTCC CC0, LF decoder edge or bit timeout */
+    TPM_WAKE_TICK,                    /* RTCC CC1, Tag Main Machine */
+    TPM_WAKE_BLE,                     /* radio interrupts, BLE Stack */
+    TPM_WAKE_SLEEPTIMER,              /* BURTC, sleeptimer (BLE Stack timers, CLI, BLE Manager) */
+    TPM_WAKE_UART,                    /* CLI RX */
+    TPM_WAKE_OTHER,
+    TPM_WAKE_MAX
+} tpm_wake_src_t;
+
+//! @brief Power stats telemetry (big-endian, since previous Power Stats message)
+typedef struct tpm_power_telemetry_t {
+    uint8_t active_bp[2];             /* EM0/EM1 residency (x0.01 %) */
+    uint8_t wakeups[2];               /* wake-ups (saturated) */
+    uint8_t top_wake_src;             /* @ref tpm_wake_src_t with most wake-ups */
+} tpm_power_telemetry_t;
 
 //******************************************************************************
 // Interface
@@ -30,6 +71,23 @@ void tpm_schedule_system_reset(uint32_t timeout_ms);
 void tpm_enter_current_draw_mode(uint32_t reset_delay_ms);
 void tag_enter_deep_sleep(void);
 void tag_check_wakeup_from_deep_sleep(void);
+#if defined(TAG_SHELF_MODE_PRESENT)
+bool tpm_shelf_check(void);
+bool tpm_is_fast_resume(void);
+#endif
 void tag_power_settings(void);
+#if defined(TAG_HFXO_PREWARM_PRESENT)
+void tpm_hfxo_prewarm_init(void);
+void tpm_hfxo_prewarm_schedule(uint32_t rtcc_value);
+void tpm_hfxo_prewarm_release(void);
+void tpm_hfxo_prewarm_isr(void);
+bool tpm_hfxo_prewarm_consume(void);
+#endif
+#if defined(TAG_POWER_STATS_PRESENT)
+void tpm_power_stats_init(void);
+void tpm_print_power_stats(void);
+void tpm_reset_power_stats(void);
+void tpm_get_power_telemetry(tpm_power_telemetry_t *t);
+#endif
 
 #endif /* TAG_POWER_MANAGER_H_ */
@@ -0,0 +1,54 @@
+/*
+ * tag_retained_state.h
+ *
+ *  Application state kept over warm resets (watchdog, lockup, software, brown-out).
+ *
+ *  The block lives in RAM section .custom (not initialized during c startup, same as
+ *  'uptime'). It is saved at the end of every Tag Main Machine run and restored by
+ *  tag_init() after any non POR reset, once machines are initialized, only if its
+ *  magic, version, length and CRC match.
+ *
+ *  It holds LF field membership, pending critical events (including critical messages
+ *  not advertised yet) and the sync beacon phase, so a reset does not show up as a
+ *  false Exiting/Entering Field pair or a lost alarm.
+ *
+ */
+
+#ifndef TAG_RETAINED_STATE_H_
+#define TAG_RETAINED_STATE_H_
+
+#include "stdint.h"
+#include "stdbool.h"
+#include "tag_defines.h"
+#include "lf_machine.h"
+#include "tag_beacon_machine.h"
+
+//******************************************************************************
+// Defines
+//******************************************************************************
+#define TRS_MAGIC                    (0x54525331)   /* "TRS1" */
+#define TRS_VERSION                  (1)            /* bump on any trs_state_t change */
+
+//******************************************************************************
+// Extern global variables
+//******************************************************************************
+
+//******************************************************************************
+// Data types
+//******************************************************************************
+#if defined(TAG_RETAINED_STATE_PRESENT)
+typedef struct trs_state_t {
+    lfm_retained_t lf;
+    tbm_retained_t beacon;
+} trs_state_t;
+#endif
+
+//******************************************************************************
+// Interface
+//******************************************************************************
+#if defined(TAG_RETAINED_STATE_PRESENT)
+void trs_save(void);
+bool trs_restore(void);
+#endif
+
+#endif /* TAG_RETAINED_STATE_H_ */
@@ -68,6 +68,7 @@ typedef struct tsm_tag_ext_status_t {
             uint16_t fast_beacon_rate;      /* Current setting for Fast Beacon Rate */
             uint8_t lf_gain : 3;            /* LF Gain Reduction setting */
             uint8_t : 5;                    /* reserved */
+            uint8_t remaining_life_days[2]; /* Projected remaining battery life in days (big-endian) */
         };
         uint8_t bytes[10];
     };
@@ -80,8 +81,6 @@ tsm_tag_status_t* tsm_get_tag_status_beacon_data(void);
 tsm_tag_ext_status_t* tsm_get_tag_ext_status_beacon_data(void);
 void tsm_set_tag_status_flag(tsm_tag_status_flags_t flag);
 void tsm_clear_tag_status_flag(tsm_tag_status_flags_t flag);
-void tag_extended_status_run(void);
-void tag_firmware_rev_run(void);
 uint32_t tsm_init(void);
 
 #endif /* TAG_STATUS_FW_MACHINE_H_ */
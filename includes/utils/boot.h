@@ -10,19 +10,52 @@
  *       This allows SERMAC to execute the BOOT SELECT sequencing on BLE Tag.
  *       Below is the documentation for J-link custom scripts:
  *       https://wiki.segger.com/J-Link_script_files
+ *
+ * With TAG_BOOT_TRACE_PRESENT the end of each boot phase is timestamped from boot_init
+ * (DWT cycles until sleeptimer runs, sleeptimer ticks after). The trace of this boot and
+ * of the previous one (kept in .custom over non POR resets) are printed when a CLI
+ * session starts.
  */
 
 #ifndef BOOT_H_
 #define BOOT_H_
 
+#include "stdint.h"
+#include "stdbool.h"
+#include "tag_defines.h"
+
 #define BOOT_MANUFACTURING_TEST      (0b01)
 #define BOOT_UNUSED                  (0b00)
 #define BOOT_ESCAPE_HATCH            (0b10)
 #define BOOT_DEFAULT                 (0b11)
 
+#if defined(TAG_BOOT_TRACE_PRESENT)
+#define BOOT_TRACE_MARK(phase)       boot_trace_mark(phase)
+#else
+#define BOOT_TRACE_MARK(phase)
+#endif
+
+//! @brief Boot phases (marked when they end)
+typedef enum boot_phase_t {
+    BOOT_PHASE_BOOT_INIT,
+    BOOT_PHASE_SYSTEM_INIT,
+    BOOT_PHASE_AS39_INIT,
+    BOOT_PHASE_RTCC_INIT,
+    BOOT_PHASE_LF_DECODER_INIT,
+    BOOT_PHASE_TMM_START,
+    BOOT_PHASE_FIRST_ADV,
+    BOOT_PHASE_MAX
+} boot_phase_t;
+
 uint8_t boot_get_mode(void);
 void boot_init(void);
 uint32_t boot_get_reset_cause(void);
 void boot_print_reset_cause(void);
+bool boot_is_silent_reset(void);
+#if defined(TAG_BOOT_TRACE_PRESENT)
+void boot_trace_mark(boot_phase_t phase);
+bool boot_trace_is_marked(boot_phase_t phase);
+void boot_trace_print(void);
+#endif
 
 #endif /* BOOT_H_ */
@@ -1,23 +1,56 @@
 /*
  * tag_sw_timer.h
  *
+ *  Software timers used by Tag Main Machine "tasks", kept by a central timer service.
+ *  Timers hold an absolute deadline in Tag Main Machine ticks and sit in a hashed timer
+ *  wheel (slot = deadline % TAG_SW_TIMER_WHEEL_SLOTS), so start/stop are O(1) and each
+ *  run only visits the slots of the elapsed ticks (@ref tag_sw_timer_process).
+ *
+ *  Expired timers either call their callback (Tag Main Machine context, before machines
+ *  run) or stay expired until their owner polls, reloads or stops them.
+ *
  */
 
 #ifndef TAG_SW_TIMER_H_
 #define TAG_SW_TIMER_H_
 
 #include "stdio.h"
+#include "stdint.h"
 #include "stdbool.h"
 
-typedef struct tag_sw_timer_t {
-    uint32_t value;
-    uint32_t reload_value;
-} tag_sw_timer_t;
+//! @brief Number of wheel slots (power of 2), timers further than that take more than one round
+#define TAG_SW_TIMER_WHEEL_SLOTS             (64)
 
-void tag_sw_timer_tick(tag_sw_timer_t *timer);
-bool tag_sw_timer_is_expired(tag_sw_timer_t *timer);
+//! @brief True if tick 'a' comes before tick 'b' (wrap around safe)
+#define TAG_SW_TIMER_IS_BEFORE(a, b)         ((int32_t)((a) - (b)) < 0)
+
+typedef enum tag_sw_timer_state_t {
+    TAG_SW_TIMER_STOPPED,
+    TAG_SW_TIMER_RUNNING,
+    TAG_SW_TIMER_EXPIRED,             /* polled timers only, until reloaded or stopped */
+} tag_sw_timer_state_t;
+
+typedef struct tag_sw_timer_t tag_sw_timer_t;
+typedef void (*tag_sw_timer_callback_t)(tag_sw_timer_t *timer);
+
+struct tag_sw_timer_t {
+    tag_sw_timer_t *next;             /* wheel slot list */
+    tag_sw_timer_t *prev;
+    uint32_t deadline;                /* absolute time (Tag Main Machine ticks) */
+    uint32_t period;                  /* auto-reload (ticks), 0 for one-shot */
+    tag_sw_timer_callback_t callback; /* NULL: owner polls @ref tag_sw_timer_is_expired */
+    tag_sw_timer_state_t state;
+};
+
+void tag_sw_timer_start(tag_sw_timer_t *timer, uint32_t ticks, uint32_t period, tag_sw_timer_callback_t callback);
 void tag_sw_timer_reload(tag_sw_timer_t *timer, uint32_t reload_value);
+void tag_sw_timer_stop(tag_sw_timer_t *timer);
+bool tag_sw_timer_is_expired(tag_sw_timer_t *timer);
 bool tag_sw_timer_is_running(tag_sw_timer_t *timer);
 bool tag_sw_timer_is_stopped(tag_sw_timer_t *timer);
+bool tag_sw_timer_get_deadline(tag_sw_timer_t *timer, uint32_t *deadline);
+void tag_sw_timer_process(uint32_t now);
+uint32_t tag_sw_timer_get_time(void);
+bool tag_sw_timer_get_next_deadline(uint32_t *deadline);
 
 #endif /* TAG_SW_TIMER_H_ */
@@ -8,6 +8,7 @@
 
 #include "battery_machine.h"
 #include "tag_sw_timer.h"
+#include "tag_main_machine.h"
 
 //******************************************************************************
 // Defines
@@ -124,13 +125,10 @@ static void read_battery_voltage(void)
  */
 void battery_machine_run(void)
 {
-  // Tick Battery Machine Timer
-  tag_sw_timer_tick(&btm_timer);
-
   // Measure Battery Voltage every BTM_TIMER_PERIOD_SEC seconds and
   // Send its event to Tag Beacon Machine
   if (tag_sw_timer_is_expired(&btm_timer)) {
-      tag_sw_timer_reload(&btm_timer, BTM_TIMER_PERIOD_SEC);
+      tag_sw_timer_reload(&btm_timer, TMM_SEC_TO_TICKS(BTM_TIMER_PERIOD_SEC));
       read_battery_voltage();
       // TODO: Add Event
   }
@@ -138,9 +136,12 @@ void battery_machine_run(void)
 
 uint32_t btm_init(void)
 {
-    tag_sw_timer_reload(&btm_timer, BTM_TIMER_PERIOD_SEC);
+    tag_sw_timer_reload(&btm_timer, TMM_SEC_TO_TICKS(BTM_TIMER_PERIOD_SEC));
     battery_voltage_in_mv = 0;
     return 0;
 }
 
+// Not registered yet (battery voltage reading is not finished)
+//TMM_MACHINE(35, btm, "Battery", btm_init, battery_machine_run, TMM_SLOW_TASK_PERIOD, 0);
+
 
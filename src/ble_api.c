@@ -36,6 +36,13 @@
 #include "gatt_db.h"
 #include "stdbool.h"
 #include "ble_manager_machine.h"
+#include "tag_command.h"
+#if defined(TAG_BEACON_AUTH_PRESENT)
+#include "tag_beacon_auth.h"
+#endif
+#if defined(TAG_GATT_PROVISIONING_PRESENT)
+#include "tag_configuration.h"
+#endif
 #include "app_assert.h"
 #include "dbg_utils.h"
 
@@ -73,8 +80,41 @@ static void ble_api_on_system_boot(sl_bt_msg_t *evt) {
     // Create an advertising set.
     sc = sl_bt_advertiser_create_set(&advertising_set_handle);
     app_assert_status(sc);
+
+#if defined(TAG_BEACON_AUTH_PRESENT)
+    // Identity address is part of the beacon authentication nonce and MIC.
+    tba_init(address.addr);
+#endif
 }
 
+#if defined(TAG_GATT_PROVISIONING_PRESENT)
+/**
+ * @brief GATT user characteristic write (provisioning station)
+ * @details Only the tag configuration batch is served, in a single write request (no long
+ *     writes). Every request is answered so the station never waits for an ATT timeout.
+ */
+static void ble_api_on_user_write_request(sl_bt_msg_t *evt)
+{
+    uint8_t connection = evt->data.evt_gatt_server_user_write_request.connection;
+    uint16_t characteristic = evt->data.evt_gatt_server_user_write_request.characteristic;
+    tcf_status_t status;
+
+    if ((characteristic == gattdb_cmd_tag_config) &&
+        (evt->data.evt_gatt_server_user_write_request.att_opcode == sl_bt_gatt_server_write_request)) {
+        status = tcf_apply_batch(evt->data.evt_gatt_server_user_write_request.value.data,
+                                 evt->data.evt_gatt_server_user_write_request.value.len);
+    } else {
+        status = TCF_ERR_NOT_SUPPORTED;
+    }
+
+    sl_bt_gatt_server_send_user_write_response(connection, characteristic, (uint8_t)status);
+
+    // One batch per connection, link is closed as soon as the response is out.
+    if (status == TCF_OK) {
+        bmm_on_config_written();
+    }
+}
+#endif
 
 /**************************************************************************//**
  * Bluetooth stack event handler.
@@ -95,20 +135,45 @@ void sl_bt_on_event(sl_bt_msg_t *evt)
             ble_api_on_system_boot(evt);
             break;
 
+        case sl_bt_evt_system_external_signal_id:
+            bmm_external_signal_handler(evt->data.evt_system_external_signal.extsignals);
+            tcm_external_signal_handler(evt->data.evt_system_external_signal.extsignals);
+            break;
+
+#if defined(TAG_SCAN_WINDOW_PRESENT)
+        case sl_bt_evt_scanner_scan_report_id:
+            bmm_scan_report_handler(evt->data.evt_scanner_scan_report.data.data,
+                                    evt->data.evt_scanner_scan_report.data.len);
+            break;
+#endif
+
         case sl_bt_evt_advertiser_timeout_id:
-            bmm_adv_running = false;
+            bmm_adv_timeout_handler();
             DEBUG_LOG(DBG_CAT_BLE, "Stop BLE beacon advertising...");
             break;
 
         case sl_bt_evt_connection_opened_id:
+#if defined(TAG_GATT_PROVISIONING_PRESENT)
+            bmm_on_connection_opened(evt->data.evt_connection_opened.connection);
+#else
             sl_bt_advertiser_stop(advertising_set_handle);
+#endif
             DEBUG_LOG(DBG_CAT_BLE, "BLE connected...");
             break;
 
         case sl_bt_evt_connection_closed_id:
+#if defined(TAG_GATT_PROVISIONING_PRESENT)
+            bmm_on_connection_closed(evt->data.evt_connection_closed.connection);
+#endif
             DEBUG_LOG(DBG_CAT_BLE, "BLE disconnected...");
             break;
 
+#if defined(TAG_GATT_PROVISIONING_PRESENT)
+        case sl_bt_evt_gatt_server_user_write_request_id:
+            ble_api_on_user_write_request(evt);
+            break;
+#endif
+
    ///////////////////////////////////////////////////////////////////////////
    // Add additional event handlers here as your application requires!      //
    ///////////////////////////////////////////////////////////////////////////
@@ -8,10 +8,14 @@
 
 #include "em_common.h"
 #include "em_cmu.h"
+#include "em_core.h"
 #include "stdio.h"
 #include "stdbool.h"
 #include "string.h"
 #include "sl_bluetooth.h"
+#include "sl_bluetooth_config.h"
+#include "sl_sleeptimer.h"
+#include "sl_power_manager.h"
 #include "sl_device_init_hfxo.h"
 #include "sl_slist.h"
 #include "app_assert.h"
@@ -23,19 +27,52 @@
 #include "tag_defines.h"
 #include "ble_api.h"
 #include "tag_main_machine.h"
+#include "boot.h"
 #include "temperature_machine.h"
+#include "energy_budget_machine.h"
+#if defined(TAG_BEACON_AUTH_PRESENT)
+#include "tag_beacon_auth.h"
+#endif
+#if defined(TAG_DOWNLINK_PRESENT)
+#include "tag_command.h"
+#endif
+#if defined(TAG_GATT_PROVISIONING_PRESENT)
+#include "tag_configuration.h"
+#endif
 #include "ble_manager_machine.h"
 
 
 //******************************************************************************
 // Defines
 //******************************************************************************
-#define BLE_CIRCULAR_BUFFER_SIZE     (10)
+#define BMM_CRITICAL_RING_SIZE       (64)               // Bytes (messages are usually 2 to 5 bytes long)
+#define BMM_PERIODIC_RING_SIZE       (192)
+#define BMM_MSG_HEADER_SIZE          (2)                // length + type
+#define BMM_MSG_TOMBSTONE            (0x80)             // Set in length field once message was consumed out of order
+#define BMM_MSG_LENGTH_MASK          (0x7F)
+#define BMM_PACKING_MAX_CANDIDATES   (16)               // Max. periodic messages considered by packing pass
+#define BMM_ADV_MAX_MSGS             (BMM_PACKING_MAX_CANDIDATES + (BMM_CRITICAL_RING_SIZE / BMM_MSG_HEADER_SIZE))
 
 #define ADV_PAYLOAD_MAX_LEN          (31)
+#define EXT_ADV_PAYLOAD_MAX_LEN      (250)              // Extended advertising (BLE 5), AUX_ADV_IND on secondary channel
+#define EXT_ADV_PRIMARY_PHY          (sl_bt_gap_phy_1m)
+#define EXT_ADV_SECONDARY_PHY        (sl_bt_gap_phy_2m)  // Shorter on-air time for the large payload
+
+#if defined(TAG_BLE_EXT_ADV_PRESENT)
+#define ADV_PAYLOAD_BUFFER_LEN       (EXT_ADV_PAYLOAD_MAX_LEN)
+#else
+#define ADV_PAYLOAD_BUFFER_LEN       (ADV_PAYLOAD_MAX_LEN)
+#endif
+#define SCAN_RSP_PAYLOAD_MAX_LEN     (31)
 #define ADV_RETRANSMISSIONS          (3)
 #define ADV_MIN_INTERVAL             (50)
 #define ADV_MAX_INTERVAL             (100)
+#define ADV_CHANNEL_MAP              (7)                // All advertising channels (37, 38, 39)
+#define ADV_TX_POWER_MAX             (SL_BT_CONFIG_MAX_TX_POWER)   // 0.1 dBm
+#define ADV_TX_POWER_MIN             (SL_BT_CONFIG_MIN_TX_POWER)
+
+// Advertising interval is set in units of 0.625 ms (integer math, no float conversion)
+#define BMM_MS_TO_ADV_INTERVAL(ms)   ((((uint32_t)(ms)) * 16) / 10)
 
 // UUID Service Data for GuardRFID
 #define UUID_SD_GUARD_L              0xE6
@@ -47,64 +84,266 @@
 #define UUID_TEST_L                  0xFF
 #define UUID_TEST_H                  0xFF
 
+#if defined(TAG_SCAN_WINDOW_PRESENT)
+#define BMM_SCAN_INTERVAL            (16)               // 10 ms (0.625 ms units), scan window = interval (continuous)
+#define BMM_SCAN_WINDOW              (16)
+#define BMM_READER_FRAME_MIN_LEN     (1 + 2 + 1 + 6)    // AD type + UUID + frame type + identity address
+#define BMM_ACK_FRAME_LEN            (1 + 6 + TBA_COUNTER_LEN + TBA_MIC_LEN) // frame type + identity address + counter + MIC
+#endif
+
+#if defined(TAG_GATT_PROVISIONING_PRESENT)
+#define BMM_CONN_HANDLE_NONE         (0xFF)
+#endif
+
 //******************************************************************************
 // Data types
 //******************************************************************************
-typedef struct bmm_circular_queue_t {
-    int8_t front;
-    int8_t rear;
-    bmm_msg_t item[BLE_CIRCULAR_BUFFER_SIZE];
-} bmm_circular_queue_t;
+typedef struct bmm_msg_ring_t {
+    uint16_t head;                     /* consumer index */
+    uint16_t tail;                     /* producer index */
+    uint16_t used;                     /* bytes in use (including wrap padding) */
+    uint16_t count;                    /* number of committed messages */
+    uint16_t pad;                      /* wrap padding of the outstanding reservation */
+    uint16_t size;
+    uint8_t *buf;
+} bmm_msg_ring_t;
+
+typedef enum bmm_adv_mode_t {
+    BMM_ADV_LEGACY = 0,
+    BMM_ADV_EXTENDED,
+    BMM_ADV_MODE_MAX
+} bmm_adv_mode_t;
+
+typedef struct bmm_pdu_stats_t {
+    uint32_t adv_count;                /* number of ADV_PDUs assembled */
+    uint32_t total_bytes;              /* sum of all ADV_PDU lengths */
+    uint8_t min_len;
+    uint8_t max_len;
+} bmm_pdu_stats_t;
+
+/** Main context work requested on the running advertising set (ADV_PDU is not touched by ISR meanwhile) **/
+typedef enum bmm_adv_pending_t {
+    BMM_ADV_PENDING_NONE = 0,
+    BMM_ADV_PENDING_START,
+    BMM_ADV_PENDING_UPDATE,
+    BMM_ADV_PENDING_RESTART
+} bmm_adv_pending_t;
+
+/** Beacon message placed in current ADV_PDU **/
+typedef struct bmm_adv_msg_t {
+    uint8_t offset;                    /* index of msg_type in ADV_PDU */
+    uint8_t length;                    /* msg_type + msg_data */
+    bmm_msg_priority_t priority;
+} bmm_adv_msg_t;
+
+/** RF profile (advertising set policy) **/
+typedef struct bmm_adv_cfg_t {
+    uint16_t min_interval_ms;
+    uint16_t max_interval_ms;
+    int16_t tx_power;                  /* 0.1 dBm */
+    uint8_t retransmissions;           /* max. num. of advertising events per set */
+    uint8_t channel_map;
+} bmm_adv_cfg_t;
+
+typedef struct bmm_min_avg_max_t {
+    uint32_t min;
+    uint32_t max;
+    uint32_t total;
+} bmm_min_avg_max_t;
+
+typedef struct bmm_adv_timing_stats_t {
+    uint32_t count;
+    uint32_t starts;                     /* advertiser starts, restarts included */
+    bmm_min_avg_max_t start_latency_us;  /* advertiser (re)start request (ISR) -> advertiser started (main context) */
+    bmm_min_avg_max_t active_time_ms;    /* advertising request -> advertiser timeout (EM0/EM1 on HFXO) */
+} bmm_adv_timing_stats_t;
+
+#if defined(TAG_SCAN_WINDOW_PRESENT)
+/** Scan window opened after advertising (advertiser is stopped meanwhile) **/
+typedef enum bmm_scan_window_t {
+    BMM_SCAN_WINDOW_NONE = 0,
+    BMM_SCAN_WINDOW_ACK,               /* between advertising attempts of a critical ADV_PDU */
+    BMM_SCAN_WINDOW_DOWNLINK           /* once advertising set is over, downlink slot */
+} bmm_scan_window_t;
+#endif
+
+#if defined(TAG_READER_ACK_PRESENT)
+/** Reader acknowledgment policy for ADV_PDUs carrying critical messages **/
+typedef struct bmm_ack_cfg_t {
+    bool enabled;
+    uint16_t window_ms;                /* scan window opened after each advertising attempt */
+    uint8_t max_attempts;              /* advertising attempts before giving up (0: RF profile events) */
+} bmm_ack_cfg_t;
+
+typedef struct bmm_ack_stats_t {
+    uint32_t windows;                  /* scan windows opened */
+    uint32_t hits;                     /* ADV_PDUs acknowledged by a reader */
+    uint32_t misses;                   /* scan windows closed without acknowledgment */
+    uint32_t events_saved;             /* advertising events not transmitted thanks to an ack */
+    uint32_t scan_time_ms;
+} bmm_ack_stats_t;
+#endif
+
+#if defined(TAG_DOWNLINK_PRESENT)
+/** Downlink slots policy **/
+typedef struct bmm_dl_cfg_t {
+    bool enabled;
+    uint16_t window_ms;                /* scan window opened once advertising set is over */
+    uint8_t period;                    /* one downlink window every 'period' advertising sets */
+} bmm_dl_cfg_t;
+
+typedef struct bmm_dl_stats_t {
+    uint32_t windows;
+    uint32_t scan_time_ms;
+} bmm_dl_stats_t;
+#endif
+
+#if defined(TAG_GATT_PROVISIONING_PRESENT)
+typedef struct bmm_prov_stats_t {
+    uint32_t windows;                  /* provisioning windows opened */
+    uint32_t connections;
+    uint32_t timeouts;                 /* links dropped by the tag, no configuration written */
+    bmm_min_avg_max_t conn_time_ms;    /* connection opened -> closed */
+} bmm_prov_stats_t;
+#endif
+
+typedef struct bmm_adv_prefix_t {
+    uint8_t length;                    /* constant ADV_PDU prefix length */
+    uint8_t data_len_index;            /* index of tag data AD length field */
+    uint8_t tag_id_index;              /* index of Tag Type ID (start of authenticated frame) */
+    uint8_t data_len;                  /* tag data AD length without beacon messages */
+} bmm_adv_prefix_t;
 
 typedef struct bmm_adv_pdu_t {
-    uint8_t data[ADV_PAYLOAD_MAX_LEN];
+    uint8_t data[ADV_PAYLOAD_BUFFER_LEN];
     size_t length;
 }bmm_adv_payload_t;
 
+#if defined(TAG_ADV_SCAN_RSP_PRESENT)
+/** Beacon messages served from scan response (only read by commissioning tools) **/
+typedef enum bmm_scan_rsp_slots_t {
+    BMM_SCAN_RSP_FIRMWARE_REV = 0,
+    BMM_SCAN_RSP_TAG_EXT_STATUS,
+    BMM_SCAN_RSP_SLOT_MAX
+} bmm_scan_rsp_slots_t;
+
+typedef struct bmm_scan_rsp_slot_t {
+    uint8_t length;                    /* 0 if slot was never filled */
+    uint8_t type;
+    uint8_t data[BLE_MSG_MAX_DATASIZE];
+} bmm_scan_rsp_slot_t;
+
+typedef struct bmm_scan_rsp_t {
+    uint8_t data[SCAN_RSP_PAYLOAD_MAX_LEN];
+    uint8_t length;
+} bmm_scan_rsp_t;
+#endif
+
 //******************************************************************************
 // Global variables
 //******************************************************************************
-static sl_sleeptimer_timer_handle_t bmm_ble_api_sched_timer;
 static volatile bmm_fsm_t bmm_fsm;
 volatile bool bmm_adv_running;
 volatile bool bmm_stack_running;
 static bool bmm_running;
-static bmm_circular_queue_t queue;
+static uint8_t bmm_critical_ring_buf[BMM_CRITICAL_RING_SIZE];
+static uint8_t bmm_periodic_ring_buf[BMM_PERIODIC_RING_SIZE];
+static bmm_msg_ring_t msg_ring[BMM_MSG_PRIORITY_MAX] = {
+    [BMM_MSG_CRITICAL] = { .size = BMM_CRITICAL_RING_SIZE, .buf = bmm_critical_ring_buf },
+    [BMM_MSG_PERIODIC] = { .size = BMM_PERIODIC_RING_SIZE, .buf = bmm_periodic_ring_buf },
+};
 static bmm_adv_payload_t adv_payload;
+static bmm_pdu_stats_t bmm_pdu_stats[BMM_ADV_MODE_MAX];
+static bmm_adv_mode_t bmm_adv_mode;
+#if defined(TAG_BLE_EXT_ADV_PRESENT)
+static bool bmm_ext_adv_enabled;
+#endif
+static bmm_adv_prefix_t bmm_adv_prefix;
+static uint32_t bmm_adv_request_tick;
+static uint32_t bmm_adv_start_tick;                                /* last advertiser (re)start request */
+static volatile bmm_adv_pending_t bmm_adv_pending;
+static bmm_adv_msg_t bmm_adv_msgs[BMM_ADV_MAX_MSGS];
+static uint8_t bmm_adv_msg_count;
+static uint32_t bmm_adv_merge_count;
+static uint32_t bmm_adv_restart_count;
+static uint32_t bmm_oversize_drop_count;                           /* messages that could never fit in an ADV_PDU */
+static bmm_adv_cfg_t bmm_adv_cfg;                                  /* policy of current ADV_PDU */
+static bmm_adv_cfg_t bmm_adv_cfg_applied;                          /* policy applied to advertising set */
+static bmm_rf_profile_t bmm_adv_profile;                           /* RF profile of current ADV_PDU */
+static bmm_adv_cfg_t bmm_adv_cfg_req[BMM_RF_PROFILE_MAX];          /* policies requested, latched on BMM_PROCESS_CFG_REQ */
+static volatile uint8_t bmm_adv_cfg_req_mask;                      /* bit n: RF profile n requested */
+static volatile bool bmm_adv_cfg_dirty;                            /* set parameters to be re-applied on next advertising */
+
+/** RF profiles by message class (entries can be changed at runtime, see @ref bmm_set_adv_config) **/
+static bmm_adv_cfg_t bmm_rf_profiles[BMM_RF_PROFILE_MAX] = {
+    /*                            min ms             max ms             tx power           events               channel map */
+    [BMM_RF_PROFILE_ROUTINE]  = { ADV_MIN_INTERVAL,  ADV_MAX_INTERVAL,  0,                 1,                   0x01 },
+    [BMM_RF_PROFILE_STANDARD] = { ADV_MIN_INTERVAL,  ADV_MAX_INTERVAL,  ADV_TX_POWER_MAX,  ADV_RETRANSMISSIONS, ADV_CHANNEL_MAP },
+    [BMM_RF_PROFILE_ALARM]    = { 20,                30,                ADV_TX_POWER_MAX,  5,                   ADV_CHANNEL_MAP },
+};
+static bool bmm_em1_requirement;
+static bmm_adv_timing_stats_t bmm_adv_timing;
+#if defined(TAG_ADV_SCAN_RSP_PRESENT)
+static bool bmm_scan_rsp_enabled;
+static bmm_scan_rsp_slot_t bmm_scan_rsp_slots[BMM_SCAN_RSP_SLOT_MAX];
+static volatile bool bmm_scan_rsp_dirty;                           /* slots changed, scan response to be pushed again */
+static uint8_t bmm_scan_rsp_length;                                /* scan response length pushed to the stack */
+static uint8_t bmm_scan_rsp_record[BMM_MSG_HEADER_SIZE + BLE_MSG_MAX_DATASIZE];   /* reservation of a scan response message */
+#endif
+#if defined(TAG_BEACON_AUTH_PRESENT)
+static bool bmm_adv_secured;                                       /* ADV_PDU built with room for counter and MIC */
+static volatile bool bmm_adv_sealed;                               /* ADV_PDU beacon messages are encrypted */
+#endif
+#if defined(TAG_READER_ACK_PRESENT)
+static bmm_ack_cfg_t bmm_ack_cfg;
+static bmm_ack_stats_t bmm_ack_stats;
+static volatile bool bmm_ack_expected;                             /* current ADV_PDU waits for a reader ack */
+static volatile uint8_t bmm_ack_retries_left;                      /* advertising attempts left after current one */
+static bool bmm_ack_retry;                                         /* pending restart is a retransmission of current ADV_PDU */
+#endif
+#if defined(TAG_DOWNLINK_PRESENT)
+static bmm_dl_cfg_t bmm_dl_cfg;
+static bmm_dl_stats_t bmm_dl_stats;
+static uint8_t bmm_dl_countdown;                                   /* advertising sets left before next downlink window */
+#endif
+#if defined(TAG_SCAN_WINDOW_PRESENT)
+static volatile bmm_scan_window_t bmm_scan_window;                 /* advertiser is stopped while a window is open */
+static uint32_t bmm_scan_window_tick;
+static sl_sleeptimer_timer_handle_t bmm_scan_timer;
+static bool bmm_scanner_ready;
+static bd_addr bmm_identity_address;
+#endif
+#if defined(TAG_GATT_PROVISIONING_PRESENT)
+static volatile bool bmm_prov_window_open;                         /* legacy advertising sets are connectable */
+static uint32_t bmm_prov_window_tick;
+static uint32_t bmm_prov_window_len;                               /* sleeptimer ticks */
+static uint8_t bmm_conn_handle;
+static uint32_t bmm_conn_tick;
+static bool bmm_conn_configured;                                   /* configuration written on current link */
+static sl_sleeptimer_timer_handle_t bmm_conn_timer;
+static bmm_prov_stats_t bmm_prov_stats;
+#endif
 
 
 //******************************************************************************
 // Functions
 //******************************************************************************
-static void ble_api_start_adv(uint8_t retransmissions, uint32_t min_interval, uint32_t max_interval)
+/**
+ * @brief Apply advertising set timing, channel map and PHY (BLE API, main context)
+ * @note Parameters persist in the advertising set, only called when policy changes.
+ */
+static void ble_api_apply_adv_config(const bmm_adv_cfg_t *cfg)
 {
     sl_status_t sc;
 
     sc = sl_bt_advertiser_set_timing( advertising_set_handle,
-                                      min_interval*1.6,                         // min. adv. interval (milliseconds * 1.6)
-                                      max_interval*1.6,                         // max. adv. interval (milliseconds * 1.6)
+                                      BMM_MS_TO_ADV_INTERVAL(cfg->min_interval_ms),   // min. adv. interval (units of 0.625 ms)
+                                      BMM_MS_TO_ADV_INTERVAL(cfg->max_interval_ms),   // max. adv. interval (units of 0.625 ms)
                                       0,                                        // adv. duration
-                                      retransmissions);                         // max. num. adv. events
+                                      cfg->retransmissions);                    // max. num. adv. events
     app_assert_status(sc);
 
-    //sc = sl_bt_advertiser_create_set(&advertising_set_handle);
-
-    //app_assert_status(sc);
-
-    /* Deprecated function
-    sl_bt_advertiser_set_data( advertising_set_handle,
-                               sl_bt_advertiser_advertising_data_packet,
-                               adv_payload.length,
-                               adv_payload.data);
-                               */
-    sl_bt_legacy_advertiser_set_data( advertising_set_handle,
-                               sl_bt_advertiser_advertising_data_packet,
-                               adv_payload.length,
-                               adv_payload.data);
-
-    //app_assert_status(sc);
-
-    /* Set all adv channels
+    /* Set adv channels
     *     - <b>1:</b> Advertise on CH37
     *     - <b>2:</b> Advertise on CH38
     *     - <b>3:</b> Advertise on CH37 and CH38
@@ -113,7 +352,230 @@ static void ble_api_start_adv(uint8_t retransmissions, uint32_t min_interval, ui
     *     - <b>6:</b> Advertise on CH38 and CH39
     *     - <b>7:</b> Advertise on all channels
     */
-    sl_bt_advertiser_set_channel_map(advertising_set_handle, 7);
+    sc = sl_bt_advertiser_set_channel_map(advertising_set_handle, cfg->channel_map);
+    app_assert_status(sc);
+
+    int16_t tx_power_set;
+    sc = sl_bt_advertiser_set_tx_power(advertising_set_handle, cfg->tx_power, &tx_power_set);
+    app_assert_status(sc);
+
+#if defined(TAG_BLE_EXT_ADV_PRESENT)
+    // Only used by extended advertising, legacy PDUs are always sent on 1M PHY.
+    sc = sl_bt_extended_advertiser_set_phy(advertising_set_handle, EXT_ADV_PRIMARY_PHY, EXT_ADV_SECONDARY_PHY);
+    app_assert_status(sc);
+#endif
+
+    DEBUG_LOG(DBG_CAT_BLE, "BLE advertising set configured (%d-%d ms, %d events, channel map 0x%X, %d.%d dBm)",
+              cfg->min_interval_ms,
+              cfg->max_interval_ms,
+              cfg->retransmissions,
+              cfg->channel_map,
+              (tx_power_set / 10),
+              ((tx_power_set < 0) ? -(tx_power_set % 10) : (tx_power_set % 10)));
+}
+
+#if defined(TAG_BEACON_AUTH_PRESENT)
+//! @brief Beacon messages length in a secured ADV_PDU
+static uint8_t bmm_get_secured_plain_len(void)
+{
+    return (uint8_t)(adv_payload.length - TBA_MIC_LEN - bmm_adv_prefix.length - TBA_COUNTER_LEN);
+}
+
+/**
+ * @brief Turn a secured ADV_PDU back into a plain text one (room for counter and MIC removed)
+ * @details Beacon messages are still in plain text, they move down over the counter room.
+ */
+static void bmm_drop_secured_room(void)
+{
+    uint8_t *frame = &adv_payload.data[bmm_adv_prefix.tag_id_index];
+    uint8_t plain_len = bmm_get_secured_plain_len();
+    uint8_t i;
+
+    frame[0] &= ~TBA_FRAME_SECURED;
+    memmove(&frame[1], &frame[1 + TBA_COUNTER_LEN], plain_len);
+    for (i = 0; i < bmm_adv_msg_count; i++) {
+        bmm_adv_msgs[i].offset -= TBA_COUNTER_LEN;
+    }
+    adv_payload.data[bmm_adv_prefix.data_len_index] -= TBA_OVERHEAD_LEN;
+    adv_payload.length -= TBA_OVERHEAD_LEN;
+    bmm_adv_secured = false;
+}
+
+/**
+ * @brief Encrypt and sign ADV_PDU beacon messages (main context)
+ * @details If sealing fails (error counted by Beacon Auth) the ADV_PDU goes out as a regular
+ *     plain text frame, never with a blank counter and MIC.
+ */
+static void bmm_seal_tag_data(void)
+{
+    if (bmm_adv_secured && !bmm_adv_sealed) {
+        if (tba_seal(&adv_payload.data[bmm_adv_prefix.tag_id_index], bmm_get_secured_plain_len()) == 0) {
+            bmm_adv_sealed = true;
+        } else {
+            bmm_drop_secured_room();
+            DEBUG_LOG(DBG_CAT_WARNING, "ADV_PDU could not be sealed, sent in plain text...");
+        }
+    }
+}
+
+//! @brief Restore ADV_PDU plain text so it can be modified (ISR context)
+static void bmm_unseal_tag_data(void)
+{
+    if (bmm_adv_sealed) {
+        tba_unseal(&adv_payload.data[bmm_adv_prefix.tag_id_index], bmm_get_secured_plain_len());
+        bmm_adv_sealed = false;
+    }
+}
+#endif
+
+/**
+ * @brief Push current ADV_PDU to the advertising set (BLE API, main context)
+ * @note It can also be used on a running advertising set to update its payload.
+ */
+static void ble_api_set_adv_data(void)
+{
+    sl_status_t sc;
+
+#if defined(TAG_BEACON_AUTH_PRESENT)
+    bmm_seal_tag_data();
+#endif
+
+#if defined(TAG_BLE_EXT_ADV_PRESENT)
+    if (bmm_adv_mode == BMM_ADV_EXTENDED) {
+        // Payload does not fit a single command, it goes through the system data buffer.
+        sl_bt_system_data_buffer_clear();
+        sc = sl_bt_system_data_buffer_write(adv_payload.length, adv_payload.data);
+        app_assert_status(sc);
+        sc = sl_bt_extended_advertiser_set_long_data(advertising_set_handle);
+        app_assert_status(sc);
+    } else
+#endif
+    {
+        /* Deprecated function
+        sl_bt_advertiser_set_data( advertising_set_handle,
+                                   sl_bt_advertiser_advertising_data_packet,
+                                   adv_payload.length,
+                                   adv_payload.data);
+                                   */
+        sc = sl_bt_legacy_advertiser_set_data( advertising_set_handle,
+                                               sl_bt_advertiser_advertising_data_packet,
+                                               adv_payload.length,
+                                               adv_payload.data);
+        app_assert_status(sc);
+    }
+}
+
+#if defined(TAG_ADV_SCAN_RSP_PRESENT)
+/**
+ * @brief Check if Firmware Revision / Tag Extended Status are served from scan response
+ * @details Scan response is not sealed, so with beacon authentication on these messages
+ *     stay in the (sealed) ADV_PDU.
+ */
+static bool bmm_is_scan_rsp_active(void)
+{
+#if defined(TAG_BEACON_AUTH_PRESENT)
+    if (tba_is_enabled()) {
+        return false;
+    }
+#endif
+    return bmm_scan_rsp_enabled;
+}
+
+//! @brief Scan response slot of a message type, NULL if it goes in ADV_PDU
+static bmm_scan_rsp_slot_t* bmm_get_scan_rsp_slot(uint8_t type)
+{
+    switch (type) {
+        case BLE_MSG_FIRMWARE_REV:
+            return &bmm_scan_rsp_slots[BMM_SCAN_RSP_FIRMWARE_REV];
+
+        case BLE_MSG_TAG_EXT_STATUS:
+            return &bmm_scan_rsp_slots[BMM_SCAN_RSP_TAG_EXT_STATUS];
+
+        default:
+            return NULL;
+    }
+}
+
+/**
+ * @brief Build scan response from its slots and push it to the advertising set (BLE API, main context)
+ * @details Same Service Data header as ADV_PDU (UUID and Tag Type ID) followed by the slot messages.
+ */
+static void ble_api_set_scan_rsp_data(void)
+{
+    bmm_scan_rsp_t rsp;
+    sl_status_t sc;
+    uint8_t i;
+    uint8_t j;
+
+    rsp.length = 0;
+    rsp.data[rsp.length++] = 0;                                                 // placeholder for AD length
+    rsp.data[rsp.length++] = ADV_SERVICE_DATA;
+    rsp.data[rsp.length++] = UUID_SD_GUARD_L;
+    rsp.data[rsp.length++] = UUID_SD_GUARD_H;
+    rsp.data[rsp.length++] = TAG_ID;
+
+    // Slots are written from ISR context (Tag Beacon Machine)
+    CORE_DECLARE_IRQ_STATE;
+    CORE_ENTER_ATOMIC();
+    for (i = 0; i < BMM_SCAN_RSP_SLOT_MAX; i++) {
+        bmm_scan_rsp_slot_t *slot = &bmm_scan_rsp_slots[i];
+        if ((slot->length != 0) && ((rsp.length + slot->length) <= SCAN_RSP_PAYLOAD_MAX_LEN)) {
+            rsp.data[rsp.length++] = slot->type;
+            for (j = 0; j < (slot->length - 1); j++) {
+                rsp.data[rsp.length++] = slot->data[j];
+            }
+        }
+    }
+    bmm_scan_rsp_dirty = false;
+    CORE_EXIT_ATOMIC();
+
+    rsp.data[0] = rsp.length - 1;
+
+    sc = sl_bt_legacy_advertiser_set_data( advertising_set_handle,
+                                           sl_bt_advertiser_scan_response_packet,
+                                           rsp.length,
+                                           rsp.data);
+    app_assert_status(sc);
+
+    bmm_scan_rsp_length = rsp.length;
+
+    DEBUG_LOG(DBG_CAT_BLE, "BLE scan response updated (%d bytes)", rsp.length);
+}
+#endif
+
+#if defined(TAG_GATT_PROVISIONING_PRESENT)
+//! @brief Provisioning window is closed once expired (ISR or main context)
+static bool bmm_is_prov_window_open(void)
+{
+    if (bmm_prov_window_open && ((sl_sleeptimer_get_tick_count() - bmm_prov_window_tick) >= bmm_prov_window_len)) {
+        bmm_prov_window_open = false;
+    }
+
+    return bmm_prov_window_open;
+}
+#endif
+
+/**
+ * @brief Start BLE advertising set (BLE API, main context)
+ * @details Set configuration is only re-applied if policy changed, otherwise only payload is pushed.
+ */
+static void ble_api_start_adv(void)
+{
+    sl_status_t sc;
+
+    if (bmm_adv_cfg_dirty || (memcmp(&bmm_adv_cfg, &bmm_adv_cfg_applied, sizeof(bmm_adv_cfg)) != 0)) {
+        ble_api_apply_adv_config(&bmm_adv_cfg);
+        bmm_adv_cfg_applied = bmm_adv_cfg;
+        bmm_adv_cfg_dirty = false;
+    }
+
+    ble_api_set_adv_data();
+
+#if defined(TAG_ADV_SCAN_RSP_PRESENT)
+    if (bmm_is_scan_rsp_active() && bmm_scan_rsp_dirty) {
+        ble_api_set_scan_rsp_data();
+    }
+#endif
 
 #if 1
     // Start BLE advertising (advertiser_non_connectable)
@@ -123,9 +585,31 @@ static void ble_api_start_adv(uint8_t retransmissions, uint32_t min_interval, ui
                                  advertiser_non_connectable);
                                  */
 
-    sc = sl_bt_legacy_advertiser_start( advertising_set_handle,
-                                        sl_bt_legacy_advertiser_non_connectable);
-
+#if defined(TAG_BLE_EXT_ADV_PRESENT)
+    if (bmm_adv_mode == BMM_ADV_EXTENDED) {
+        sc = sl_bt_extended_advertiser_start( advertising_set_handle,
+                                              sl_bt_extended_advertiser_non_connectable,
+                                              0);
+    } else
+#endif
+#if defined(TAG_GATT_PROVISIONING_PRESENT)
+    // Provisioning station connects on any advertising set of the window (single connection).
+    if (bmm_is_prov_window_open() && (bmm_conn_handle == BMM_CONN_HANDLE_NONE)) {
+        sc = sl_bt_legacy_advertiser_start( advertising_set_handle,
+                                            sl_bt_legacy_advertiser_connectable);
+    } else
+#endif
+#if defined(TAG_ADV_SCAN_RSP_PRESENT)
+    // Scan response is served on demand by the stack (scan requests from commissioning tools).
+    if (bmm_is_scan_rsp_active() && (bmm_scan_rsp_length != 0)) {
+        sc = sl_bt_legacy_advertiser_start( advertising_set_handle,
+                                            sl_bt_legacy_advertiser_scannable);
+    } else
+#endif
+    {
+        sc = sl_bt_legacy_advertiser_start( advertising_set_handle,
+                                            sl_bt_legacy_advertiser_non_connectable);
+    }
 
 #else
     //TODO to receive commands we need reader to connect.
@@ -139,117 +623,341 @@ static void ble_api_start_adv(uint8_t retransmissions, uint32_t min_interval, ui
 #endif
     app_assert_status(sc);
 
-    DEBUG_LOG(DBG_CAT_BLE, "Start BLE beacon advertising...");
+    DEBUG_LOG(DBG_CAT_BLE, "Start BLE beacon advertising (%s)...", ((bmm_adv_mode == BMM_ADV_EXTENDED) ? "extended" : "legacy"));
 }
 
-static void bmm_ble_api_start_adv_callback(sl_sleeptimer_timer_handle_t *handle, void *data)
+static void bmm_min_avg_max_update(bmm_min_avg_max_t *m, uint32_t value)
 {
-    // This SLEEPTIMER ISR context is running on HFXO, so we can call BLE API.
+    if (value < m->min) {
+        m->min = value;
+    }
+    if (value > m->max) {
+        m->max = value;
+    }
+    m->total += value;
+}
 
-    (void)(data);
-    (void)(handle);
+static void bmm_min_avg_max_print(const char *name, const bmm_min_avg_max_t *m, uint32_t count, const char *unit)
+{
+    printf("\n  %-22s min %lu / avg %lu / max %lu %s", name, m->min, (m->total / count), m->max, unit);
+}
 
+//! @brief Account latency from last advertiser (re)start request (main context)
+static void bmm_adv_start_latency_update(void)
+{
+    uint32_t latency_ticks = sl_sleeptimer_get_tick_count() - bmm_adv_start_tick;
+
+    bmm_min_avg_max_update(&bmm_adv_timing.start_latency_us,
+                           (uint32_t)(((uint64_t)latency_ticks * 1000000) / sl_sleeptimer_get_timer_frequency()));
+    bmm_adv_timing.starts++;
+}
+
+/**
+ * @brief Start BLE Advertiser (main context)
+ * @details Called from BLE Stack event handler on @ref BMM_EXT_SIGNAL_START_ADV, core is already
+ *     running on HFXO (EM1 requirement was taken by @ref bmm_start_adv).
+ */
+static void bmm_on_start_adv_signal(void)
+{
     // Start a BLE Advertiser
-    ble_api_start_adv(ADV_RETRANSMISSIONS, ADV_MIN_INTERVAL, ADV_MAX_INTERVAL);
+    ble_api_start_adv();
+    BOOT_TRACE_MARK(BOOT_PHASE_FIRST_ADV);
+    bmm_adv_start_latency_update();
 
-    // While BLE is being used we change the global setting to avoid going to sleep after an ISR.
-    // This means, after the ISR we go to main context to let call ble_api_fsm_run() until adv is over.
-    // This way HFXO is used.
-    bmm_adv_running = true;
-    tag_sleep_on_isr_exit(false);
+    // Energy Budget accounting (HFXO on-time is accounted once advertising is over)
+    ebm_count_event(EBM_EVT_ADV, 1);
+    ebm_count_event(EBM_EVT_ADV_RETX, (bmm_adv_cfg.retransmissions - 1));
+}
+
+//----------------------------------------------------------------------------
+// START OF MESSAGE RING IMPLEMENTATION (FIFO, variable length, zero-copy)
+//----------------------------------------------------------------------------
+// Records are stored back to back as [length][type][data...] where length
+// is (msg_type + msg_data). A record never wraps around the end of the
+// buffer, if it does not fit contiguously a wrap marker (length = 0) is
+// written and the record is placed at the beginning of the buffer instead.
+// Records consumed out of order are marked with @ref BMM_MSG_TOMBSTONE and
+// released once they reach the head of the ring.
+//----------------------------------------------------------------------------
+static void bmm_ring_init(bmm_msg_ring_t *ring)
+{
+    ring->head = 0;
+    ring->tail = 0;
+    ring->used = 0;
+    ring->count = 0;
+    ring->pad = 0;
+    memset(ring->buf, 0, ring->size);
+}
+
+static bmm_msg_t* bmm_ring_reserve(bmm_msg_ring_t *ring, uint8_t data_len)
+{
+    uint16_t needed = (uint16_t)data_len + BMM_MSG_HEADER_SIZE;
+    uint16_t contiguous = ring->size - ring->tail;
+    uint16_t free = ring->size - ring->used;
+    bmm_msg_t *msg;
+
+    if (contiguous >= needed) {
+        if (free < needed) {
+            return NULL;
+        }
+        ring->pad = 0;
+        msg = (bmm_msg_t*)&ring->buf[ring->tail];
+    } else {
+        // Record has to go to the beginning of the buffer, tail end is wasted.
+        if (free < (contiguous + needed)) {
+            return NULL;
+        }
+        // Wrap marker is only seen by the consumer once the record is committed.
+        ring->buf[ring->tail] = 0;
+        ring->pad = contiguous;
+        msg = (bmm_msg_t*)&ring->buf[0];
+    }
 
+    msg->length = data_len + 1;
+
+    return msg;
+}
+
+static void bmm_ring_commit(bmm_msg_ring_t *ring, bmm_msg_t *msg)
+{
+    uint16_t size = (uint16_t)msg->length + 1;
+
+    if (ring->pad != 0) {
+        ring->tail = 0;
+    }
+    ring->tail += size;
+    if (ring->tail >= ring->size) {
+        ring->tail = 0;
+    }
+
+    ring->used += (ring->pad + size);
+    ring->pad = 0;
+    ring->count++;
+}
+
+//! @brief Peek next beacon message from the ring (in place, no dequeuing)
+static const bmm_msg_t* bmm_ring_peek(bmm_msg_ring_t *ring)
+{
+    if (ring->count == 0) {
+        return NULL;
+    }
+
+    // Skip wrap marker
+    if (ring->buf[ring->head] == 0) {
+        ring->used -= (ring->size - ring->head);
+        ring->head = 0;
+    }
+
+    return (const bmm_msg_t*)&ring->buf[ring->head];
+}
+
+//! @brief Release the message returned by @ref bmm_ring_peek (and any consumed messages behind it)
+static void bmm_ring_release(bmm_msg_ring_t *ring)
+{
+    uint16_t size;
+
+    do {
+        if (bmm_ring_peek(ring) == NULL) {
+            return;
+        }
+
+        size = (uint16_t)(ring->buf[ring->head] & BMM_MSG_LENGTH_MASK) + 1;
+        ring->head += size;
+        if (ring->head >= ring->size) {
+            ring->head = 0;
+        }
+        ring->used -= size;
+        ring->count--;
+
+        // Ring is empty, start over from the beginning so we have max. contiguous space.
+        if (ring->count == 0) {
+            ring->head = 0;
+            ring->tail = 0;
+            ring->used = 0;
+        }
+    } while ((bmm_ring_peek(ring) != NULL) && (ring->buf[ring->head] & BMM_MSG_TOMBSTONE));
 }
 
+/**
+ * @brief Walk committed messages in FIFO order without removing them.
+ * @param ring
+ * @param index ring position, set to ring head before first call.
+ * @return next message or NULL when all 'n' messages were visited.
+ */
+static bmm_msg_t* bmm_ring_walk(bmm_msg_ring_t *ring, uint16_t *index, uint16_t *n)
+{
+    bmm_msg_t *msg;
+
+    if (*n >= ring->count) {
+        return NULL;
+    }
+
+    // Skip wrap marker
+    if (ring->buf[*index] == 0) {
+        *index = 0;
+    }
+
+    msg = (bmm_msg_t*)&ring->buf[*index];
+
+    *index += (uint16_t)(msg->length & BMM_MSG_LENGTH_MASK) + 1;
+    if (*index >= ring->size) {
+        *index = 0;
+    }
+    (*n)++;
+
+    return msg;
+}
 //----------------------------------------------------------------------------
-// START OF CIRCULAR QUEUE IMPLEMENTATION (FIFO)
+// END OF MESSAGE RING IMPLEMENTATION
 //----------------------------------------------------------------------------
+
+//! @brief Init both BLE Manager message queues (critical and periodic)
 void bmm_queue_init(void)
 {
-    queue.front = -1;
-    queue.rear = -1;
-    memset(queue.item, 0, (sizeof(queue.item) / sizeof(queue.item[0])) * BLE_CIRCULAR_BUFFER_SIZE);
+    bmm_ring_init(&msg_ring[BMM_MSG_CRITICAL]);
+    bmm_ring_init(&msg_ring[BMM_MSG_PERIODIC]);
 }
 
-bool bmm_queue_is_empty(void)
+bool bmm_queue_is_empty(bmm_msg_priority_t priority)
 {
-    return (queue.front == -1);
+    return (msg_ring[priority].count == 0);
 }
 
-bool bmm_queue_is_full(void)
+/**
+ * @brief Nothing to advertise nor to configure (Tag Main Machine may sleep until its next deadline)
+ */
+bool bmm_is_idle(void)
 {
-    return (((queue.rear + 1) % BLE_CIRCULAR_BUFFER_SIZE) == queue.front);
+    return (!bmm_adv_running &&
+            (bmm_adv_cfg_req_mask == 0) &&
+            bmm_queue_is_empty(BMM_MSG_CRITICAL) &&
+            bmm_queue_is_empty(BMM_MSG_PERIODIC));
 }
 
-//! @brief Add a beacon message in the queue.
-uint32_t bmm_enqueue_msg(bmm_msg_t *msg)
+/**
+ * @brief Reserve space for a beacon message directly in the queue.
+ * @details Critical queue rejects new messages when full (caller keeps the event
+ *     pending). Periodic queue drops its oldest messages to make room instead.
+ *     Messages served from scan response take no queue space at all.
+ * @param priority queue the message goes to
+ * @param type msg_type
+ * @param data_len number of data bytes (msg_type is not included)
+ * @return pointer to the message record (data to be filled in by caller)
+ *     or NULL if there is no space left. Must be followed by @ref bmm_commit_msg.
+ * @note Only one reservation per queue can be outstanding at a time.
+ */
+bmm_msg_t* bmm_reserve_msg(bmm_msg_priority_t priority, uint8_t type, uint8_t data_len)
 {
-    uint32_t status;
+    bmm_msg_ring_t *ring;
+    bmm_msg_t *msg;
 
-    if (bmm_queue_is_full()) {
-        DEBUG_LOG(DBG_CAT_BLE, "Queue is full!");
-        status = -1;
-    } else {
-        if (bmm_queue_is_empty()) {
-            queue.front++;
+    if ((priority >= BMM_MSG_PRIORITY_MAX) || (data_len > BLE_MSG_MAX_DATASIZE)) {
+        return NULL;
+    }
+
+#if defined(TAG_ADV_SCAN_RSP_PRESENT)
+    // Commissioning data goes to scan response instead, decided before any periodic message is evicted.
+    if (bmm_is_scan_rsp_active() && (bmm_get_scan_rsp_slot(type) != NULL)) {
+        msg = (bmm_msg_t*)bmm_scan_rsp_record;
+        msg->length = data_len + 1;
+        msg->type = type;
+        return msg;
+    }
+#endif
+
+    ring = &msg_ring[priority];
+    msg = bmm_ring_reserve(ring, data_len);
+
+    if (priority == BMM_MSG_PERIODIC) {
+        // Evict oldest periodic messages until the new one fits.
+        while ((msg == NULL) && (ring->count > 0)) {
+            bmm_ring_release(ring);
+            DEBUG_LOG(DBG_CAT_BLE, "Periodic queue is full, oldest message was dropped");
+            msg = bmm_ring_reserve(ring, data_len);
         }
-        queue.rear = (queue.rear + 1) % BLE_CIRCULAR_BUFFER_SIZE;
-        memcpy(&queue.item[queue.rear], msg, sizeof(bmm_msg_t));
-        status = 0;
     }
 
-    return status;
+    if (msg != NULL) {
+        msg->type = type;
+    }
+
+    return msg;
 }
 
-//! @brief Peek next beacon message from the queue (no dequeuing)
-static uint32_t bmm_peek_queue(bmm_msg_t *msg)
+#if defined(TAG_ADV_SCAN_RSP_PRESENT)
+/**
+ * @brief Keep latest Firmware Revision / Tag Extended Status message for scan response
+ * @return 0 if message belongs to scan response.
+ */
+static uint32_t bmm_set_scan_rsp_slot(const bmm_msg_t *msg)
 {
-    uint32_t status;
-    if (bmm_queue_is_empty()) {
-        status = 1;
-    } else {
-        memcpy(msg, &queue.item[queue.front], sizeof(bmm_msg_t));
-        status = 0;
+    bmm_scan_rsp_slot_t *slot = bmm_get_scan_rsp_slot(msg->type);
+
+    if (slot == NULL) {
+        return 1;
     }
 
-    return status;
+    slot->length = msg->length;
+    slot->type = msg->type;
+    memcpy(slot->data, msg->data, (msg->length - 1));
+    bmm_scan_rsp_dirty = true;
+
+    return 0;
 }
+#endif
 
-//! @brief Dequeue beacon message from the queue
-static uint32_t bmm_dequeue_msg(bmm_msg_t *msg)
+/**
+ * @brief Commit a message previously reserved with @ref bmm_reserve_msg
+ * @param priority (same used for reservation)
+ * @param msg
+ * @return 0 if message was added to the queue.
+ */
+uint32_t bmm_commit_msg(bmm_msg_priority_t priority, bmm_msg_t *msg)
 {
-    uint32_t status;
+    if ((msg == NULL) || (priority >= BMM_MSG_PRIORITY_MAX)) {
+        return 1;
+    }
 
-    if (bmm_queue_is_empty()) {
-        status = 1;
-    } else {
-        memcpy(msg, &queue.item[queue.front], sizeof(bmm_msg_t));
-        if (queue.front == queue.rear) {
-            queue.front = -1;
-            queue.rear = -1;
-        } else {
-            queue.front = ((queue.front + 1) % BLE_CIRCULAR_BUFFER_SIZE);
-        }
-        status = 0;
+#if defined(TAG_ADV_SCAN_RSP_PRESENT)
+    // Reserved for scan response (see @ref bmm_reserve_msg), no queue record behind it.
+    if (msg == (bmm_msg_t*)bmm_scan_rsp_record) {
+        return bmm_set_scan_rsp_slot(msg);
     }
+#endif
 
-    return status;
+    bmm_ring_commit(&msg_ring[priority], msg);
+
+    return 0;
 }
-//----------------------------------------------------------------------------
-// END OF QUEUE IMPLEMENTATION
-//----------------------------------------------------------------------------
 
 /**
- * @brief Schedule a BLE API call to start BLE Advertiser
- * @note Wrap BLE API call in a SLEEPTIMER context where HFXO will be restored.
+ * @brief Request BLE Advertiser start from main context
+ * @details BLE API must not be called from this ISR context, so main loop is signaled through
+ *     BLE Stack external signal. HFXO is requested once here (EM1 requirement) and released as
+ *     soon as the advertising set is over (@ref bmm_adv_timeout_handler).
  */
 static void bmm_start_adv(void)
 {
-    sl_sleeptimer_start_timer_ms( &bmm_ble_api_sched_timer,
-                                  1,
-                                  bmm_ble_api_start_adv_callback,
-                                  (void*)NULL,
-                                  0,
-                                  0);
+    bmm_adv_request_tick = sl_sleeptimer_get_tick_count();
+    bmm_adv_start_tick = bmm_adv_request_tick;
+
+    if (!bmm_em1_requirement) {
+        sl_power_manager_add_em_requirement(SL_POWER_MANAGER_EM1);
+        bmm_em1_requirement = true;
+    }
+
+#if defined(TAG_HFXO_PREWARM_PRESENT)
+    // Pre-warm EM1 requirement is handed over to ours, HFXO keeps running.
+    tpm_hfxo_prewarm_consume();
+#endif
+
+    // While BLE is being used we change the global setting to avoid going to sleep after an ISR.
+    // This means, after the ISR we go to main context to let call ble_api_fsm_run() until adv is over.
+    bmm_adv_running = true;
+    tag_sleep_on_isr_exit(false);
+
+    bmm_adv_pending = BMM_ADV_PENDING_START;
+    sl_bt_external_signal(BMM_EXT_SIGNAL_START_ADV);
 }
 
 static void bmm_append_adv_flags(uint8_t *pdu_len, uint8_t flags)
@@ -259,37 +967,50 @@ static void bmm_append_adv_flags(uint8_t *pdu_len, uint8_t flags)
     adv_payload.data[(*pdu_len)++] = flags;
 }
 
-static void bmm_append_adv_complete_local_name(uint8_t *pdu_len)
+#if defined(TAG_ADV_LOCAL_NAME_PRESENT)
+static void bmm_append_adv_local_name(uint8_t *pdu_len)
 {
     uint8_t i;
+    uint8_t name_len = (uint8_t)strlen(tag_name);
 
-    // Keep index where name length should be placed.
-    uint8_t temp = (*pdu_len);
+#if defined(TAG_ADV_LOCAL_NAME_SHORTENED)
+    if (name_len > TAG_ADV_SHORT_NAME_LEN) {
+        name_len = TAG_ADV_SHORT_NAME_LEN;
+    }
+    bmm_ble_adv_types_t ad_type = ADV_SHORTENED_LOCAL_NAME;
+#else
+    bmm_ble_adv_types_t ad_type = ADV_COMPLETE_LOCAL_NAME;
+#endif
 
-    // Add length (to be calculated below)
-    adv_payload.data[(*pdu_len)++] = 0;
+    // Add length (adv_type + name)
+    adv_payload.data[(*pdu_len)++] = name_len + 1;
 
     // Add adv_type
-    adv_payload.data[(*pdu_len)++] = ADV_COMPLETE_LOCAL_NAME;
+    adv_payload.data[(*pdu_len)++] = ad_type;
 
     // Add tag_name
-    for (i = 0; i < strlen(tag_name); i++) {
+    for (i = 0; i < name_len; i++) {
         adv_payload.data[(*pdu_len)++] = tag_name[i];
     }
-
-    // Add the length
-    adv_payload.data[temp] = i + 1;
-
 }
+#endif
 
-static void bmm_append_user_data(uint8_t *pdu_len, bmm_msg_t *msg)
+static void bmm_append_user_data(uint8_t *pdu_len, const bmm_msg_t *msg, bmm_msg_priority_t priority)
 {
     uint8_t i;
 
-    if (*pdu_len > ADV_PAYLOAD_MAX_LEN) {
+    if (((*pdu_len) + msg->length) > ADV_PAYLOAD_BUFFER_LEN) {
         DEBUG_LOG(DBG_CAT_BLE, "Error ADV PAYLOAD size exceeded...");
     } else {
 
+        // Keep track of messages in ADV_PDU (needed to rebuild it while advertising set is running)
+        if (bmm_adv_msg_count < BMM_ADV_MAX_MSGS) {
+            bmm_adv_msgs[bmm_adv_msg_count].offset = (*pdu_len);
+            bmm_adv_msgs[bmm_adv_msg_count].length = (msg->length & BMM_MSG_LENGTH_MASK);
+            bmm_adv_msgs[bmm_adv_msg_count].priority = priority;
+            bmm_adv_msg_count++;
+        }
+
         // Append message type
         adv_payload.data[(*pdu_len)++] = msg->type;
 
@@ -300,98 +1021,468 @@ static void bmm_append_user_data(uint8_t *pdu_len, bmm_msg_t *msg)
     }
 }
 
-static void bmm_process_packet_aggregation(uint8_t *pdu_len, uint8_t *userdata_len)
-{
-    bool finished = false;
-    bmm_msg_t msg;
+/**
+ * @brief Select the subset of periodic messages that best fills the remaining space
+ * @details Small subset-sum over message lengths (payload is at most @ref ADV_PAYLOAD_BUFFER_LEN bytes).
+ *     When several subsets fill the same space, the one made of older messages wins.
+ * @param len message lengths in FIFO order
+ * @param n number of messages
+ * @param space bytes left in ADV_PDU
+ * @return bitmask of selected messages
+ */
+static uint16_t bmm_select_best_fit(const uint8_t *len, uint8_t n, uint8_t space)
+{
+    static uint16_t subset[ADV_PAYLOAD_BUFFER_LEN + 1];
+    static bool reachable[ADV_PAYLOAD_BUFFER_LEN + 1];
+    int16_t sum;
+    uint8_t i;
 
-    do {
-        if(bmm_peek_queue(&msg) != 1) {                                         // Peek a message from the queue (does not remove from the queue)
-            if (((*pdu_len) + msg.length) < ADV_PAYLOAD_MAX_LEN) {              // If message fits into the ADV_PDU buffer then proceed.
-                (*userdata_len) += msg.length;                                  // Update manuf. spec. data length
-                bmm_dequeue_msg(&msg);                                          // Grab message from the queue (this time it will remove from the queue)
-                bmm_append_user_data(pdu_len, &msg);                            // And append message to ADV_PDU buffer
-            } else {                                                            // If message does not fit then leave it in the queue and exit.
-                finished = true;                                                // If it does not fit, just exit.
+    memset(reachable, 0, sizeof(reachable));
+    reachable[0] = true;
+    subset[0] = 0;
+
+    for (i = 0; i < n; i++) {
+        for (sum = space; sum >= len[i]; sum--) {
+            if (!reachable[sum] && reachable[sum - len[i]]) {
+                reachable[sum] = true;
+                subset[sum] = subset[sum - len[i]] | (1 << i);
             }
-        } else {
-            finished = true;                                                    // In case there is no more messages in the queue, just exit.
         }
-    } while (!finished);
+    }
+
+    for (sum = space; sum > 0; sum--) {
+        if (reachable[sum]) {
+            return subset[sum];
+        }
+    }
 
+    return 0;
 }
+
+//! @brief Space for beacon messages in ADV_PDU (MIC trailer of secured ADV_PDU excluded)
+static uint8_t bmm_get_adv_max_len(void)
+{
+    uint8_t max_len = (bmm_adv_mode == BMM_ADV_EXTENDED) ? EXT_ADV_PAYLOAD_MAX_LEN : ADV_PAYLOAD_MAX_LEN;
+
+#if defined(TAG_BEACON_AUTH_PRESENT)
+    if (bmm_adv_secured) {
+        max_len -= TBA_MIC_LEN;
+    }
+#endif
+
+    return max_len;
+}
+
 /**
- * @brief Append Tag Data into the ADV_PDU
- * @details This function will try to fit "aggregate" as many beacon messages as possible in the ADV_PAYLOAD.
+ * @brief Space for one beacon message in an otherwise empty ADV_PDU
+ * @param priority critical messages always go out in a legacy ADV_PDU (see @ref bmm_select_adv_mode)
+ */
+static uint8_t bmm_get_msg_max_len(bmm_msg_priority_t priority)
+{
+    uint8_t max_len = ADV_PAYLOAD_MAX_LEN;
+
+#if defined(TAG_BLE_EXT_ADV_PRESENT)
+    if (bmm_ext_adv_enabled && (priority == BMM_MSG_PERIODIC)) {
+        max_len = EXT_ADV_PAYLOAD_MAX_LEN;
+    }
+#else
+    (void)(priority);
+#endif
+#if defined(TAG_BEACON_AUTH_PRESENT)
+    if (tba_is_enabled()) {
+        max_len -= TBA_OVERHEAD_LEN;
+    }
+#endif
+
+    return (max_len - bmm_adv_prefix.length);
+}
+
+/**
+ * @brief Drop queued messages larger than any ADV_PDU they may go out in
+ * @details Such a message would stall the critical queue (FIFO) or stay in the periodic
+ *     queue forever, leaving nothing else to advertise.
+ */
+static void bmm_drop_oversize_msgs(void)
+{
+    bmm_msg_ring_t *ring = &msg_ring[BMM_MSG_CRITICAL];
+    uint8_t max_len = bmm_get_msg_max_len(BMM_MSG_CRITICAL);
+    bmm_msg_t *msg;
+    uint16_t index;
+    uint16_t n;
+
+    // Critical queue is only consumed from its head, the others are dropped once they get there.
+    while (((msg = (bmm_msg_t*)bmm_ring_peek(ring)) != NULL) && (msg->length > max_len)) {
+        DEBUG_LOG(DBG_CAT_WARNING, "Critical message 0x%02X does not fit in ADV_PDU, dropped...", msg->type);
+        bmm_ring_release(ring);
+        bmm_oversize_drop_count++;
+    }
+
+    ring = &msg_ring[BMM_MSG_PERIODIC];
+    max_len = bmm_get_msg_max_len(BMM_MSG_PERIODIC);
+    index = ring->head;
+    n = 0;
+    while ((msg = bmm_ring_walk(ring, &index, &n)) != NULL) {
+        if (!(msg->length & BMM_MSG_TOMBSTONE) && (msg->length > max_len)) {
+            DEBUG_LOG(DBG_CAT_WARNING, "Periodic message 0x%02X does not fit in ADV_PDU, dropped...", msg->type);
+            msg->length |= BMM_MSG_TOMBSTONE;
+            bmm_oversize_drop_count++;
+        }
+    }
+
+    if ((bmm_ring_peek(ring) != NULL) && (ring->buf[ring->head] & BMM_MSG_TOMBSTONE)) {
+        bmm_ring_release(ring);
+    }
+}
+
+/**
+ * @brief Pack queued messages into ADV_PDU
+ * @details Critical messages go first in FIFO order. The remaining space is then filled
+ *     with the best fitting combination of periodic messages, those left out stay queued
+ *     for the next advertising.
+ */
+static void bmm_process_packet_aggregation(uint8_t *pdu_len, uint8_t *userdata_len)
+{
+    uint8_t max_len = bmm_get_adv_max_len();
+    bmm_pdu_stats_t *stats = &bmm_pdu_stats[bmm_adv_mode];
+    bmm_msg_ring_t *ring = &msg_ring[BMM_MSG_CRITICAL];
+    bmm_msg_t *candidate[BMM_PACKING_MAX_CANDIDATES];
+    uint8_t candidate_len[BMM_PACKING_MAX_CANDIDATES];
+    const bmm_msg_t *msg;
+    uint16_t selected;
+    uint16_t index;
+    uint16_t n;
+    uint8_t count;
+    uint8_t i;
+
+    // Critical messages first, FIFO order is kept.
+    while ((msg = bmm_ring_peek(ring)) != NULL) {
+        if (((*pdu_len) + msg->length) > max_len) {
+            break;                                                              // If it does not fit leave it in the queue for next ADV_PDU.
+        }
+        (*userdata_len) += msg->length;                                         // Update service data length
+        bmm_append_user_data(pdu_len, msg, BMM_MSG_CRITICAL);                   // Append message to ADV_PDU buffer straight from the queue
+        bmm_ring_release(ring);                                                 // And remove it from the queue
+    }
+
+    // Then fill remaining space with periodic messages.
+    ring = &msg_ring[BMM_MSG_PERIODIC];
+    index = ring->head;
+    n = 0;
+    count = 0;
+    while ((count < BMM_PACKING_MAX_CANDIDATES) && ((candidate[count] = bmm_ring_walk(ring, &index, &n)) != NULL)) {
+        if (!(candidate[count]->length & BMM_MSG_TOMBSTONE)) {
+            candidate_len[count] = candidate[count]->length;
+            count++;
+        }
+    }
+
+    selected = bmm_select_best_fit(candidate_len, count, max_len - (*pdu_len));
+
+    for (i = 0; i < count; i++) {
+        if (selected & (1 << i)) {
+            (*userdata_len) += candidate[i]->length;
+            bmm_append_user_data(pdu_len, candidate[i], BMM_MSG_PERIODIC);
+            candidate[i]->length |= BMM_MSG_TOMBSTONE;                          // Consumed, it is released once it reaches the ring head.
+        }
+    }
+
+    // Release consumed messages sitting at the head of the ring.
+    if ((bmm_ring_peek(ring) != NULL) && (ring->buf[ring->head] & BMM_MSG_TOMBSTONE)) {
+        bmm_ring_release(ring);
+    }
+
+    // PDU fill statistics
+    stats->adv_count++;
+    stats->total_bytes += (*pdu_len);
+    if ((*pdu_len) < stats->min_len) {
+        stats->min_len = (*pdu_len);
+    }
+    if ((*pdu_len) > stats->max_len) {
+        stats->max_len = (*pdu_len);
+    }
+}
+
+/**
+ * @brief Append Tag Data header into the ADV_PDU
+ * @details Only the constant part (AD type, UUID and Tag ID) is written here, length is
+ *     written per advertising once packet aggregation is done.
  * @param pdu_len variable holding PDU length counter
  */
-static void bmm_append_tag_data(uint8_t *pdu_len, bmm_ble_adv_types_t ad_type)
+static void bmm_append_tag_data_header(uint8_t *pdu_len, bmm_ble_adv_types_t ad_type)
 {
-    // Save current index position, we will use this later when packet aggregation is done.
-    uint8_t man_spec_data_len_index = (*pdu_len);
-    uint8_t man_spec_data_len = 0;
+    // Save current index position, length is only known after packet aggregation.
+    bmm_adv_prefix.data_len_index = (*pdu_len);
+    bmm_adv_prefix.data_len = 0;
 
-    // Fill in all Manufacturer Specific Data fields
     adv_payload.data[(*pdu_len)++] = 0;                                         // placeholder for the length once we finish packet assembly.
     adv_payload.data[(*pdu_len)++] = ad_type;                                   // set ADV_TYPE id
-    man_spec_data_len++;
+    bmm_adv_prefix.data_len++;
     if (ad_type == ADV_MANU_SPEC_DATA) {
         adv_payload.data[(*pdu_len)++] = UUID_MSD_GUARD_L;                      // GuardRFID 16-bits UUID for MSD (little-endian)
-        man_spec_data_len++;
+        bmm_adv_prefix.data_len++;
         adv_payload.data[(*pdu_len)++] = UUID_MSD_GUARD_H;
-        man_spec_data_len++;
+        bmm_adv_prefix.data_len++;
 
     } else if (ad_type == ADV_SERVICE_DATA) {
         adv_payload.data[(*pdu_len)++] = UUID_SD_GUARD_L;                       // GuardRFID 16-bits UUID for SD (little-endian)
-        man_spec_data_len++;
+        bmm_adv_prefix.data_len++;
         adv_payload.data[(*pdu_len)++] = UUID_SD_GUARD_H;
-        man_spec_data_len++;
+        bmm_adv_prefix.data_len++;
     }
 
+    bmm_adv_prefix.tag_id_index = (*pdu_len);
     adv_payload.data[(*pdu_len)++] = TAG_ID;                                    // BLE Tag Type ID
-    man_spec_data_len++;
+    bmm_adv_prefix.data_len++;
+}
+
+/**
+ * @brief Build the constant part of ADV_PDU (flags, local name, tag data header)
+ * @note Called once at init, every advertising only appends the beacon messages after it.
+ */
+static void bmm_build_adv_prefix(void)
+{
+    uint8_t pdu_len = 0;
+
+    memset(&adv_payload, 0, sizeof(adv_payload));
+
+#if 0
+    // Check if this BLE Manager is currently set to advertise as "advertiser_connectable_non_scannable".
+    // TODO Need to decide how this policy will be managed by BMM.
+    if(connectable) {
+        //! If so, then we must add the advertise flags according to BLE specs
+        bmm_append_adv_flags(&pdu_len, flag_value);
+    }
+#endif
+
+#if defined(TAG_ADV_LOCAL_NAME_PRESENT)
+    // Append Local Name
+    bmm_append_adv_local_name(&pdu_len);
+#endif
+
+    // Append Manufacturer Specific Data (MSD)
+    //bmm_append_tag_data_header(&pdu_len, ADV_MANU_SPEC_DATA);
+
+    // Append Service Data (SD)
+    bmm_append_tag_data_header(&pdu_len, ADV_SERVICE_DATA);
+
+    bmm_adv_prefix.length = pdu_len;
+    adv_payload.length = pdu_len;
+}
+
+/**
+ * @brief Get RF profile (message class) of a beacon message
+ * @details Alarm grade delivery is only given to urgent (critical queue) alarm messages,
+ *     periodic reports of the same type (e.g. staying in field) use standard profile.
+ */
+static bmm_rf_profile_t bmm_get_msg_rf_profile(uint8_t type, bmm_msg_priority_t priority)
+{
+    bmm_rf_profile_t profile;
+
+    switch (type) {
+        case BLE_MSG_LF_FIELD:
+        case BLE_MSG_BUTTON_PRESS:
+        case BLE_MSG_FALL_DETECTION:
+            profile = BMM_RF_PROFILE_ALARM;
+            break;
+
+        case BLE_MSG_TAG_STATUS:
+            // Present in every ADV_PDU, it only raises the profile when sent for async events.
+            profile = ((priority == BMM_MSG_CRITICAL) ? BMM_RF_PROFILE_STANDARD : BMM_RF_PROFILE_ROUTINE);
+            break;
+
+        case BLE_MSG_COMMAND_ACK:
+            profile = BMM_RF_PROFILE_STANDARD;
+            break;
+
+        case BLE_MSG_TEMPERATURE:
+        case BLE_MSG_TAG_EXT_STATUS:
+        case BLE_MSG_UPTIME:
+        case BLE_MSG_POWER_STATS:
+        case BLE_MSG_FIRMWARE_REV:
+        default:
+            profile = BMM_RF_PROFILE_ROUTINE;
+            break;
+    }
+
+    if ((priority == BMM_MSG_PERIODIC) && (profile > BMM_RF_PROFILE_STANDARD)) {
+        profile = BMM_RF_PROFILE_STANDARD;
+    }
+
+    return profile;
+}
+
+//! @brief RF profile of current ADV_PDU is the one of its highest class message.
+static bmm_rf_profile_t bmm_get_adv_rf_profile(void)
+{
+    bmm_rf_profile_t profile = BMM_RF_PROFILE_ROUTINE;
+    bmm_rf_profile_t p;
+    uint8_t i;
+
+    for (i = 0; i < bmm_adv_msg_count; i++) {
+        p = bmm_get_msg_rf_profile(adv_payload.data[bmm_adv_msgs[i].offset], bmm_adv_msgs[i].priority);
+        if (p > profile) {
+            profile = p;
+        }
+    }
+
+    return profile;
+}
+
+#if defined(TAG_READER_ACK_PRESENT)
+//! @brief Check if current ADV_PDU carries critical messages
+static bool bmm_adv_has_critical_msg(void)
+{
+    uint8_t i;
+    for (i = 0; i < bmm_adv_msg_count; i++) {
+        if (bmm_adv_msgs[i].priority == BMM_MSG_CRITICAL) {
+            return true;
+        }
+    }
+    return false;
+}
+#endif
+
+//! @brief Check if advertiser is running (not listening in a scan window after advertising)
+static bool bmm_adv_is_on_air(void)
+{
+#if defined(TAG_SCAN_WINDOW_PRESENT)
+    return (bmm_scan_window == BMM_SCAN_WINDOW_NONE);
+#else
+    return true;
+#endif
+}
+
+/**
+ * @brief Append Tag Data into the ADV_PDU
+ * @details This function will try to fit "aggregate" as many beacon messages as possible in the ADV_PAYLOAD.
+ *     Prefix built by @ref bmm_build_adv_prefix is reused as is.
+ */
+static void bmm_append_tag_data(void)
+{
+    uint8_t pdu_len = bmm_adv_prefix.length;
+    uint8_t data_len = bmm_adv_prefix.data_len;
+
+    bmm_adv_msg_count = 0;
+
+#if defined(TAG_BEACON_AUTH_PRESENT)
+    // Leave room for the counter, messages are encrypted in place once pushed to the stack.
+    adv_payload.data[bmm_adv_prefix.tag_id_index] = TAG_ID;
+    bmm_adv_sealed = false;
+    bmm_adv_secured = tba_is_enabled();
+    if (bmm_adv_secured) {
+        pdu_len += TBA_COUNTER_LEN;
+        data_len += TBA_COUNTER_LEN;
+    }
+#endif
 
     // Now go thru the msg queue and aggregate messages until PDU buffer is full.
-    bmm_process_packet_aggregation(pdu_len, &man_spec_data_len);
+    bmm_process_packet_aggregation(&pdu_len, &data_len);
+
+#if defined(TAG_BEACON_AUTH_PRESENT)
+    // Room for the MIC
+    if (bmm_adv_secured) {
+        pdu_len += TBA_MIC_LEN;
+        data_len += TBA_MIC_LEN;
+    }
+#endif
 
-    // Add manufacturer specific data length to the appropriate index in the buffer.
-    adv_payload.data[man_spec_data_len_index] = man_spec_data_len;
+    // Add tag data length to the appropriate index in the buffer.
+    adv_payload.data[bmm_adv_prefix.data_len_index] = data_len;
 
     // And finally, add total PDU length.
-    adv_payload.length = (size_t)(*pdu_len);
-
+    adv_payload.length = (size_t)pdu_len;
+
+    // Pick RF profile for this ADV_PDU
+    bmm_adv_profile = bmm_get_adv_rf_profile();
+    bmm_adv_cfg = bmm_rf_profiles[bmm_adv_profile];
+
+#if defined(TAG_READER_ACK_PRESENT)
+    // Critical messages: one advertising event per attempt, retransmitted only if no reader acks it.
+    bmm_ack_expected = false;
+    bmm_ack_retries_left = 0;
+    // Acks are signed over the ADV_PDU counter, no ack expected for a plain text ADV_PDU.
+    if (bmm_ack_cfg.enabled && bmm_adv_secured && bmm_adv_has_critical_msg()) {
+        uint8_t attempts = (bmm_ack_cfg.max_attempts != 0) ? bmm_ack_cfg.max_attempts : bmm_adv_cfg.retransmissions;
+        bmm_ack_expected = true;
+        bmm_ack_retries_left = (attempts - 1);
+        bmm_adv_cfg.retransmissions = 1;
+    }
+#endif
 }
 
-static uint32_t bmm_process_msg_events(void)
+#if defined(TAG_BLE_EXT_ADV_PRESENT)
+//! @brief Sum of all queued beacon messages length (bytes they would take in ADV_PDU)
+static uint16_t bmm_get_pending_msg_bytes(void)
 {
-    uint32_t status;
+    bmm_msg_t *msg;
+    uint16_t bytes = 0;
+    uint16_t index;
+    uint16_t n;
+    uint8_t p;
+
+    for (p = 0; p < BMM_MSG_PRIORITY_MAX; p++) {
+        index = msg_ring[p].head;
+        n = 0;
+        while ((msg = bmm_ring_walk(&msg_ring[p], &index, &n)) != NULL) {
+            if (!(msg->length & BMM_MSG_TOMBSTONE)) {
+                bytes += msg->length;
+            }
+        }
+    }
 
-    if (!bmm_queue_is_empty()) {
-        uint8_t pdu_len = 0;
+    return bytes;
+}
+#endif
 
-        // Clear ADV_PDU buffer
-        memset(&adv_payload, 0, sizeof(adv_payload));
+/**
+ * @brief Select legacy or extended advertising for next ADV_PDU
+ * @details Legacy is kept whenever all pending messages fit in a legacy ADV_PDU so
+ *     readers without BLE 5 support still get them. Extended is only used to drain
+ *     a periodic backlog in a single advertising event, never while critical messages
+ *     are pending.
+ */
+static bmm_adv_mode_t bmm_select_adv_mode(void)
+{
+#if defined(TAG_GATT_PROVISIONING_PRESENT)
+    // Only legacy advertising is made connectable, backlog waits for the window to be over.
+    if (bmm_is_prov_window_open()) {
+        return BMM_ADV_LEGACY;
+    }
+#endif
+#if defined(TAG_BLE_EXT_ADV_PRESENT)
+    uint16_t overhead = 0;
 
-#if 0
-        // Check if this BLE Manager is currently set to advertise as "advertiser_connectable_non_scannable".
-        // TODO Need to decide how this policy will be managed by BMM.
-        if(connectable) {
-            //! If so, then we must add the advertise flags according to BLE specs
-            bmm_append_adv_flags(&pdu_len, flag_value);
+#if defined(TAG_BEACON_AUTH_PRESENT)
+    if (tba_is_enabled()) {
+        overhead = TBA_OVERHEAD_LEN;
+    }
+#endif
+
+    // Critical messages always go out in a legacy ADV_PDU, readers without BLE 5 must get them.
+    // Periodic backlog waits for the next advertising set.
+    if (bmm_ext_adv_enabled && bmm_queue_is_empty(BMM_MSG_CRITICAL)) {
+        if ((bmm_adv_prefix.length + overhead + bmm_get_pending_msg_bytes()) > ADV_PAYLOAD_MAX_LEN) {
+            return BMM_ADV_EXTENDED;
         }
+    }
 #endif
+    return BMM_ADV_LEGACY;
+}
 
-        // Append Complete Local Name
-        bmm_append_adv_complete_local_name(&pdu_len);
+static uint32_t bmm_process_msg_events(void)
+{
+    uint32_t status;
 
-        // Append Manufacturer Specific Data (MSD)
-        //bmm_append_tag_data(&pdu_len, ADV_MANU_SPEC_DATA);
+    bmm_drop_oversize_msgs();
 
-        // Append Service Data (SD)
-        bmm_append_tag_data(&pdu_len, ADV_SERVICE_DATA);
+    if (!bmm_queue_is_empty(BMM_MSG_CRITICAL) || !bmm_queue_is_empty(BMM_MSG_PERIODIC)) {
+        bmm_adv_mode = bmm_select_adv_mode();
 
-        status = 0;
+        // Append beacon messages to the cached ADV_PDU prefix
+        bmm_append_tag_data();
 
+        // Queues may only hold consumed (not yet released) messages, nothing to advertise then.
+        status = (bmm_adv_msg_count != 0) ? 0 : 1;
     } else {
         status = 1;
     }
@@ -399,6 +1490,129 @@ static uint32_t bmm_process_msg_events(void)
     return status;
 }
 
+/**
+ * @brief Put messages of current ADV_PDU back in their queues
+ * @note Critical queue may reject them if full (they were advertised at least once by now).
+ */
+static void bmm_requeue_adv_msgs(void)
+{
+    bmm_msg_t *msg;
+    uint8_t i;
+    uint8_t j;
+
+    for (i = 0; i < bmm_adv_msg_count; i++) {
+        bmm_adv_msg_t *m = &bmm_adv_msgs[i];
+        msg = bmm_reserve_msg(m->priority, adv_payload.data[m->offset], (m->length - 1));
+        if (msg != NULL) {
+            for (j = 0; j < (m->length - 1); j++) {
+                msg->data[j] = adv_payload.data[m->offset + 1 + j];
+            }
+            bmm_commit_msg(m->priority, msg);
+        } else {
+            DEBUG_LOG(DBG_CAT_WARNING, "Message could not be requeued...");
+        }
+    }
+
+    bmm_adv_msg_count = 0;
+}
+
+/**
+ * @brief Merge urgent (critical) messages into the running advertising set
+ * @details If they fit in the current ADV_PDU (and its RF profile) they are appended and the running
+ *     set data is updated, so they go out on its next advertising event. Otherwise the ADV_PDU is
+ *     rebuilt (urgent messages first) and the advertising set is restarted with it.
+ */
+static void bmm_process_urgent_msg(void)
+{
+    uint8_t max_len;
+    uint8_t pdu_len;
+    uint8_t data_len;
+    uint8_t trailer_len = 0;
+    uint16_t urgent_len = 0;
+    bmm_rf_profile_t urgent_profile = BMM_RF_PROFILE_ROUTINE;
+    const bmm_msg_t *msg;
+    uint16_t index;
+    uint16_t n = 0;
+    bool is_live;
+
+    // Set may have been released (or handed to main context) since the FSM looked at it,
+    // messages then wait for the next advertising set.
+    CORE_DECLARE_IRQ_STATE;
+    CORE_ENTER_ATOMIC();
+    is_live = (bmm_adv_running && (bmm_adv_pending == BMM_ADV_PENDING_NONE));
+    CORE_EXIT_ATOMIC();
+    if (!is_live) {
+        return;
+    }
+
+    bmm_drop_oversize_msgs();
+    if (bmm_queue_is_empty(BMM_MSG_CRITICAL)) {
+        return;
+    }
+    index = msg_ring[BMM_MSG_CRITICAL].head;
+
+#if defined(TAG_BEACON_AUTH_PRESENT)
+    // Back to plain text, it is sealed again (new counter) when pushed to the stack.
+    bmm_unseal_tag_data();
+    if (bmm_adv_secured) {
+        trailer_len = TBA_MIC_LEN;
+    }
+#endif
+    max_len = bmm_get_adv_max_len();
+    pdu_len = (uint8_t)(adv_payload.length - trailer_len);
+    data_len = (uint8_t)(adv_payload.data[bmm_adv_prefix.data_len_index] - trailer_len);
+
+    while ((msg = bmm_ring_walk(&msg_ring[BMM_MSG_CRITICAL], &index, &n)) != NULL) {
+        urgent_len += msg->length;
+        if (bmm_get_msg_rf_profile(msg->type, BMM_MSG_CRITICAL) > urgent_profile) {
+            urgent_profile = bmm_get_msg_rf_profile(msg->type, BMM_MSG_CRITICAL);
+        }
+    }
+
+    // Running set RF profile cannot change, set is restarted if urgent messages need a higher one.
+    // An extended set is restarted as legacy (see @ref bmm_select_adv_mode).
+    if (((pdu_len + urgent_len) <= max_len) && (urgent_profile <= bmm_adv_profile) && bmm_adv_is_on_air() &&
+        (bmm_adv_mode == BMM_ADV_LEGACY)) {
+        // Merge into running advertising set
+        while ((msg = bmm_ring_peek(&msg_ring[BMM_MSG_CRITICAL])) != NULL) {
+            data_len += msg->length;
+            bmm_append_user_data(&pdu_len, msg, BMM_MSG_CRITICAL);
+            bmm_ring_release(&msg_ring[BMM_MSG_CRITICAL]);
+        }
+        adv_payload.data[bmm_adv_prefix.data_len_index] = data_len + trailer_len;
+        adv_payload.length = (size_t)(pdu_len + trailer_len);
+
+        bmm_adv_merge_count++;
+        bmm_adv_pending = BMM_ADV_PENDING_UPDATE;
+        sl_bt_external_signal(BMM_EXT_SIGNAL_UPDATE_ADV_DATA);
+        DEBUG_LOG(DBG_CAT_BLE, "Urgent messages merged into running advertising set...");
+    } else {
+        // Rebuild ADV_PDU with urgent messages first and restart advertising set
+        bmm_requeue_adv_msgs();
+        bmm_adv_mode = bmm_select_adv_mode();
+        bmm_append_tag_data();
+
+        bmm_adv_restart_count++;
+        bmm_adv_start_tick = sl_sleeptimer_get_tick_count();
+        bmm_adv_pending = BMM_ADV_PENDING_RESTART;
+        sl_bt_external_signal(BMM_EXT_SIGNAL_RESTART_ADV);
+        DEBUG_LOG(DBG_CAT_BLE, "Urgent messages do not fit running set, restarting advertising set...");
+    }
+}
+
+//! @brief Latch requested RF profile, it will be applied on next advertising start using it.
+static void bmm_process_cfg_req(void)
+{
+    uint8_t p;
+
+    for (p = 0; p < BMM_RF_PROFILE_MAX; p++) {
+        if (bmm_adv_cfg_req_mask & (1 << p)) {
+            bmm_rf_profiles[p] = bmm_adv_cfg_req[p];
+        }
+    }
+    bmm_adv_cfg_req_mask = 0;
+}
+
 static void bmm_process_stop(void)
 {
     bmm_running = false;
@@ -419,14 +1633,17 @@ static void bmm_process_step(void)
         case BMM_START:
             bmm_process_start();
             // Make decision based on signals on what to do next...
-            // Check Beacon Messages Queue is the only thing implemented for now..
-            bmm_fsm.state = BMM_PROCESS_MSG_EVENTS;
+            bmm_fsm.state = BMM_PROCESS_CFG_REQ;
             break;
 
         case BMM_PROCESS_CFG_REQ:
             //set mac?
             //change phy config?
-            //change ad channels, timing, burst, etc?
+            // Advertising set policy (timing, channels, burst) can only change while set is not running.
+            if ((bmm_adv_cfg_req_mask != 0) && !bmm_adv_running) {
+                bmm_process_cfg_req();
+            }
+            bmm_fsm.state = BMM_PROCESS_MSG_EVENTS;
             break;
 
         case BMM_PROCESS_MSG_EVENTS:
@@ -436,11 +1653,19 @@ static void bmm_process_step(void)
                 } else {
                     bmm_fsm.state = BMM_EXIT;
                 }
+            } else if ((!bmm_queue_is_empty(BMM_MSG_CRITICAL)) && (bmm_adv_pending == BMM_ADV_PENDING_NONE)) {
+                // Urgent messages do not wait for the running advertising set to be over.
+                bmm_fsm.state = BMM_PROCESS_URGENT_MSG;
             } else {
                 bmm_fsm.state = BMM_EXIT;
             }
             break;
 
+        case BMM_PROCESS_URGENT_MSG:
+            bmm_process_urgent_msg();
+            bmm_fsm.state = BMM_EXIT;
+            break;
+
         case BMM_START_ADV:
             bmm_start_adv();
             bmm_fsm.state = BMM_EXIT;
@@ -473,13 +1698,834 @@ void ble_manager_run(void)
     } while (bmm_running);
 }
 
+/**
+ * @brief Advertising set is over, account HFXO on-time and release BLE Manager (main context)
+ */
+static void bmm_adv_set_done(void)
+{
+    uint32_t elapsed_ms;
+
+    elapsed_ms = sl_sleeptimer_tick_to_ms(sl_sleeptimer_get_tick_count() - bmm_adv_request_tick);
+
+    // Set is stopped first so urgent messages (TMM ISR) are no longer merged into it, they
+    // start a new set instead. HFXO and ADV_PDU are released before that new set may take them.
+    CORE_DECLARE_IRQ_STATE;
+    CORE_ENTER_ATOMIC();
+    bmm_adv_running = false;
+    bmm_adv_pending = BMM_ADV_PENDING_NONE;
+    bmm_adv_msg_count = 0;
+
+    // Release HFXO
+    if (bmm_em1_requirement) {
+        sl_power_manager_remove_em_requirement(SL_POWER_MANAGER_EM1);
+        bmm_em1_requirement = false;
+    }
+    CORE_EXIT_ATOMIC();
+
+    ebm_add_hfxo_time(elapsed_ms);
+    bmm_min_avg_max_update(&bmm_adv_timing.active_time_ms, elapsed_ms);
+    bmm_adv_timing.count++;
+}
+
+#if defined(TAG_SCAN_WINDOW_PRESENT)
+static void bmm_scan_timer_callback(sl_sleeptimer_timer_handle_t *handle, void *data)
+{
+    (void)(handle);
+    (void)(data);
+    sl_bt_external_signal(BMM_EXT_SIGNAL_SCAN_WINDOW_END);
+}
+
+/**
+ * @brief Open a scan window right after our own advertising (BLE API, main context)
+ * @details Readers answer (ack, downlink command) as soon as they receive the ADV_PDU.
+ * @param window purpose of the window
+ * @param window_ms
+ * @return 0 if scanner is running.
+ */
+static uint32_t ble_api_open_scan_window(bmm_scan_window_t window, uint16_t window_ms)
+{
+    sl_status_t sc;
+    uint8_t address_type;
+
+    if (!bmm_scanner_ready) {
+        // Readers address this tag by its identity address, scanner settings persist in the stack.
+        sc = sl_bt_system_get_identity_address(&bmm_identity_address, &address_type);
+        if (sc == SL_STATUS_OK) {
+            sc = sl_bt_scanner_set_mode(sl_bt_scanner_scan_phy_1m, sl_bt_scanner_scan_mode_passive);
+        }
+        if (sc == SL_STATUS_OK) {
+            sc = sl_bt_scanner_set_timing(sl_bt_scanner_scan_phy_1m, BMM_SCAN_INTERVAL, BMM_SCAN_WINDOW);
+        }
+        if (sc != SL_STATUS_OK) {
+            DEBUG_LOG(DBG_CAT_WARNING, "Scanner setup failed: 0x%lx", sc);
+            return 1;
+        }
+        bmm_scanner_ready = true;
+    }
+
+    sc = sl_bt_scanner_start(sl_bt_scanner_scan_phy_1m, sl_bt_scanner_discover_observation);
+    if (sc != SL_STATUS_OK) {
+        DEBUG_LOG(DBG_CAT_WARNING, "Scanner start failed: 0x%lx", sc);
+        return 1;
+    }
+
+    sl_sleeptimer_start_timer_ms(&bmm_scan_timer, window_ms, bmm_scan_timer_callback, NULL, 0, 0);
+    bmm_scan_window_tick = sl_sleeptimer_get_tick_count();
+    bmm_scan_window = window;
+    return 0;
+}
+
+//! @brief Close scan window (BLE API, main context)
+static void ble_api_close_scan_window(void)
+{
+    uint32_t scan_ms;
+
+    if (bmm_scan_window == BMM_SCAN_WINDOW_NONE) {
+        return;
+    }
+
+    sl_sleeptimer_stop_timer(&bmm_scan_timer);
+    sl_bt_scanner_stop();
+
+    // Energy Budget accounting (HFXO on-time is accounted once advertising set is done)
+    scan_ms = sl_sleeptimer_tick_to_ms(sl_sleeptimer_get_tick_count() - bmm_scan_window_tick);
+    ebm_count_event(EBM_EVT_RX_MS, scan_ms);
+#if defined(TAG_READER_ACK_PRESENT)
+    if (bmm_scan_window == BMM_SCAN_WINDOW_ACK) {
+        bmm_ack_stats.scan_time_ms += scan_ms;
+    }
+#endif
+#if defined(TAG_DOWNLINK_PRESENT)
+    if (bmm_scan_window == BMM_SCAN_WINDOW_DOWNLINK) {
+        bmm_dl_stats.scan_time_ms += scan_ms;
+    }
+#endif
+
+    bmm_scan_window = BMM_SCAN_WINDOW_NONE;
+}
+
+/**
+ * @brief Find a reader frame addressed to this tag in received advertising data
+ * @details Service Data AD | UUID (GuardRFID) | Frame Type | Tag identity address (LE) | ...
+ * @param data advertising data of the received report
+ * @param len
+ * @param frame_len frame length (from Frame Type byte)
+ * @return pointer to Frame Type byte, NULL if not found.
+ */
+static const uint8_t* bmm_find_reader_frame(const uint8_t *data, uint8_t len, uint8_t *frame_len)
+{
+    uint8_t i = 0;
+    uint8_t ad_len;
+
+    while ((i + 1) < len) {
+        ad_len = data[i];
+        if ((ad_len == 0) || ((i + 1 + ad_len) > len)) {
+            return NULL;
+        }
+        if ((ad_len >= BMM_READER_FRAME_MIN_LEN) &&
+            (data[i + 1] == ADV_SERVICE_DATA) &&
+            (data[i + 2] == UUID_SD_GUARD_L) &&
+            (data[i + 3] == UUID_SD_GUARD_H) &&
+            (memcmp(&data[i + 5], bmm_identity_address.addr, sizeof(bmm_identity_address.addr)) == 0)) {
+            *frame_len = (ad_len - 3);
+            return &data[i + 4];
+        }
+        i += (ad_len + 1);
+    }
+
+    return NULL;
+}
+#endif
+
+/**
+ * @brief Advertising set (and reader ack) is over, listen for a downlink command if a slot
+ *     is due, otherwise release BLE Manager (main context)
+ */
+static void bmm_adv_set_over(void)
+{
+#if defined(TAG_DOWNLINK_PRESENT)
+    // Commands are only accepted once signed, no slot without a key.
+    if (bmm_dl_cfg.enabled && tba_is_enabled()) {
+        if (bmm_dl_countdown > 0) {
+            bmm_dl_countdown--;
+        }
+        if (bmm_dl_countdown == 0) {
+            bmm_dl_countdown = bmm_dl_cfg.period;
+            if (ble_api_open_scan_window(BMM_SCAN_WINDOW_DOWNLINK, bmm_dl_cfg.window_ms) == 0) {
+                bmm_dl_stats.windows++;
+                return;
+            }
+        }
+    }
+#endif
+
+    bmm_adv_set_done();
+}
+
+#if defined(TAG_SCAN_WINDOW_PRESENT)
+/**
+ * @brief Scan window elapsed (main context)
+ * @details Ack window: advertise again or give up. Downlink window: release BLE Manager.
+ */
+static void bmm_on_scan_window_end(void)
+{
+    bmm_scan_window_t window = bmm_scan_window;
+    bool is_pending;
+
+    if (window == BMM_SCAN_WINDOW_NONE) {
+        return;
+    }
+
+    ble_api_close_scan_window();
+
+    // Retransmission seals the ADV_PDU again, urgent messages are kept out of it until it is
+    // restarted by the pending signal switch (see @ref bmm_external_signal_handler).
+    CORE_DECLARE_IRQ_STATE;
+    CORE_ENTER_ATOMIC();
+    is_pending = (bmm_adv_pending != BMM_ADV_PENDING_NONE);
+#if defined(TAG_READER_ACK_PRESENT)
+    if (!is_pending && (window == BMM_SCAN_WINDOW_ACK) && (bmm_ack_retries_left > 0)) {
+        bmm_ack_retries_left--;
+        bmm_ack_retry = true;
+        bmm_adv_pending = BMM_ADV_PENDING_RESTART;
+    }
+#endif
+    CORE_EXIT_ATOMIC();
+
+    // ADV_PDU was changed meanwhile, pending restart takes over.
+    if (is_pending) {
+        return;
+    }
+
+#if defined(TAG_READER_ACK_PRESENT)
+    if (window == BMM_SCAN_WINDOW_ACK) {
+        bmm_ack_stats.misses++;
+        if (!bmm_ack_retry) {
+            bmm_ack_expected = false;
+            bmm_adv_set_over();
+        }
+        return;
+    }
+#endif
+
+    bmm_adv_set_done();
+}
+#endif
+
+#if defined(TAG_READER_ACK_PRESENT)
+/**
+ * @brief Check a reader acknowledgment against current ADV_PDU (main context)
+ * @details Ack must carry the counter of the sealed ADV_PDU being advertised and a valid MIC
+ *     (ack key), so it can neither be forged nor replayed for a later ADV_PDU.
+ * @param frame
+ * @param len
+ * @return true if current ADV_PDU is acknowledged.
+ */
+static bool bmm_is_valid_reader_ack(const uint8_t *frame, uint8_t len)
+{
+    if ((len != BMM_ACK_FRAME_LEN) || !bmm_adv_sealed) {
+        return false;
+    }
+
+    // Counter follows Tag Type ID in the sealed frame
+    if (memcmp(&frame[1 + sizeof(bmm_identity_address.addr)],
+               &adv_payload.data[bmm_adv_prefix.tag_id_index + 1], TBA_COUNTER_LEN) != 0) {
+        return false;
+    }
+
+    return (tba_verify_ack(frame, len) == 0);
+}
+
+//! @brief Reader acknowledged current ADV_PDU, remaining attempts are cancelled (main context)
+static void bmm_on_reader_ack(void)
+{
+    ble_api_close_scan_window();
+    bmm_ack_stats.hits++;
+
+    // ADV_PDU was changed meanwhile, pending restart still has to advertise it.
+    if (bmm_adv_pending != BMM_ADV_PENDING_NONE) {
+        return;
+    }
+
+    bmm_ack_stats.events_saved += bmm_ack_retries_left;
+    bmm_ack_retries_left = 0;
+    bmm_ack_expected = false;
+    bmm_adv_set_over();
+}
+
+/**
+ * @brief Reader acknowledgment policy for ADV_PDUs carrying critical messages
+ * @param enable
+ * @param window_ms scan window after each advertising attempt
+ * @param max_attempts advertising attempts before giving up (0: RF profile events)
+ * @return 0 if policy was accepted.
+ */
+uint32_t bmm_set_ack_config(bool enable, uint16_t window_ms, uint8_t max_attempts)
+{
+    if ((window_ms < BMM_SCAN_WINDOW_MIN_MS) || (window_ms > BMM_SCAN_WINDOW_MAX_MS)) {
+        return 1;
+    }
+
+    // Taken into account from next ADV_PDU (built by Tag Main Machine)
+    CORE_DECLARE_IRQ_STATE;
+    CORE_ENTER_ATOMIC();
+    bmm_ack_cfg.window_ms = window_ms;
+    bmm_ack_cfg.max_attempts = max_attempts;
+    bmm_ack_cfg.enabled = enable;
+    CORE_EXIT_ATOMIC();
+    return 0;
+}
+#endif
+
+#if defined(TAG_DOWNLINK_PRESENT)
+/**
+ * @brief Downlink command received, handed over to Tag Command module (main context)
+ * @details One command per downlink window, next advertising set listens again so a
+ *     reader can send a sequence of commands.
+ * @param frame
+ * @param len
+ */
+static void bmm_on_downlink_frame(const uint8_t *frame, uint8_t len)
+{
+    if (tcm_post_downlink_cmd(frame, len) != 0) {
+        return;
+    }
+
+    bmm_dl_countdown = 1;
+
+    if (bmm_scan_window == BMM_SCAN_WINDOW_DOWNLINK) {
+        ble_api_close_scan_window();
+        if (bmm_adv_pending == BMM_ADV_PENDING_NONE) {
+            bmm_adv_set_done();
+        }
+    }
+}
+
+/**
+ * @brief Downlink slots policy
+ * @param enable
+ * @param window_ms scan window after advertising set
+ * @param period one downlink window every 'period' advertising sets (1-255)
+ * @return 0 if policy was accepted.
+ */
+uint32_t bmm_set_dl_config(bool enable, uint16_t window_ms, uint8_t period)
+{
+    if ((window_ms < BMM_SCAN_WINDOW_MIN_MS) || (window_ms > BMM_SCAN_WINDOW_MAX_MS) || (period == 0)) {
+        return 1;
+    }
+
+    // Called from CLI (sleeptimer ISR) or tag configuration, used by the running advertising set.
+    CORE_DECLARE_IRQ_STATE;
+    CORE_ENTER_ATOMIC();
+    bmm_dl_cfg.window_ms = window_ms;
+    bmm_dl_cfg.period = period;
+    bmm_dl_cfg.enabled = enable;
+    bmm_dl_countdown = period;
+    CORE_EXIT_ATOMIC();
+    return 0;
+}
+#endif
+
+#if defined(TAG_SCAN_WINDOW_PRESENT)
+/**
+ * @brief Scanner report handler (called from BLE Stack event handler, main context)
+ * @details Only reader frames addressed to this tag are considered, see @ref BMM_ACK_FRAME_TYPE
+ *     and @ref TCM_DL_FRAME_TYPE.
+ * @param data advertising data of the received report
+ * @param len
+ */
+void bmm_scan_report_handler(const uint8_t *data, uint8_t len)
+{
+    const uint8_t *frame;
+    uint8_t frame_len;
+
+    if (bmm_scan_window == BMM_SCAN_WINDOW_NONE) {
+        return;
+    }
+
+    frame = bmm_find_reader_frame(data, len, &frame_len);
+    if (frame == NULL) {
+        return;
+    }
+
+    switch (frame[0]) {
+#if defined(TAG_READER_ACK_PRESENT)
+        case BMM_ACK_FRAME_TYPE:
+            if ((bmm_scan_window == BMM_SCAN_WINDOW_ACK) && bmm_is_valid_reader_ack(frame, frame_len)) {
+                bmm_on_reader_ack();
+            }
+            break;
+#endif
+#if defined(TAG_DOWNLINK_PRESENT)
+        case TCM_DL_FRAME_TYPE:
+            bmm_on_downlink_frame(frame, frame_len);
+            break;
+#endif
+        default:
+            break;
+    }
+}
+#endif
+
+/**
+ * @brief Advertiser timeout handler (called from BLE Stack event handler)
+ * @details Advertising set is over, wait for a reader acknowledgment or downlink command if
+ *     needed, otherwise release BLE Manager.
+ */
+void bmm_adv_timeout_handler(void)
+{
+    bool is_pending;
+
+    // If ADV_PDU was changed meanwhile, it was not advertised yet. Keep the set alive and
+    // let the pending signal restart it.
+    CORE_DECLARE_IRQ_STATE;
+    CORE_ENTER_ATOMIC();
+    is_pending = (bmm_adv_pending != BMM_ADV_PENDING_NONE);
+    if (is_pending) {
+        bmm_adv_pending = BMM_ADV_PENDING_RESTART;
+        bmm_adv_start_tick = sl_sleeptimer_get_tick_count();
+    }
+    CORE_EXIT_ATOMIC();
+
+    if (is_pending) {
+        return;
+    }
+
+#if defined(TAG_READER_ACK_PRESENT)
+    // Keep the set alive (HFXO, ADV_PDU) while listening for the reader ack.
+    if (bmm_ack_expected) {
+        if (ble_api_open_scan_window(BMM_SCAN_WINDOW_ACK, bmm_ack_cfg.window_ms) == 0) {
+            bmm_ack_stats.windows++;
+            return;
+        }
+        bmm_ack_expected = false;
+    }
+#endif
+
+    bmm_adv_set_over();
+}
+
+/**
+ * @brief Check RF profile parameters against BLE and radio limits (see @ref bmm_set_adv_config)
+ * @return true if parameters can be applied.
+ */
+bool bmm_is_adv_config_valid(bmm_rf_profile_t profile,
+                             uint8_t retransmissions,
+                             uint16_t min_interval_ms,
+                             uint16_t max_interval_ms,
+                             uint8_t channel_map,
+                             int16_t tx_power)
+{
+    return ((profile < BMM_RF_PROFILE_MAX) &&
+            (retransmissions != 0) &&
+            (min_interval_ms >= BMM_ADV_MIN_INTERVAL_MS) &&
+            (max_interval_ms >= min_interval_ms) &&
+            (max_interval_ms <= BMM_ADV_MAX_INTERVAL_MS) &&
+            ((channel_map & ADV_CHANNEL_MAP) != 0) &&
+            ((channel_map & ~ADV_CHANNEL_MAP) == 0) &&
+            (tx_power >= ADV_TX_POWER_MIN) &&
+            (tx_power <= ADV_TX_POWER_MAX));
+}
+
+/**
+ * @brief Request a new RF profile (advertising set policy) for a message class
+ * @details Applied by BLE Manager once current advertising set is over. Each profile
+ *     has its own request, so several profiles can be changed at once.
+ * @param profile message class
+ * @param retransmissions max. num. of advertising events per set (1-255)
+ * @param min_interval_ms (20 ms or more)
+ * @param max_interval_ms (min_interval_ms or more)
+ * @param channel_map (bit 0: CH37, bit 1: CH38, bit 2: CH39)
+ * @param tx_power (0.1 dBm)
+ * @return 0 if request was accepted.
+ */
+uint32_t bmm_set_adv_config(bmm_rf_profile_t profile,
+                            uint8_t retransmissions,
+                            uint16_t min_interval_ms,
+                            uint16_t max_interval_ms,
+                            uint8_t channel_map,
+                            int16_t tx_power)
+{
+    if (!bmm_is_adv_config_valid(profile, retransmissions, min_interval_ms, max_interval_ms, channel_map, tx_power)) {
+        return 1;
+    }
+
+    // Requests come from CLI (ISR) or GATT provisioning (main context), latched by BLE Manager ISR.
+    CORE_DECLARE_IRQ_STATE;
+    CORE_ENTER_ATOMIC();
+    bmm_adv_cfg_req[profile].retransmissions = retransmissions;
+    bmm_adv_cfg_req[profile].min_interval_ms = min_interval_ms;
+    bmm_adv_cfg_req[profile].max_interval_ms = max_interval_ms;
+    bmm_adv_cfg_req[profile].channel_map = channel_map;
+    bmm_adv_cfg_req[profile].tx_power = tx_power;
+    bmm_adv_cfg_req_mask |= (1 << profile);
+    CORE_EXIT_ATOMIC();
+
+    return 0;
+}
+
+#if defined(TAG_GATT_PROVISIONING_PRESENT)
+static void bmm_conn_timer_callback(sl_sleeptimer_timer_handle_t *handle, void *data)
+{
+    (void)(handle);
+    (void)(data);
+    sl_bt_external_signal(BMM_EXT_SIGNAL_CONN_TIMEOUT);
+}
+
+//! @brief Tag drops the provisioning link (BLE API, main context)
+static void ble_api_close_connection(void)
+{
+    if (bmm_conn_handle == BMM_CONN_HANDLE_NONE) {
+        return;
+    }
+
+    if (!bmm_conn_configured) {
+        bmm_prov_stats.timeouts++;
+    }
+
+    sl_bt_connection_close(bmm_conn_handle);
+}
+
+/**
+ * @brief Open (or close) the provisioning window, legacy advertising sets are connectable meanwhile
+ * @details Called from CLI, downlink command or at boot. Station connects on any advertising
+ *     set sent during the window.
+ * @param window_sec window length (0 closes the window)
+ * @return 0 if window was opened (or closed).
+ */
+uint32_t bmm_open_prov_window(uint16_t window_sec)
+{
+    if (window_sec > BMM_PROV_WINDOW_MAX_SEC) {
+        return 1;
+    }
+
+    CORE_DECLARE_IRQ_STATE;
+    CORE_ENTER_ATOMIC();
+    bmm_prov_window_tick = sl_sleeptimer_get_tick_count();
+    bmm_prov_window_len = ((uint32_t)window_sec * sl_sleeptimer_get_timer_frequency());
+    bmm_prov_window_open = (window_sec != 0);
+    CORE_EXIT_ATOMIC();
+
+    if (window_sec != 0) {
+        bmm_prov_stats.windows++;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Provisioning station connected (called from BLE Stack event handler, main context)
+ * @details Window is closed (one station, one connection) and the link is dropped if no
+ *     configuration is written within @ref BMM_PROV_CONN_TIMEOUT_MS. Advertiser stops on
+ *     connection, advertising set is then over as on advertiser timeout.
+ * @param connection
+ */
+void bmm_on_connection_opened(uint8_t connection)
+{
+    bmm_conn_handle = connection;
+    bmm_conn_tick = sl_sleeptimer_get_tick_count();
+    bmm_conn_configured = false;
+    bmm_prov_window_open = false;
+    bmm_prov_stats.connections++;
+
+    sl_sleeptimer_start_timer_ms(&bmm_conn_timer, BMM_PROV_CONN_TIMEOUT_MS, bmm_conn_timer_callback, NULL, 0, 0);
+
+    if (bmm_adv_running) {
+        bmm_adv_timeout_handler();
+    }
+}
+
+//! @brief Provisioning link closed by either side (called from BLE Stack event handler, main context)
+void bmm_on_connection_closed(uint8_t connection)
+{
+    if (connection != bmm_conn_handle) {
+        return;
+    }
+
+    sl_sleeptimer_stop_timer(&bmm_conn_timer);
+    bmm_min_avg_max_update(&bmm_prov_stats.conn_time_ms,
+                           sl_sleeptimer_tick_to_ms(sl_sleeptimer_get_tick_count() - bmm_conn_tick));
+    bmm_conn_handle = BMM_CONN_HANDLE_NONE;
+}
+
+/**
+ * @brief Configuration batch was applied (main context)
+ * @details Link is closed right after the write response, unless station closes it first.
+ */
+void bmm_on_config_written(void)
+{
+    bmm_conn_configured = true;
+    sl_sleeptimer_restart_timer_ms(&bmm_conn_timer, BMM_PROV_CLOSE_DELAY_MS, bmm_conn_timer_callback, NULL, 0, 0);
+}
+#endif
+
+/**
+ * @brief BLE Stack external signals handler (called from BLE Stack event handler, main context)
+ * @param signals
+ */
+void bmm_external_signal_handler(uint32_t signals)
+{
+#if defined(TAG_SCAN_WINDOW_PRESENT)
+    if (signals & BMM_EXT_SIGNAL_SCAN_WINDOW_END) {
+        bmm_on_scan_window_end();
+    }
+#endif
+#if defined(TAG_GATT_PROVISIONING_PRESENT)
+    if (signals & BMM_EXT_SIGNAL_CONN_TIMEOUT) {
+        ble_api_close_connection();
+    }
+#endif
+#if !defined(TAG_SCAN_WINDOW_PRESENT) && !defined(TAG_GATT_PROVISIONING_PRESENT)
+    (void)(signals);
+#endif
+
+    // Pending work is tracked by 'bmm_adv_pending' since advertising set may time out
+    // after the signal was raised (work is then converted into a restart).
+    switch (bmm_adv_pending) {
+        case BMM_ADV_PENDING_START:
+            bmm_on_start_adv_signal();
+            break;
+
+        case BMM_ADV_PENDING_UPDATE:
+            ble_api_set_adv_data();
+            break;
+
+        case BMM_ADV_PENDING_RESTART:
+#if defined(TAG_READER_ACK_PRESENT)
+            // Ack window missed, same ADV_PDU goes out again (new counter).
+            if (bmm_ack_retry) {
+                bmm_ack_retry = false;
+                ble_api_start_adv();
+                ebm_count_event(EBM_EVT_ADV_RETX, 1);
+                break;
+            }
+#endif
+#if defined(TAG_SCAN_WINDOW_PRESENT)
+            // New ADV_PDU has its own ack policy (window of the previous one is dropped).
+            ble_api_close_scan_window();
+#endif
+            sl_bt_advertiser_stop(advertising_set_handle);
+            ble_api_start_adv();
+            bmm_adv_start_latency_update();
+            ebm_count_event(EBM_EVT_ADV, 1);
+            ebm_count_event(EBM_EVT_ADV_RETX, (bmm_adv_cfg.retransmissions - 1));
+            break;
+
+        default:
+            break;
+    }
+
+    bmm_adv_pending = BMM_ADV_PENDING_NONE;
+
+#if defined(TAG_BEACON_AUTH_PRESENT)
+    // Radio is busy with the advertising set, get next frame keystream ready meanwhile.
+    tba_process();
+#endif
+}
+
+//! @brief Print ADV_PDU fill and advertising timing statistics (CLI)
+void bmm_print_stats(void)
+{
+    static const char *mode_name[BMM_ADV_MODE_MAX] = { "Legacy", "Extended" };
+    static const uint8_t mode_max_len[BMM_ADV_MODE_MAX] = { ADV_PAYLOAD_MAX_LEN, EXT_ADV_PAYLOAD_MAX_LEN };
+    uint8_t m;
+
+    for (m = 0; m < BMM_ADV_MODE_MAX; m++) {
+        bmm_pdu_stats_t *stats = &bmm_pdu_stats[m];
+        printf("\n\n  %s ADV_PDU count:  %lu", mode_name[m], stats->adv_count);
+        if (stats->adv_count != 0) {
+            printf("\n  ADV_PDU length:       min %u / avg %lu / max %u (of %u bytes)",
+                   stats->min_len,
+                   (stats->total_bytes / stats->adv_count),
+                   stats->max_len,
+                   mode_max_len[m]);
+            printf("\n  ADV_PDU fill:         %lu%%", ((stats->total_bytes * 100) / (stats->adv_count * mode_max_len[m])));
+        }
+    }
+#if defined(TAG_BLE_EXT_ADV_PRESENT)
+    printf("\n\n  Extended advertising: %s", (bmm_ext_adv_enabled ? "On" : "Off"));
+#endif
+#if defined(TAG_ADV_SCAN_RSP_PRESENT)
+    printf("\n  Scan response:        %s (%d bytes)", (bmm_is_scan_rsp_active() ? "On" : (bmm_scan_rsp_enabled ? "Off (beacon auth. on)" : "Off")), bmm_scan_rsp_length);
+#endif
+    printf("\n  Queued messages:      critical %u / periodic %u (oversize dropped %lu)",
+           msg_ring[BMM_MSG_CRITICAL].count,
+           msg_ring[BMM_MSG_PERIODIC].count,
+           bmm_oversize_drop_count);
+
+    static const char *profile_name[BMM_RF_PROFILE_MAX] = { "Routine", "Standard", "Alarm" };
+    uint8_t p;
+
+    for (p = 0; p < BMM_RF_PROFILE_MAX; p++) {
+        printf("\n%s  RF profile %d (%-8s) %d-%d ms, %d events, channel map 0x%X, %d (0.1 dBm)",
+               ((p == 0) ? "\n" : ""),
+               p,
+               profile_name[p],
+               bmm_rf_profiles[p].min_interval_ms,
+               bmm_rf_profiles[p].max_interval_ms,
+               bmm_rf_profiles[p].retransmissions,
+               bmm_rf_profiles[p].channel_map,
+               bmm_rf_profiles[p].tx_power);
+    }
+    printf("\n  Advertising sets:     %lu (urgent merged %lu, restarted %lu)", bmm_adv_timing.count, bmm_adv_merge_count, bmm_adv_restart_count);
+    if (bmm_adv_timing.count != 0) {
+        bmm_min_avg_max_print("Start latency:", &bmm_adv_timing.start_latency_us, bmm_adv_timing.starts, "us");
+        bmm_min_avg_max_print("EM0/EM1 (HFXO) time:", &bmm_adv_timing.active_time_ms, bmm_adv_timing.count, "ms");
+    }
+#if defined(TAG_READER_ACK_PRESENT)
+    printf("\n\n  Reader ack:           %s (window %d ms, attempts %d)",
+           (bmm_ack_cfg.enabled ? "On" : "Off"),
+           bmm_ack_cfg.window_ms,
+           bmm_ack_cfg.max_attempts);
+    printf("\n  Ack windows:          %lu (hits %lu, misses %lu, scan time %lu ms)",
+           bmm_ack_stats.windows,
+           bmm_ack_stats.hits,
+           bmm_ack_stats.misses,
+           bmm_ack_stats.scan_time_ms);
+    printf("\n  Adv. events saved:    %lu", bmm_ack_stats.events_saved);
+#endif
+#if defined(TAG_DOWNLINK_PRESENT)
+    printf("\n\n  Downlink:             %s (window %d ms, every %d adv. sets)",
+           ((bmm_dl_cfg.enabled && tba_is_enabled()) ? "On" : "Off"),
+           bmm_dl_cfg.window_ms,
+           bmm_dl_cfg.period);
+    printf("\n  Downlink windows:     %lu (scan time %lu ms)", bmm_dl_stats.windows, bmm_dl_stats.scan_time_ms);
+    tcm_print_stats();
+#endif
+#if defined(TAG_GATT_PROVISIONING_PRESENT)
+    printf("\n\n  Provisioning window:  %s (opened %lu)", (bmm_is_prov_window_open() ? "Open" : "Closed"), bmm_prov_stats.windows);
+    printf("\n  Connections:          %lu (dropped by tag %lu)", bmm_prov_stats.connections, bmm_prov_stats.timeouts);
+    if (bmm_prov_stats.connections != 0) {
+        bmm_min_avg_max_print("Connection time:", &bmm_prov_stats.conn_time_ms, bmm_prov_stats.connections, "ms");
+    }
+    tcf_print_stats();
+#endif
+#if defined(TAG_BEACON_AUTH_PRESENT)
+    tba_print_stats();
+#endif
+}
+
+void bmm_reset_stats(void)
+{
+    // Called from CLI (sleeptimer ISR), statistics are updated by Tag Main Machine and main context.
+    CORE_DECLARE_IRQ_STATE;
+    CORE_ENTER_ATOMIC();
+    memset(&bmm_adv_timing, 0, sizeof(bmm_adv_timing));
+    bmm_adv_merge_count = 0;
+    bmm_adv_restart_count = 0;
+    bmm_oversize_drop_count = 0;
+    bmm_adv_timing.start_latency_us.min = UINT32_MAX;
+    bmm_adv_timing.active_time_ms.min = UINT32_MAX;
+
+    memset(bmm_pdu_stats, 0, sizeof(bmm_pdu_stats));
+    bmm_pdu_stats[BMM_ADV_LEGACY].min_len = ADV_PAYLOAD_MAX_LEN;
+    bmm_pdu_stats[BMM_ADV_EXTENDED].min_len = EXT_ADV_PAYLOAD_MAX_LEN;
+#if defined(TAG_READER_ACK_PRESENT)
+    memset(&bmm_ack_stats, 0, sizeof(bmm_ack_stats));
+#endif
+#if defined(TAG_DOWNLINK_PRESENT)
+    memset(&bmm_dl_stats, 0, sizeof(bmm_dl_stats));
+#endif
+#if defined(TAG_GATT_PROVISIONING_PRESENT)
+    memset(&bmm_prov_stats, 0, sizeof(bmm_prov_stats));
+    bmm_prov_stats.conn_time_ms.min = UINT32_MAX;
+#endif
+    CORE_EXIT_ATOMIC();
+}
+
+#if defined(TAG_ADV_SCAN_RSP_PRESENT)
+/**
+ * @brief Serve Firmware Revision and Tag Extended Status from scan response (advertising set
+ *     becomes scannable) or send them in ADV_PDU as any other beacon message.
+ * @note Only legacy advertising is scannable, extended ADV_PDU (backlog) stays non-scannable.
+ */
+void bmm_set_scan_rsp(bool enable)
+{
+    // Called from CLI (sleeptimer ISR), slots are filled by Tag Main Machine.
+    CORE_DECLARE_IRQ_STATE;
+    CORE_ENTER_ATOMIC();
+    bmm_scan_rsp_enabled = enable;
+    if (!enable) {
+        memset(bmm_scan_rsp_slots, 0, sizeof(bmm_scan_rsp_slots));
+        bmm_scan_rsp_length = 0;
+    }
+    bmm_scan_rsp_dirty = enable;
+    CORE_EXIT_ATOMIC();
+}
+
+bool bmm_is_scan_rsp_enabled(void)
+{
+    return bmm_scan_rsp_enabled;
+}
+#endif
+
+#if defined(TAG_BLE_EXT_ADV_PRESENT)
+/**
+ * @brief Allow or forbid extended advertising (legacy only when disabled)
+ * @param enable
+ */
+void bmm_set_ext_adv(bool enable)
+{
+    bmm_ext_adv_enabled = enable;
+}
+
+bool bmm_is_ext_adv_enabled(void)
+{
+    return bmm_ext_adv_enabled;
+}
+#endif
+
 //! @brief BLE Manager Init
 uint32_t bmm_init(void)
 {
     bmm_stack_running = false;
     bmm_adv_running = false;
     bmm_queue_init();
+    bmm_reset_stats();
+    bmm_em1_requirement = false;
+
+    // Advertising set policy is applied on first advertising.
+    bmm_adv_profile = BMM_RF_PROFILE_STANDARD;
+    bmm_adv_cfg = bmm_rf_profiles[bmm_adv_profile];
+    bmm_adv_cfg_req_mask = 0;
+    bmm_adv_cfg_dirty = true;
+    bmm_adv_mode = BMM_ADV_LEGACY;
+#if defined(TAG_BLE_EXT_ADV_PRESENT)
+    // Opt-in (CLI or tag configuration), readers without BLE 5 would miss periodic messages of extended sets.
+    bmm_ext_adv_enabled = false;
+#endif
+#if defined(TAG_BEACON_AUTH_PRESENT)
+    bmm_adv_secured = false;
+    bmm_adv_sealed = false;
+#endif
+#if defined(TAG_ADV_SCAN_RSP_PRESENT)
+    bmm_set_scan_rsp(true);
+#endif
+#if defined(TAG_READER_ACK_PRESENT)
+    // Off until deployed readers send acknowledgments
+    bmm_ack_expected = false;
+    bmm_set_ack_config(false, BMM_ACK_WINDOW_DEFAULT_MS, 0);
+#endif
+#if defined(TAG_DOWNLINK_PRESENT)
+    bmm_set_dl_config(true, BMM_DL_WINDOW_DEFAULT_MS, BMM_DL_PERIOD_DEFAULT);
+#endif
+#if defined(TAG_SCAN_WINDOW_PRESENT)
+    bmm_scan_window = BMM_SCAN_WINDOW_NONE;
+    bmm_scanner_ready = false;
+#endif
+#if defined(TAG_GATT_PROVISIONING_PRESENT)
+    bmm_conn_handle = BMM_CONN_HANDLE_NONE;
+    // Connectable after a power-up or in manufacturing only, otherwise the window is opened
+    // by a signed downlink command (TCM_CMD_PROVISIONING) or CLI.
+    bmm_prov_window_open = false;
+    if ((boot_get_reset_cause() & EMU_RSTCAUSE_POR) || (boot_get_mode() == BOOT_MANUFACTURING_TEST)) {
+        bmm_open_prov_window(BMM_PROV_BOOT_WINDOW_SEC);
+    }
+#endif
+    bmm_build_adv_prefix();
     return 0;
 }
 
+TMM_MACHINE(60, bmm, "BLE Manager", bmm_init, NULL, 0, 0);
+
 
@@ -254,6 +254,40 @@ uint32_t as39_init(SPIDRV_Handle_t as39_spi)
     return status;
 }
 
+/*!
+ *  @brief Attach AS393x device driver to a device that kept its settings
+ *  @details Used on wake-up from EM4 (shelf mode), AS393x stays powered so its registers
+ *      still hold @ref as39_settings and there is no need to preset and write them again.
+ *  @param SPIDRV_Handle_t as39_spi
+ *  @return @ref AS39_OK on success, otherwise on failure.
+ */
+uint32_t as39_attach(SPIDRV_Handle_t as39_spi)
+{
+    uint32_t status;
+
+    if(_as39_dev_handle != NULL) {
+        return AS39_OK;
+    }
+
+    if (as39_spi == NULL) {
+        return AS39_FAIL;
+    }
+
+    _as39_dev_handle = &_as39_dev_data;
+    _as39_init_gpio();
+    _as39_dev_data.spi = as39_spi;
+    status = _as39_init_spi();
+
+    if (status != 0) {
+        return status;
+    }
+
+    memcpy(&_as39_dev_handle->registers, &as39_settings, sizeof(as39_settings));
+    _as39_dev_handle->device_name = AS39_DEVICE_NAME;
+
+    return status;
+}
+
 uint32_t as39_get_settings_handler(as39_settings_handle_t *as39_handle)
 {
     uint32_t status = 0;
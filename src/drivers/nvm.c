@@ -13,6 +13,8 @@
 #include "app_assert.h"
 #include "nvm3_default_config.h"
 #include "tag_beacon_machine.h"
+#include "tag_beacon_auth.h"
+#include "tag_configuration.h"
 #include "nvm3.h"
 
 #include "dbg_utils.h"
@@ -31,6 +33,9 @@ typedef enum nvm_tag_keys_t {
     NVM_TAG_CONFIGURATION_KEY,
     NVM_TAG_OP_MODE_KEY,
     NVM_TBM_BEACON_RATE_KEY,
+    NVM_TBA_KEY_KEY,
+    NVM_TBA_COUNTER_KEY,
+    NVM_TCM_DL_COUNTER_KEY,
 } nvm_tag_keys_t;
 
 //******************************************************************************
@@ -134,5 +139,197 @@ uint32_t nvm_write_tbm_settings(tbm_nvm_data_t *b)
     return status;
 }
 
+uint32_t nvm_read_tba_key(uint8_t *key)
+{
+    Ecode_t ret;
+    uint32_t status;
+
+    ret = nvm3_readData(nvm3_defaultHandle, NVM_TBA_KEY_KEY, key, TBA_KEY_LEN);
+
+    if (ret == ECODE_NVM3_OK) {
+        status = 0;
+    } else {
+        status = 1;
+    }
+
+    nvm_repack();
+
+    return status;
+}
+
+uint32_t nvm_write_tba_key(const uint8_t *key)
+{
+    Ecode_t ret;
+    uint32_t status;
+
+    ret = nvm3_writeData(nvm3_defaultHandle, NVM_TBA_KEY_KEY, key, TBA_KEY_LEN);
+
+    if (ret == ECODE_NVM3_OK) {
+        status = 0;
+    } else {
+        status = 1;
+    }
+
+    nvm_repack();
+
+    return status;
+}
+
+uint32_t nvm_read_tba_counter(uint32_t *counter)
+{
+    Ecode_t ret;
+    uint32_t status;
+
+    ret = nvm3_readData(nvm3_defaultHandle, NVM_TBA_COUNTER_KEY, counter, sizeof(uint32_t));
+
+    if (ret == ECODE_NVM3_OK) {
+        status = 0;
+    } else {
+        status = 1;
+    }
+
+    nvm_repack();
+
+    return status;
+}
+
+uint32_t nvm_write_tba_counter(uint32_t counter)
+{
+    Ecode_t ret;
+    uint32_t status;
+
+    ret = nvm3_writeData(nvm3_defaultHandle, NVM_TBA_COUNTER_KEY, &counter, sizeof(counter));
+
+    if (ret == ECODE_NVM3_OK) {
+        status = 0;
+    } else {
+        status = 1;
+    }
+
+    nvm_repack();
+
+    return status;
+}
+
+uint32_t nvm_read_tcm_dl_counter(uint32_t *counter)
+{
+    Ecode_t ret;
+    uint32_t status;
+
+    ret = nvm3_readData(nvm3_defaultHandle, NVM_TCM_DL_COUNTER_KEY, counter, sizeof(uint32_t));
+
+    if (ret == ECODE_NVM3_OK) {
+        status = 0;
+    } else {
+        status = 1;
+    }
+
+    nvm_repack();
+
+    return status;
+}
+
+uint32_t nvm_write_tcm_dl_counter(uint32_t counter)
+{
+    Ecode_t ret;
+    uint32_t status;
+
+    ret = nvm3_writeData(nvm3_defaultHandle, NVM_TCM_DL_COUNTER_KEY, &counter, sizeof(counter));
+
+    if (ret == ECODE_NVM3_OK) {
+        status = 0;
+    } else {
+        status = 1;
+    }
+
+    nvm_repack();
+
+    return status;
+}
+
+uint32_t nvm_read_tag_op_mode(uint8_t *op_mode)
+{
+    Ecode_t ret;
+    uint32_t status;
+
+    ret = nvm3_readData(nvm3_defaultHandle, NVM_TAG_OP_MODE_KEY, op_mode, sizeof(uint8_t));
+
+    if (ret == ECODE_NVM3_OK) {
+        status = 0;
+    } else {
+        status = 1;
+    }
+
+    return status;
+}
+
+uint32_t nvm_write_tag_op_mode(uint8_t op_mode)
+{
+    Ecode_t ret;
+    uint32_t status;
+
+    ret = nvm3_writeData(nvm3_defaultHandle, NVM_TAG_OP_MODE_KEY, &op_mode, sizeof(op_mode));
+
+    if (ret == ECODE_NVM3_OK) {
+        status = 0;
+    } else {
+        status = 1;
+    }
+
+    nvm_repack();
+
+    return status;
+}
+
+uint32_t nvm_read_tag_configuration(tcf_nvm_data_t *c)
+{
+    Ecode_t ret;
+    uint32_t status;
+
+    ret = nvm3_readData(nvm3_defaultHandle, NVM_TAG_CONFIGURATION_KEY, c, sizeof(tcf_nvm_data_t));
+
+    if (ret == ECODE_NVM3_OK) {
+        status = 0;
+    } else {
+        status = 1;
+    }
 
+    nvm_repack();
 
+    return status;
+}
+
+uint32_t nvm_write_tag_configuration(const tcf_nvm_data_t *c, const tbm_nvm_data_t *b)
+{
+    tcf_nvm_data_t prev;
+    bool has_prev;
+    Ecode_t ret;
+    uint32_t status;
+
+    // Configuration goes first and is rolled back if beacon rates cannot follow, NVM never
+    // holds half of a batch.
+    has_prev = (nvm3_readData(nvm3_defaultHandle, NVM_TAG_CONFIGURATION_KEY, &prev, sizeof(tcf_nvm_data_t)) == ECODE_NVM3_OK);
+
+    ret = nvm3_writeData(nvm3_defaultHandle, NVM_TAG_CONFIGURATION_KEY, c, sizeof(tcf_nvm_data_t));
+
+    if ((ret == ECODE_NVM3_OK) && (b != NULL)) {
+        ret = nvm3_writeData(nvm3_defaultHandle, NVM_TBM_BEACON_RATE_KEY, b, sizeof(tbm_nvm_data_t));
+        if (ret != ECODE_NVM3_OK) {
+            if (has_prev) {
+                nvm3_writeData(nvm3_defaultHandle, NVM_TAG_CONFIGURATION_KEY, &prev, sizeof(tcf_nvm_data_t));
+            } else {
+                nvm3_deleteObject(nvm3_defaultHandle, NVM_TAG_CONFIGURATION_KEY);
+            }
+        }
+    }
+
+    if (ret == ECODE_NVM3_OK) {
+        status = 0;
+    } else {
+        status = 1;
+    }
+
+    nvm_repack();
+
+    return status;
+}
@@ -7,6 +7,7 @@
 
 #include "lf_decoder.h"
 #include "tag_main_machine.h"
+#include "tag_power_manager.h"
 #include "rtcc.h"
 
 
@@ -34,12 +35,14 @@ void RTCC_IRQHandler(void)
     CORE_DECLARE_IRQ_STATE;
     uint32_t irq_flag;
 
+    // Critical section is limited to flags handling, handlers below run with interrupts enabled.
     CORE_ENTER_ATOMIC();
     irq_flag = RTCC_IntGet();
 
     // Clear RTCC flags
     RTCC_IntClear(irq_flag & (RTCC_IF_CC0 | RTCC_IF_CC1 | RTCC_IF_CC2));
     NVIC_ClearPendingIRQ(RTCC_IRQn);
+    CORE_EXIT_ATOMIC();
 
 #if 1
     // Capture/Compare 0 handler - LF Decoder
@@ -53,18 +56,18 @@ void RTCC_IRQHandler(void)
 #endif
 
 #if 1
-    // Capture/Compare 1 handler - Tag Main Machine SysTick
+    // Capture/Compare 1 handler - Tag Main Machine SysTick (only posts the run, see TMM_SW_IRQn)
     if (irq_flag & RTCC_IF_CC1) {
         tag_main_machine_isr();
     }
 #endif
 
-#if 0
-    // Capture/Compare 2 handler
-    if (irq_flag &RTCC_IF_CC2) {// unused... }
+#if defined(TAG_HFXO_PREWARM_PRESENT)
+    // Capture/Compare 2 handler - HFXO pre-warm (sync beacons)
+    if (irq_flag & RTCC_IF_CC2) {
+        tpm_hfxo_prewarm_isr();
+    }
 #endif
-
-    CORE_EXIT_ATOMIC();
 }
 
 
@@ -87,6 +90,7 @@ void rtcc_init(void)
 
     RTCC_IntClear(RTCC_IF_CC0 | RTCC_IF_CC1 | RTCC_IF_CC2);
     RTCC_IntDisable(RTCC_IF_CC0 | RTCC_IF_CC1 | RTCC_IF_CC2);
+    NVIC_SetPriority(RTCC_IRQn, RTCC_IRQ_PRIORITY);
     NVIC_ClearPendingIRQ(RTCC_IRQn);
     NVIC_EnableIRQ(RTCC_IRQn);
 }
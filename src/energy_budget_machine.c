@@ -0,0 +1,275 @@
+/*
+ * energy_budget_machine.c
+ *
+ *  This module runs from Tag Main Machine ISR context (slow task).
+ *
+ *  Converts energy relevant event counters into consumed charge, projects the
+ *  remaining battery life and governs the slow beacon rate so the tag meets
+ *  @ref EBM_TARGET_LIFETIME_DAYS.
+ *
+ */
+
+#include "stdio.h"
+#include "stdbool.h"
+#include "string.h"
+#include "em_common.h"
+#include "em_core.h"
+#include "em_emu.h"
+
+#include "dbg_utils.h"
+#include "tag_sw_timer.h"
+#include "tag_main_machine.h"
+#include "boot.h"
+#include "tag_beacon_machine.h"
+#include "energy_budget_machine.h"
+
+
+//******************************************************************************
+// Defines
+//******************************************************************************
+#define EBM_RETAINED_MAGIC           (0x45424D31)   /* "EBM1" */
+#define EBM_NC_PER_MAH               (3600000000ULL)
+#define EBM_BATTERY_CAPACITY_NC      ((uint64_t)EBM_BATTERY_CAPACITY_MAH * EBM_NC_PER_MAH)
+#define EBM_SEC_PER_DAY              (86400UL)
+
+//******************************************************************************
+// Data types
+//******************************************************************************
+typedef struct ebm_retained_t {
+    uint32_t magic;
+    uint32_t elapsed_sec;        /* seconds since battery insertion (POR) */
+    uint64_t consumed_nc;        /* charge drawn since battery insertion (POR) */
+} ebm_retained_t;
+
+typedef struct ebm_data_t {
+    uint64_t window_nc;          /* charge drawn since last governor evaluation */
+    uint32_t window_sec;
+    uint32_t remaining_life_sec;
+    uint16_t stretch_pct;
+} ebm_data_t;
+
+//******************************************************************************
+// Global variables
+//******************************************************************************
+static volatile uint32_t ebm_event_counters[EBM_EVT_MAX];
+static volatile uint32_t ebm_hfxo_time_ms;
+static tag_sw_timer_t ebm_governor_timer;
+static ebm_data_t ebm_data;
+// Keep this in .custom section to survive non POR resets (same as 'uptime').
+ebm_retained_t __attribute__ ((section(".custom"))) ebm_retained;
+
+static const uint32_t ebm_event_charge_nc[EBM_EVT_MAX] = {
+    [EBM_EVT_ADV]       = EBM_CHARGE_ADV_NC,
+    [EBM_EVT_ADV_RETX]  = EBM_CHARGE_ADV_RETX_NC,
+    [EBM_EVT_LF_WAKEUP] = EBM_CHARGE_LF_WAKEUP_NC,
+    [EBM_EVT_RX_MS]     = EBM_CHARGE_RX_NC_PER_MS,
+};
+
+//******************************************************************************
+// Static functions
+//******************************************************************************
+/**
+ * @brief Drain event counters and convert them into charge (nC) since previous call.
+ * @param elapsed_sec
+ */
+static uint64_t ebm_collect_charge(uint32_t elapsed_sec)
+{
+    uint32_t counters[EBM_EVT_MAX];
+    uint32_t hfxo_ms;
+    uint64_t charge_nc;
+    uint8_t i;
+
+    CORE_DECLARE_IRQ_STATE;
+    CORE_ENTER_ATOMIC();
+    for (i = 0; i < EBM_EVT_MAX; i++) {
+        counters[i] = ebm_event_counters[i];
+        ebm_event_counters[i] = 0;
+    }
+    hfxo_ms = ebm_hfxo_time_ms;
+    ebm_hfxo_time_ms = 0;
+    CORE_EXIT_ATOMIC();
+
+    // Baseline sleep current over elapsed time (nA * 1s = nC)
+    charge_nc = (uint64_t)EBM_SLEEP_CURRENT_NA * elapsed_sec;
+
+    for (i = 0; i < EBM_EVT_MAX; i++) {
+        charge_nc += (uint64_t)counters[i] * ebm_event_charge_nc[i];
+    }
+
+    charge_nc += (uint64_t)hfxo_ms * EBM_CHARGE_HFXO_NC_PER_MS;
+
+    return charge_nc;
+}
+
+/**
+ * @brief Project remaining battery life based on average current of the last window
+ *     and adjust the slow beacon rate stretch factor accordingly.
+ */
+static void ebm_governor_run(void)
+{
+    uint64_t remaining_nc;
+    uint64_t avg_current_na;
+    uint64_t target_remaining_sec;
+    uint64_t target_total_sec = (uint64_t)EBM_TARGET_LIFETIME_DAYS * EBM_SEC_PER_DAY;
+
+    if (ebm_data.window_sec == 0) {
+        return;
+    }
+
+    avg_current_na = ebm_data.window_nc / ebm_data.window_sec;
+    if (avg_current_na == 0) {
+        avg_current_na = 1;
+    }
+
+    if (ebm_retained.consumed_nc < EBM_BATTERY_CAPACITY_NC) {
+        remaining_nc = EBM_BATTERY_CAPACITY_NC - ebm_retained.consumed_nc;
+    } else {
+        remaining_nc = 0;
+    }
+
+    // nC / nA = seconds
+    uint64_t remaining_sec = remaining_nc / avg_current_na;
+    ebm_data.remaining_life_sec = (remaining_sec > UINT32_MAX) ? UINT32_MAX : (uint32_t)remaining_sec;
+
+    if (ebm_retained.elapsed_sec < target_total_sec) {
+        target_remaining_sec = target_total_sec - ebm_retained.elapsed_sec;
+    } else {
+        target_remaining_sec = 0;
+    }
+
+    if (ebm_data.remaining_life_sec < target_remaining_sec) {
+        // Falling behind target, stretch slow beacon rate.
+        if (ebm_data.stretch_pct < EBM_STRETCH_MAX_PCT) {
+            ebm_data.stretch_pct += EBM_STRETCH_STEP_PCT;
+        }
+    } else if (ebm_data.remaining_life_sec > ((target_remaining_sec * (100 + EBM_STRETCH_HYSTERESIS_PCT)) / 100)) {
+        // Comfortably ahead of target, give back beacon rate.
+        if (ebm_data.stretch_pct > EBM_STRETCH_MIN_PCT) {
+            ebm_data.stretch_pct -= EBM_STRETCH_STEP_PCT;
+        }
+    }
+
+    tbm_set_slow_rate_stretch(ebm_data.stretch_pct);
+
+    DEBUG_LOG(DBG_CAT_BATTERY, "Avg. current: %lu nA, remaining life: %u days, slow rate stretch: %u%%",
+              (uint32_t)avg_current_na,
+              ebm_get_remaining_life_days(),
+              ebm_data.stretch_pct);
+
+    ebm_data.window_nc = 0;
+    ebm_data.window_sec = 0;
+}
+
+//******************************************************************************
+// Non Static functions
+//******************************************************************************
+/**
+ * @brief Count energy relevant events (safe to call from any ISR context)
+ * @param ebm_events_t
+ * @param count
+ */
+void ebm_count_event(ebm_events_t event, uint32_t count)
+{
+    if (event < EBM_EVT_MAX) {
+        CORE_DECLARE_IRQ_STATE;
+        CORE_ENTER_ATOMIC();
+        ebm_event_counters[event] += count;
+        CORE_EXIT_ATOMIC();
+    }
+}
+
+/**
+ * @brief Account time spent running on HFXO (EM0/EM1)
+ * @param time_ms
+ */
+void ebm_add_hfxo_time(uint32_t time_ms)
+{
+    CORE_DECLARE_IRQ_STATE;
+    CORE_ENTER_ATOMIC();
+    ebm_hfxo_time_ms += time_ms;
+    CORE_EXIT_ATOMIC();
+}
+
+uint16_t ebm_get_remaining_life_days(void)
+{
+    uint32_t days = ebm_data.remaining_life_sec / EBM_SEC_PER_DAY;
+    return (days > UINT16_MAX) ? UINT16_MAX : (uint16_t)days;
+}
+
+uint16_t ebm_get_slow_rate_stretch(void)
+{
+    return ebm_data.stretch_pct;
+}
+
+/**
+ * @brief Energy Budget Machine (Slow Task)
+ * @details Accumulates consumed charge over elapsed seconds and runs the lifetime governor
+ *     every @ref EBM_GOVERNOR_PERIOD_SEC.
+ */
+void energy_budget_run(void)
+{
+    uint32_t elapsed_sec = tmm_get_elapsed_sec();
+    uint64_t charge_nc = ebm_collect_charge(elapsed_sec);
+
+    ebm_retained.consumed_nc += charge_nc;
+    ebm_retained.elapsed_sec += elapsed_sec;
+    ebm_data.window_nc += charge_nc;
+    ebm_data.window_sec += elapsed_sec;
+
+    if (tag_sw_timer_is_expired(&ebm_governor_timer)) {
+        ebm_governor_run();
+        tag_sw_timer_reload(&ebm_governor_timer, TMM_SEC_TO_TICKS(EBM_GOVERNOR_PERIOD_SEC));
+    }
+}
+
+uint32_t ebm_init(void)
+{
+    memset(&ebm_data, 0, sizeof(ebm_data));
+    ebm_data.stretch_pct = EBM_STRETCH_MIN_PCT;
+    ebm_data.remaining_life_sec = (uint32_t)(EBM_BATTERY_CAPACITY_NC / EBM_SLEEP_CURRENT_NA);
+
+    tag_sw_timer_reload(&ebm_governor_timer, TMM_SEC_TO_TICKS(EBM_GOVERNOR_PERIOD_SEC));
+
+    return 0;
+}
+
+TMM_MACHINE(30, ebm, "Energy Budget", ebm_init, energy_budget_run, TMM_SLOW_TASK_PERIOD, 3);
+
+/**
+ * @brief Initialize energy accounting only when Power-On Reset happens (battery insertion).
+ * @details 'ebm_retained' is placed in RAM section .custom so it will not be zeroed during c startup.
+ */
+void ebm_preinit(void)
+{
+    if ((boot_get_reset_cause() & EMU_RSTCAUSE_POR) || (ebm_retained.magic != EBM_RETAINED_MAGIC)) {
+        memset(&ebm_retained, 0, sizeof(ebm_retained));
+        ebm_retained.magic = EBM_RETAINED_MAGIC;
+    }
+}
+
+#if defined(TAG_SHELF_MODE_PRESENT)
+/**
+ * @brief Copy energy accounting into retention registers (RAM is lost in EM4, see shelf mode)
+ * @param regs EBM_RETAINED_WORDS registers
+ */
+void ebm_retained_save(volatile uint32_t *regs)
+{
+    const uint32_t *w = (const uint32_t *)&ebm_retained;
+    uint32_t i;
+
+    for (i = 0; i < EBM_RETAINED_WORDS; i++) {
+        regs[i] = w[i];
+    }
+}
+
+//! @brief Restore energy accounting saved by @ref ebm_retained_save (before @ref ebm_preinit)
+void ebm_retained_restore(const volatile uint32_t *regs)
+{
+    uint32_t *w = (uint32_t *)&ebm_retained;
+    uint32_t i;
+
+    for (i = 0; i < EBM_RETAINED_WORDS; i++) {
+        w[i] = regs[i];
+    }
+}
+#endif
@@ -29,6 +29,8 @@
 #include "as393x.h"
 #include "lf_decoder.h"
 #include "rtcc.h"
+#include "energy_budget_machine.h"
+#include "tag_main_machine.h"
 #include "app_properties.h"
 
 
@@ -44,6 +46,7 @@
 #define LF_NUMBER_OF_BITS            (24)           //!  # of bits in the LF data frame
 #define LF_FALSE_WAKEUP_TIMEOUT      (492)          //!  ~15 mS
 #define LF_CRC_OK_TIMEOUT            (32768)        //!  ~1500 mS
+#define LF_RTCC_COUNTS_TO_US(x)      ((uint32_t)(((uint64_t)(x) * 1000000UL) / 32768))
 
 
 //#define LF_TOL_TIGHT
@@ -104,12 +107,19 @@ typedef struct lf_decoder_t {
     uint16_t errors;
 } lf_decoder_t;
 
+typedef struct lf_decoder_stats_t {
+    uint32_t captures;
+    uint32_t frames;
+    uint32_t latency_max;              /* edge to capture ISR (RTCC counts) */
+} lf_decoder_stats_t;
+
 
 //******************************************************************************
 // Global variables
 //******************************************************************************
 static volatile lf_decoder_data_t lf_data;
 static lf_decoder_t decoder;
+static lf_decoder_stats_t lf_stats;
 
 //******************************************************************************
 // Static functions
@@ -202,8 +212,12 @@ void lf_decoder_set_lf_data(void)
     lf_data.is_available = true;
     lf_data.id = (uint16_t)((decoder.buffer >> 13) & 0x7FF);
     lf_data.command = (uint8_t)((decoder.buffer >> 7) & 0x3F);
+    lf_stats.frames++;
 
     CORE_EXIT_ATOMIC();
+
+    // LF Machine picks it up on next Tag Main Machine run
+    tmm_wakeup();
 }
 
 void lf_decoder_clear_lf_data(void)
@@ -232,6 +246,13 @@ void lf_decoder_capture_isr(void)
 {
     decoder.curr_edge = RTCC_ChannelCaptureValueGet(LF_RTCC_CC0);
 
+    // Capture latency, a next edge arriving before we get here overwrites this one.
+    uint32_t latency = RTCC_CounterGet() - decoder.curr_edge;
+    if (latency > lf_stats.latency_max) {
+        lf_stats.latency_max = latency;
+    }
+    lf_stats.captures++;
+
     volatile int pulse_width = (decoder.curr_edge - decoder.prev_edge);
 
     decoder.prev_edge = decoder.curr_edge;
@@ -255,6 +276,8 @@ void lf_decoder_capture_isr(void)
             break;
 
         case PREAMBLE:
+            // Count LF wake-ups for Energy Budget accounting
+            ebm_count_event(EBM_EVT_LF_WAKEUP, 1);
             // Consider this the start of the PREAMBLE we dont care what happened before.
             // Configure edge to falling
             lf_decoder_rtcc_cc0_config(LF_RTCC_CAPTURE, 0, rtccInEdgeFalling);
@@ -377,6 +400,21 @@ void lf_decoder_enable(bool enable)
     CORE_EXIT_ATOMIC();
 }
 
+//! @brief Print LF decoder statistics (CLI)
+void lf_decoder_print_stats(void)
+{
+    printf("\n  LF captures:          %lu (frames %lu)", lf_stats.captures, lf_stats.frames);
+    printf("\n  LF capture latency:   max %lu us", LF_RTCC_COUNTS_TO_US(lf_stats.latency_max));
+}
+
+void lf_decoder_reset_stats(void)
+{
+    CORE_DECLARE_IRQ_STATE;
+    CORE_ENTER_ATOMIC();
+    memset(&lf_stats, 0, sizeof(lf_stats));
+    CORE_EXIT_ATOMIC();
+}
+
 void lf_decoder_init(void)
 {
     // Here we initialize everything required to start the LF Decoder
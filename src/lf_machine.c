@@ -28,14 +28,15 @@
 
 // LF Commands definitions
 #define TA_CONFIRM_CMD_N_TIMES                 3       /* Protocol to confirm TA command, tag needs to receive
-                                                          same command "n" times in a row before it can execute */
+                                                          same command "n" times in a row before it can execute
+                                                          (default, see lfm_set_policy) */
 #define LF_CMD_NOP                             (0x00)
 #define LF_CMD_MT_BATT_LOW                     (0x1E)
 #define LF_CMD_MT                              (0x1F)
 #define LF_CMD_EXAMPLE                         (0xFF)
 
 // LF Exit timer
-#define LFM_TIMER_A_PERIOD_MS                  3000
+#define LFM_TIMER_A_PERIOD_MS                  3000    /* default, see lfm_set_policy */
 #define LFM_TIMER_A_PERIOD_RELOAD              (LFM_TIMER_A_PERIOD_MS / TMM_RTCC_TIMER_PERIOD_MS)
 
 //******************************************************************************
@@ -75,6 +76,8 @@ static lfm_data_t lfm_data;
 static volatile lfm_fsm_t lfm_fsm;
 static volatile bool lfm_running;
 static lfm_lf_beacon_t lf_beacon_data;
+static uint16_t lfm_exit_field_reload;                 /* Exiting Field timeout (x250 ms) */
+static uint8_t lfm_ta_confirm_n_times;
 
 //******************************************************************************
 // Static functions
@@ -121,7 +124,7 @@ static void lfm_decode_command(uint8_t lf_command)
     }
 
     // Check if we received enough samples of the command to confirm it.
-    if (lfm_data.ta_cmd_counter == TA_CONFIRM_CMD_N_TIMES) {
+    if (lfm_data.ta_cmd_counter >= lfm_ta_confirm_n_times) {
         // If so, clear state variables and go execute LF command.
         lfm_data.ta_cmd = 0;
         lfm_data.ta_cmd_counter = 0;
@@ -150,11 +153,6 @@ static char* lfm_lf_events_to_string(lfm_lf_events_t event)
     }
 }
 
-static void lfm_tick(void)
-{
-    tag_sw_timer_tick(&timer_exit_field);
-}
-
 static void lfm_fsm_start(void)
 {
     lfm_running = true;
@@ -240,7 +238,8 @@ static void lfm_process_step(void)
 
             if (tag_sw_timer_is_expired(&timer_exit_field)) {                   // Check if exit field timer is expiring in this tick
 
-                lfm_report_lf_event(EXITING_FIELD);                             // If true, go Report LF event Exiting Field (async msg)
+                tag_sw_timer_stop(&timer_exit_field);                           // If true, clear expired timer
+                lfm_report_lf_event(EXITING_FIELD);                             // Report LF event Exiting Field (async msg)
                 lfm_clear_status_flag(LFM_ENTERING_FIELD_FLAG | LFM_STAYING_IN_FIELD_FLAG);  // Clear LF status flags
                 lfm_data.buffer_1.command = 0;
                 lfm_data.buffer_1.id = 0;
@@ -272,7 +271,7 @@ static void lfm_process_step(void)
                 lfm_set_status_flag(LFM_ENTERING_FIELD_FLAG);
             }
 
-            tag_sw_timer_reload(&timer_exit_field, LFM_TIMER_A_PERIOD_RELOAD);  // Reload Exiting Field timeout
+            tag_sw_timer_reload(&timer_exit_field, lfm_exit_field_reload);      // Reload Exiting Field timeout
             lfm_fsm.state = DECODE_COMMAND;                                     // And exit.
 
             break;
@@ -327,15 +326,71 @@ uint8_t lfm_get_lf_status(void)
     return lfm_data.status;
 }
 
+/**
+ * @brief LF policy (taken into account from next LF field detection)
+ * @param exit_field_ms Exiting Field timeout (@ref LFM_EXIT_FIELD_MIN_MS to @ref LFM_EXIT_FIELD_MAX_MS)
+ * @param ta_confirm_n_times same Tag Activator command received "n" times in a row before it is executed
+ * @return 0 if policy was accepted.
+ */
+uint32_t lfm_set_policy(uint16_t exit_field_ms, uint8_t ta_confirm_n_times)
+{
+    if ((exit_field_ms < LFM_EXIT_FIELD_MIN_MS) ||
+        (exit_field_ms > LFM_EXIT_FIELD_MAX_MS) ||
+        (ta_confirm_n_times == 0) ||
+        (ta_confirm_n_times > LFM_TA_CONFIRM_MAX)) {
+        return 1;
+    }
+
+    lfm_exit_field_reload = (exit_field_ms / TMM_RTCC_TIMER_PERIOD_MS);
+    lfm_ta_confirm_n_times = ta_confirm_n_times;
+    return 0;
+}
+
+#if defined(TAG_RETAINED_STATE_PRESENT)
+/**
+ * @brief LF field membership (end of Tag Main Machine run)
+ * @param r
+ */
+void lfm_get_retained(lfm_retained_t *r)
+{
+    uint32_t deadline;
+
+    r->status = lfm_data.status;
+    r->command = lfm_data.buffer_1.command;
+    r->id = lfm_data.buffer_1.id;
+    r->beacon = lf_beacon_data;
+    r->exit_ticks = 0;
+    if (tag_sw_timer_get_deadline(&timer_exit_field, &deadline)) {
+        r->exit_ticks = (uint16_t)(deadline - tag_sw_timer_get_time());
+    } else if (tag_sw_timer_is_expired(&timer_exit_field)) {
+        r->exit_ticks = 1;            // Exiting Field not reported yet
+    }
+}
+
+/**
+ * @brief Restore LF field membership (after @ref lfm_init)
+ * @details Tag stays in its LF field, next detection reports Staying Field (not Entering)
+ *     and Exiting Field is reported when the remaining timeout expires.
+ * @param r
+ */
+void lfm_restore(const lfm_retained_t *r)
+{
+    lfm_data.status = r->status;
+    lfm_data.buffer_1.command = r->command;
+    lfm_data.buffer_1.id = r->id;
+    lf_beacon_data = r->beacon;
+    if (r->exit_ticks != 0) {
+        tag_sw_timer_reload(&timer_exit_field, r->exit_ticks);
+    }
+}
+#endif
+
 /**
  * @brief LF Machine (Responsible for LF high level functionalities)
  * @details Reports LF Field events to Tag Beacon Machine and decodes commands from Tag Activator.
  */
 void lf_run(void)
 {
-    // Update all internal sw timers
-    lfm_tick();
-
     lfm_fsm.state = INIT;
 
     // Run lf machine process until completion
@@ -347,13 +402,17 @@ void lf_run(void)
 //! @brief LF Machine Init
 uint32_t lfm_init(void)
 {
-    tag_sw_timer_reload(&timer_exit_field, 0);
+    tag_sw_timer_start(&timer_exit_field, 0, 0, NULL);
 
     lfm_data.ta_cmd = 0;
     lfm_data.ta_cmd_counter = 0;
+    lfm_exit_field_reload = LFM_TIMER_A_PERIOD_RELOAD;
+    lfm_ta_confirm_n_times = TA_CONFIRM_CMD_N_TIMES;
 
     lfm_fsm.state = INIT;
     lfm_fsm_stop();
 
     return 0;
 }
+
+TMM_MACHINE(10, lfm, "LF", lfm_init, NULL, 0, 0);
@@ -43,40 +43,109 @@
 #include "cli.h"
 #include "nvm.h"
 #include "lf_decoder.h"
+#include "energy_budget_machine.h"
+#include "tag_retained_state.h"
 
 
+#if defined(TAG_FAST_BOOT_PRESENT)
+//------------------------------------------------------------------------------
+// Diagnostics prints deferred by fast boot (blocking UART, once first advertising set is over)
+//------------------------------------------------------------------------------
+#define TAG_DIAGNOSTICS_TIMEOUT_MS   (5000)             /* printed anyway (BLE Manager idle) if no advert went out by then */
+
+static sl_sleeptimer_timer_handle_t tag_diagnostics_timer;
+static volatile bool tag_diagnostics_timeout;
+
+//! @brief No advert so far, let main context print diagnostics (sleeptimer ISR context)
+static void tag_diagnostics_timer_callback(sl_sleeptimer_timer_handle_t *handle, void *data)
+{
+    (void)(handle);
+    (void)(data);
+    tag_diagnostics_timeout = true;
+    tag_sleep_on_isr_exit(false);
+}
+
+static void tag_print_diagnostics(void)
+{
+    bool log_enabled = dbg_is_log_enabled();
+
+    dbg_log_enable(true);
+    boot_print_reset_cause();
+    tag_check_wakeup_from_deep_sleep();
+    dbg_print_banner();
+    dbg_log_enable(log_enabled);
+}
+#endif
+
 //------------------------------------------------------------------------------
 // Tag Main Initialization
 //------------------------------------------------------------------------------
 void tag_init(void)
 {
+    bool fast_resume = false;
+    bool defer_diagnostics = false;
+
+#if defined(TAG_SHELF_MODE_PRESENT)
+    // Shelved tag goes back to EM4 here unless RFSENSE or LF activation woke it up
+    fast_resume = tpm_shelf_check();
+#endif
+
     // Tag 'uptime' conditional initialization
     tum_preinit();
 
+    // Energy accounting conditional initialization
+    ebm_preinit();
+
+#if defined(TAG_FAST_BOOT_PRESENT)
+    // Reset cause and banner are printed once the first beacon is out (manufacturing excepted)
+    defer_diagnostics = (!fast_resume && (boot_get_mode() != BOOT_MANUFACTURING_TEST));
+#endif
+
     // Initialize UART (used by dbg_utils and cli)
     dbg_log_init();
-    dbg_log_enable(true);
 
-    // Print last reset cause
-    boot_print_reset_cause();
+    // Fast resume from shelf mode skips diagnostics, first beacon goes right away
+    if (!fast_resume && !defer_diagnostics) {
+        dbg_log_enable(true);
 
-    // Check if tag is waking up from deep sleep (EM4)
-    tag_check_wakeup_from_deep_sleep();
+        // Print last reset cause
+        boot_print_reset_cause();
+
+        // Check if tag is waking up from deep sleep (EM4)
+        tag_check_wakeup_from_deep_sleep();
+    }
 
     // Setup Power Manager settings
     tag_power_settings();
 
-    // Initialize AS3933 device driver
-    as39_init(sl_spidrv_as39_spi_handle);
+    // Initialize AS3933 device driver (it kept its settings over shelf mode)
+    if (fast_resume) {
+        as39_attach(sl_spidrv_as39_spi_handle);
+    } else {
+        as39_init(sl_spidrv_as39_spi_handle);
+    }
+    BOOT_TRACE_MARK(BOOT_PHASE_AS39_INIT);
 
     // Keep antenna disabled for now
     as39_antenna_enable(false, false, false);
 
     // Initialize RTCC (used by Tag Main Machine and LF Decoder)
     rtcc_init();
+    BOOT_TRACE_MARK(BOOT_PHASE_RTCC_INIT);
+
+#if defined(TAG_POWER_STATS_PRESENT)
+    // Energy modes residency and wake-ups accounting (timestamps taken from RTCC)
+    tpm_power_stats_init();
+#endif
+
+#if defined(TAG_HFXO_PREWARM_PRESENT)
+    // HFXO started ahead of sync beacons (RTCC CC2)
+    tpm_hfxo_prewarm_init();
+#endif
 
     // Initialize LF Decoder
     lf_decoder_init();
+    BOOT_TRACE_MARK(BOOT_PHASE_LF_DECODER_INIT);
 
 #if defined(TAG_WDOG_PRESENT)
     watchdog_init();
@@ -110,12 +179,36 @@ void tag_init(void)
             break;
     }
 
-    dbg_print_banner();
+#if defined(TAG_RETAINED_STATE_PRESENT)
+    // Machines are initialized, put back LF field, pending critical events and beacon phase
+    // saved before a warm reset (first Tag Main Machine tick is not due yet)
+    trs_restore();
+#endif
+
+    BOOT_TRACE_MARK(BOOT_PHASE_TMM_START);
+
+    if (!fast_resume && !defer_diagnostics) {
+        dbg_print_banner();
+    }
+
+#if defined(TAG_FAST_BOOT_PRESENT)
+    if (defer_diagnostics) {
+        sl_sleeptimer_start_timer_ms(&tag_diagnostics_timer, TAG_DIAGNOSTICS_TIMEOUT_MS, tag_diagnostics_timer_callback, NULL, 0, 0);
+    }
+#endif
 
     while (1)
     {
         // BLE API events
         ble_api_fsm_run();
+#if defined(TAG_FAST_BOOT_PRESENT)
+        // Not while an advertising set is live, main context would stall the BLE API meanwhile.
+        if (defer_diagnostics && (boot_trace_is_marked(BOOT_PHASE_FIRST_ADV) || tag_diagnostics_timeout) && bmm_is_idle()) {
+            defer_diagnostics = false;
+            sl_sleeptimer_stop_timer(&tag_diagnostics_timer);
+            tag_print_diagnostics();
+        }
+#endif
         sl_power_manager_sleep();
     }
 }
@@ -134,6 +227,7 @@ int main(void)
     // Initialize Silicon Labs device, system, service(s) and protocol stack(s).
     //*************************************************************************
     sl_system_init();
+    BOOT_TRACE_MARK(BOOT_PHASE_SYSTEM_INIT);
 
     //*************************************************************************
     // BLE Tag System Initialization
@@ -0,0 +1,556 @@
+/*
+ * tag_beacon_auth.c
+ *
+ *  Frames are built by BLE Manager in ISR context, sealing and keystream
+ *  precomputation run from main context (BLE Stack external signal) so all
+ *  PSA Crypto calls stay in a single context.
+ *
+ */
+
+#include "stdio.h"
+#include "stdbool.h"
+#include "string.h"
+#include "em_common.h"
+#include "em_device.h"
+#include "em_core.h"
+#include "psa/crypto.h"
+
+#include "dbg_utils.h"
+#include "nvm.h"
+#include "tag_beacon_auth.h"
+
+
+//******************************************************************************
+// Defines
+//******************************************************************************
+#define TBA_BLOCK_LEN                (16)
+#define TBA_ADDRESS_LEN              (6)
+#define TBA_NONCE_COUNTER_INDEX      (TBA_ADDRESS_LEN)
+#define TBA_NONCE_BLOCK_INDEX        (TBA_BLOCK_LEN - 1)
+#define TBA_MIC_ALG                  (PSA_ALG_TRUNCATED_MAC(PSA_ALG_CMAC, TBA_MIC_LEN))
+
+// Frame offsets (frame starts at Tag Type ID byte)
+#define TBA_FRAME_COUNTER_INDEX      (1)
+#define TBA_FRAME_DATA_INDEX         (TBA_FRAME_COUNTER_INDEX + TBA_COUNTER_LEN)
+
+//******************************************************************************
+// Data types
+//******************************************************************************
+typedef struct tba_keys_t {
+    psa_key_id_t enc;                  /* AES-ECB, keystream generation */
+    psa_key_id_t mac;                  /* AES-CMAC, truncated MIC */
+} tba_keys_t;
+
+/** Keys of frames received from readers (own key per frame kind, never the beacon MIC key) **/
+typedef struct tba_reader_keys_t {
+    psa_key_id_t dl;                   /* AES-CMAC, downlink commands */
+    psa_key_id_t ack;                  /* AES-CMAC, reader acknowledgments */
+    psa_key_id_t cfg;                  /* AES-CMAC, GATT configuration batches */
+} tba_reader_keys_t;
+
+typedef struct tba_stats_t {
+    uint32_t sealed;
+    uint32_t keystream_hit;            /* sealed with precomputed keystream */
+    uint32_t keystream_miss;           /* keystream computed inline */
+    uint32_t errors;
+} tba_stats_t;
+
+//******************************************************************************
+// Global variables
+//******************************************************************************
+static bool tba_enabled;
+static tba_keys_t tba_keys;
+static tba_reader_keys_t tba_reader_keys;
+static uint8_t tba_address[TBA_ADDRESS_LEN];
+static uint32_t tba_counter;                                       /* next counter value to be used */
+static uint32_t tba_counter_limit;                                 /* counter values reserved in NVM up to (not incl.) */
+static uint8_t tba_keystream[2][TBA_KEYSTREAM_LEN];                /* current frame / next frame */
+static uint8_t tba_current;
+static bool tba_next_ready;
+static uint8_t tba_nonce[TBA_KEYSTREAM_LEN];
+static uint8_t tba_mic_input[TBA_ADDRESS_LEN + TBA_FRAME_DATA_INDEX + TBA_KEYSTREAM_LEN];
+static tba_stats_t tba_stats;
+
+//******************************************************************************
+// Static functions
+//******************************************************************************
+static void tba_put_u32_le(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)(v);
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+/**
+ * @brief Generate AES-CTR keystream for a given counter
+ * @details All counter blocks go thru the AES engine in a single ECB request.
+ */
+static psa_status_t tba_gen_keystream(psa_key_id_t key, uint32_t counter, uint8_t *ks, uint16_t len)
+{
+    uint16_t blocks = (len + TBA_BLOCK_LEN - 1) / TBA_BLOCK_LEN;
+    size_t out_len;
+    uint16_t i;
+
+    memset(tba_nonce, 0, (blocks * TBA_BLOCK_LEN));
+
+    for (i = 0; i < blocks; i++) {
+        uint8_t *block = &tba_nonce[i * TBA_BLOCK_LEN];
+        memcpy(block, tba_address, TBA_ADDRESS_LEN);
+        tba_put_u32_le(&block[TBA_NONCE_COUNTER_INDEX], counter);
+        block[TBA_NONCE_BLOCK_INDEX] = (uint8_t)i;
+    }
+
+    return psa_cipher_encrypt(key, PSA_ALG_ECB_NO_PADDING,
+                              tba_nonce, (blocks * TBA_BLOCK_LEN),
+                              ks, (blocks * TBA_BLOCK_LEN), &out_len);
+}
+
+//! @brief Truncated CMAC over BD_ADDR | Tag Type ID | Counter | Ciphertext
+static psa_status_t tba_compute_mic(psa_key_id_t key, const uint8_t *frame, uint16_t frame_len, uint8_t *mic)
+{
+    size_t mic_len;
+
+    memcpy(tba_mic_input, tba_address, TBA_ADDRESS_LEN);
+    memcpy(&tba_mic_input[TBA_ADDRESS_LEN], frame, frame_len);
+
+    return psa_mac_compute(key, TBA_MIC_ALG,
+                           tba_mic_input, (TBA_ADDRESS_LEN + frame_len),
+                           mic, TBA_MIC_LEN, &mic_len);
+}
+
+static void tba_xor(uint8_t *data, const uint8_t *ks, uint16_t len)
+{
+    uint16_t i;
+
+    for (i = 0; i < len; i++) {
+        data[i] ^= ks[i];
+    }
+}
+
+static void tba_destroy_keys(tba_keys_t *keys)
+{
+    psa_destroy_key(keys->enc);
+    psa_destroy_key(keys->mac);
+    keys->enc = 0;
+    keys->mac = 0;
+}
+
+/**
+ * @brief Derive a CMAC key from the provisioned key: AES(K, label block)
+ * @param enc provisioned key (AES-ECB)
+ * @param label one AES block
+ * @param mac derived key
+ */
+static psa_status_t tba_derive_mac_key(psa_key_id_t enc, const uint8_t *label, psa_key_id_t *mac)
+{
+    psa_key_attributes_t attr = PSA_KEY_ATTRIBUTES_INIT;
+    uint8_t mac_key[TBA_KEY_LEN];
+    size_t out_len;
+    psa_status_t ret;
+
+    ret = psa_cipher_encrypt(enc, PSA_ALG_ECB_NO_PADDING, label, TBA_BLOCK_LEN, mac_key, sizeof(mac_key), &out_len);
+
+    if (ret == PSA_SUCCESS) {
+        psa_set_key_type(&attr, PSA_KEY_TYPE_AES);
+        psa_set_key_bits(&attr, (TBA_KEY_LEN * 8));
+        psa_set_key_lifetime(&attr, PSA_KEY_LIFETIME_VOLATILE);
+        psa_set_key_usage_flags(&attr, (PSA_KEY_USAGE_SIGN_MESSAGE | PSA_KEY_USAGE_VERIFY_MESSAGE));
+        psa_set_key_algorithm(&attr, TBA_MIC_ALG);
+        ret = psa_import_key(&attr, mac_key, TBA_KEY_LEN, mac);
+    }
+
+    memset(mac_key, 0, sizeof(mac_key));
+    psa_reset_key_attributes(&attr);
+
+    return ret;
+}
+
+/**
+ * @brief Import AES key as volatile PSA keys (encryption key and derived CMAC key)
+ */
+static psa_status_t tba_import_keys(const uint8_t *key, tba_keys_t *keys)
+{
+    psa_key_attributes_t attr = PSA_KEY_ATTRIBUTES_INIT;
+    uint8_t label[TBA_BLOCK_LEN];
+    psa_status_t ret;
+
+    psa_set_key_type(&attr, PSA_KEY_TYPE_AES);
+    psa_set_key_bits(&attr, (TBA_KEY_LEN * 8));
+    psa_set_key_lifetime(&attr, PSA_KEY_LIFETIME_VOLATILE);
+    psa_set_key_usage_flags(&attr, PSA_KEY_USAGE_ENCRYPT);
+    psa_set_key_algorithm(&attr, PSA_ALG_ECB_NO_PADDING);
+
+    ret = psa_import_key(&attr, key, TBA_KEY_LEN, &keys->enc);
+    psa_reset_key_attributes(&attr);
+    if (ret != PSA_SUCCESS) {
+        return ret;
+    }
+
+    // Derive MIC key so the same key is not used for both encryption and authentication.
+    memset(label, TBA_MAC_KEY_LABEL, sizeof(label));
+    ret = tba_derive_mac_key(keys->enc, label, &keys->mac);
+
+    if (ret != PSA_SUCCESS) {
+        psa_destroy_key(keys->enc);
+    }
+
+    return ret;
+}
+
+//! @brief Derive a reader frame key from a two characters label (zero padded to one block)
+static psa_status_t tba_derive_reader_key(psa_key_id_t enc, const char *name, psa_key_id_t *key)
+{
+    uint8_t label[TBA_BLOCK_LEN];
+
+    memset(label, 0, sizeof(label));
+    memcpy(label, name, 2);
+
+    return tba_derive_mac_key(enc, label, key);
+}
+
+//! @brief Derive reader frame keys (see tag_beacon_auth.h)
+static psa_status_t tba_import_reader_keys(psa_key_id_t enc, tba_reader_keys_t *keys)
+{
+    psa_status_t ret;
+
+    ret = tba_derive_reader_key(enc, TBA_DL_KEY_LABEL, &keys->dl);
+    if (ret == PSA_SUCCESS) {
+        ret = tba_derive_reader_key(enc, TBA_ACK_KEY_LABEL, &keys->ack);
+    }
+    if (ret == PSA_SUCCESS) {
+        ret = tba_derive_reader_key(enc, TBA_CFG_KEY_LABEL, &keys->cfg);
+    }
+
+    return ret;
+}
+
+static void tba_destroy_reader_keys(tba_reader_keys_t *keys)
+{
+    psa_destroy_key(keys->dl);
+    psa_destroy_key(keys->ack);
+    psa_destroy_key(keys->cfg);
+    memset(keys, 0, sizeof(tba_reader_keys_t));
+}
+
+//! @brief Reserve next block of counter values in NVM (a reboot never reuses a counter value)
+static uint32_t tba_reserve_counter_block(void)
+{
+    if (tba_counter_limit > (UINT32_MAX - TBA_COUNTER_BLOCK)) {
+        return 1;
+    }
+
+    if (nvm_write_tba_counter(tba_counter_limit + TBA_COUNTER_BLOCK) != 0) {
+        return 1;
+    }
+
+    tba_counter_limit += TBA_COUNTER_BLOCK;
+
+    return 0;
+}
+
+static uint32_t tba_get_cycles(void)
+{
+    return DWT->CYCCNT;
+}
+
+static void tba_bench_print(const char *name, uint32_t cycles)
+{
+    uint32_t cycles_per_us = (SystemCoreClockGet() / 1000000UL);
+    uint32_t avg = cycles / TBA_BENCH_ITERATIONS;
+
+    printf("\n  %-28s %6lu cycles (%lu us)", name, avg, ((cycles_per_us != 0) ? (avg / cycles_per_us) : 0));
+}
+
+//******************************************************************************
+// Non Static functions
+//******************************************************************************
+bool tba_is_enabled(void)
+{
+    return tba_enabled;
+}
+
+/**
+ * @brief Encrypt and sign a frame (main context)
+ * @param frame Tag Type ID byte followed by room for the counter, the plain text beacon
+ *     messages and room for the MIC.
+ * @param plain_len beacon messages length
+ * @return 0 if frame was sealed, otherwise frame is left in plain text.
+ */
+uint32_t tba_seal(uint8_t *frame, uint16_t plain_len)
+{
+    uint8_t next = tba_current ^ 1;
+
+    if (!tba_enabled || (plain_len > TBA_KEYSTREAM_LEN)) {
+        tba_stats.errors++;
+        return 1;
+    }
+
+    // Should not happen since reservation is kept ahead in idle time (see tba_process).
+    if ((tba_counter == tba_counter_limit) && (tba_reserve_counter_block() != 0)) {
+        DEBUG_LOG(DBG_CAT_WARNING, "Beacon auth. counter could not be reserved...");
+        tba_stats.errors++;
+        return 1;
+    }
+
+    if (tba_next_ready) {
+        tba_stats.keystream_hit++;
+    } else {
+        if (tba_gen_keystream(tba_keys.enc, tba_counter, tba_keystream[next], plain_len) != PSA_SUCCESS) {
+            tba_stats.errors++;
+            return 1;
+        }
+        tba_stats.keystream_miss++;
+    }
+
+    // Keystream of this frame is kept until next seal (needed by tba_unseal).
+    tba_current = next;
+    tba_next_ready = false;
+
+    frame[0] |= TBA_FRAME_SECURED;
+    tba_put_u32_le(&frame[TBA_FRAME_COUNTER_INDEX], tba_counter);
+    tba_xor(&frame[TBA_FRAME_DATA_INDEX], tba_keystream[tba_current], plain_len);
+    tba_counter++;
+
+    if (tba_compute_mic(tba_keys.mac, frame, (TBA_FRAME_DATA_INDEX + plain_len), &frame[TBA_FRAME_DATA_INDEX + plain_len]) != PSA_SUCCESS) {
+        tba_unseal(frame, plain_len);
+        tba_stats.errors++;
+        return 1;
+    }
+
+    tba_stats.sealed++;
+
+    return 0;
+}
+
+/**
+ * @brief Check truncated CMAC over BD_ADDR | frame (frame followed by its MIC)
+ * @details Multi-part so reader frames (configuration batches) are not bound to the beacon
+ *     frame buffer size.
+ */
+static uint32_t tba_verify_mic(psa_key_id_t key, const uint8_t *frame, uint16_t len)
+{
+    psa_mac_operation_t op = PSA_MAC_OPERATION_INIT;
+    uint16_t frame_len = (len - TBA_MIC_LEN);
+    psa_status_t ret;
+
+    if (!tba_enabled || (len <= TBA_MIC_LEN)) {
+        return 1;
+    }
+
+    ret = psa_mac_verify_setup(&op, key, TBA_MIC_ALG);
+    if (ret == PSA_SUCCESS) {
+        ret = psa_mac_update(&op, tba_address, TBA_ADDRESS_LEN);
+    }
+    if (ret == PSA_SUCCESS) {
+        ret = psa_mac_update(&op, frame, frame_len);
+    }
+    if (ret == PSA_SUCCESS) {
+        ret = psa_mac_verify_finish(&op, &frame[frame_len], TBA_MIC_LEN);
+    }
+
+    if (ret != PSA_SUCCESS) {
+        psa_mac_abort(&op);
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Verify the MIC of a downlink command (main context)
+ * @details Signed with the downlink key (K_dl), see tag_command.h for the frame.
+ * @param frame frame followed by its MIC
+ * @param len frame length including MIC
+ * @return 0 if MIC is valid.
+ */
+uint32_t tba_verify(const uint8_t *frame, uint16_t len)
+{
+    return tba_verify_mic(tba_reader_keys.dl, frame, len);
+}
+
+/**
+ * @brief Verify the MIC of a reader acknowledgment (main context)
+ * @details Signed with the ack key (K_ack), see ble_manager_machine.h for the frame.
+ * @param frame frame followed by its MIC
+ * @param len frame length including MIC
+ * @return 0 if MIC is valid.
+ */
+uint32_t tba_verify_ack(const uint8_t *frame, uint16_t len)
+{
+    return tba_verify_mic(tba_reader_keys.ack, frame, len);
+}
+
+/**
+ * @brief Verify the MIC of a GATT configuration batch (main context)
+ * @details Signed with the configuration key (K_cfg), see tag_configuration.h for the batch.
+ * @param frame batch followed by its MIC
+ * @param len batch length including MIC
+ * @return 0 if MIC is valid.
+ */
+uint32_t tba_verify_config(const uint8_t *frame, uint16_t len)
+{
+    return tba_verify_mic(tba_reader_keys.cfg, frame, len);
+}
+
+/**
+ * @brief Restore plain text of last sealed frame (safe from ISR context, no AES involved)
+ * @param frame
+ * @param plain_len
+ */
+void tba_unseal(uint8_t *frame, uint16_t plain_len)
+{
+    frame[0] &= ~TBA_FRAME_SECURED;
+    tba_xor(&frame[TBA_FRAME_DATA_INDEX], tba_keystream[tba_current], plain_len);
+}
+
+/**
+ * @brief Idle time work (main context, while advertising set is running)
+ * @details Precompute keystream for next frame and keep counter reservation ahead.
+ */
+void tba_process(void)
+{
+    if (!tba_enabled) {
+        return;
+    }
+
+    if (!tba_next_ready) {
+        if (tba_gen_keystream(tba_keys.enc, tba_counter, tba_keystream[tba_current ^ 1], TBA_KEYSTREAM_LEN) == PSA_SUCCESS) {
+            tba_next_ready = true;
+        }
+    }
+
+    if ((tba_counter_limit - tba_counter) <= (TBA_COUNTER_BLOCK / 2)) {
+        if (tba_reserve_counter_block() != 0) {
+            DEBUG_LOG(DBG_CAT_WARNING, "Beacon auth. counter exhausted or NVM error...");
+        }
+    }
+}
+
+//! @brief Print beacon authentication statistics (CLI)
+void tba_print_stats(void)
+{
+    printf("\n\n  Beacon auth.:         %s, counter %lu (reserved up to %lu)",
+           (tba_enabled ? "on" : "off (no key)"),
+           tba_counter,
+           tba_counter_limit);
+    printf("\n  Sealed frames:        %lu (precomputed keystream %lu, inline %lu, errors %lu)",
+           tba_stats.sealed,
+           tba_stats.keystream_hit,
+           tba_stats.keystream_miss,
+           tba_stats.errors);
+}
+
+/**
+ * @brief Measure per frame cost (CLI)
+ * @details Uses a throw away key and counter so beacon counter/keystream state is not touched.
+ * @note Do not run while advertising, PSA Crypto is otherwise used from main context.
+ */
+void tba_benchmark(void)
+{
+    static const uint8_t bench_key[TBA_KEY_LEN] = { 0 };
+    uint8_t frame[TBA_FRAME_DATA_INDEX + TBA_BENCH_PLAIN_LEN + TBA_MIC_LEN];
+    uint8_t ks[TBA_KEYSTREAM_LEN];
+    tba_keys_t keys;
+    uint32_t start;
+    uint32_t t_keystream = 0;
+    uint32_t t_seal_fast = 0;
+    uint32_t t_seal_cold = 0;
+    uint16_t i;
+
+    // PSA Crypto is only initialized by tba_init once a key is provisioned.
+    if ((psa_crypto_init() != PSA_SUCCESS) || (tba_import_keys(bench_key, &keys) != PSA_SUCCESS)) {
+        DEBUG_LOG(DBG_CAT_WARNING, "Beacon auth. benchmark key import failed...");
+        return;
+    }
+
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    memset(frame, 0x5A, sizeof(frame));
+
+    for (i = 0; i < TBA_BENCH_ITERATIONS; i++) {
+        // Idle time work (keystream for a full ADV_PDU)
+        start = tba_get_cycles();
+        tba_gen_keystream(keys.enc, i, ks, TBA_KEYSTREAM_LEN);
+        t_keystream += tba_get_cycles() - start;
+
+        // Per advert work with precomputed keystream (XOR + MIC)
+        start = tba_get_cycles();
+        tba_xor(&frame[TBA_FRAME_DATA_INDEX], ks, TBA_BENCH_PLAIN_LEN);
+        tba_compute_mic(keys.mac, frame, (TBA_FRAME_DATA_INDEX + TBA_BENCH_PLAIN_LEN), &frame[TBA_FRAME_DATA_INDEX + TBA_BENCH_PLAIN_LEN]);
+        t_seal_fast += tba_get_cycles() - start;
+
+        // Per advert work without precomputation
+        start = tba_get_cycles();
+        tba_gen_keystream(keys.enc, i, ks, TBA_BENCH_PLAIN_LEN);
+        tba_xor(&frame[TBA_FRAME_DATA_INDEX], ks, TBA_BENCH_PLAIN_LEN);
+        tba_compute_mic(keys.mac, frame, (TBA_FRAME_DATA_INDEX + TBA_BENCH_PLAIN_LEN), &frame[TBA_FRAME_DATA_INDEX + TBA_BENCH_PLAIN_LEN]);
+        t_seal_cold += tba_get_cycles() - start;
+    }
+
+    tba_destroy_keys(&keys);
+
+    printf("\n\n  Beacon auth. benchmark (%d bytes of beacon messages, avg. of %d runs):", TBA_BENCH_PLAIN_LEN, TBA_BENCH_ITERATIONS);
+    tba_bench_print("Keystream precompute (idle):", t_keystream);
+    tba_bench_print("Seal, precomputed keystream:", t_seal_fast);
+    tba_bench_print("Seal, inline keystream:", t_seal_cold);
+}
+
+/**
+ * @brief Init beacon authentication (main context, after BLE Stack boot)
+ * @details Authentication stays off until a key is provisioned in NVM.
+ * @param address BLE identity address (part of nonce and MIC)
+ * @return 0 if beacon authentication is on.
+ */
+uint32_t tba_init(const uint8_t *address)
+{
+    uint8_t key[TBA_KEY_LEN];
+    uint32_t stored_limit;
+
+    tba_enabled = false;
+    tba_next_ready = false;
+    tba_current = 0;
+    memset(&tba_stats, 0, sizeof(tba_stats));
+    memcpy(tba_address, address, TBA_ADDRESS_LEN);
+
+    if (nvm_read_tba_key(key) != 0) {
+        DEBUG_LOG(DBG_CAT_WARNING, "Beacon auth. key not provisioned, beacons are sent in plain text...");
+        return 1;
+    }
+
+    if ((psa_crypto_init() != PSA_SUCCESS) || (tba_import_keys(key, &tba_keys) != PSA_SUCCESS)) {
+        memset(key, 0, sizeof(key));
+        DEBUG_LOG(DBG_CAT_WARNING, "Beacon auth. key import failed...");
+        return 1;
+    }
+    memset(key, 0, sizeof(key));
+
+    if (tba_import_reader_keys(tba_keys.enc, &tba_reader_keys) != PSA_SUCCESS) {
+        tba_destroy_reader_keys(&tba_reader_keys);
+        tba_destroy_keys(&tba_keys);
+        DEBUG_LOG(DBG_CAT_WARNING, "Beacon auth. reader keys derivation failed...");
+        return 1;
+    }
+
+    // Skip whatever was reserved by last boot, those values may have been used already.
+    if (nvm_read_tba_counter(&stored_limit) != 0) {
+        stored_limit = 0;
+    }
+    tba_counter = stored_limit;
+    tba_counter_limit = stored_limit;
+
+    if (tba_reserve_counter_block() != 0) {
+        tba_destroy_reader_keys(&tba_reader_keys);
+        tba_destroy_keys(&tba_keys);
+        DEBUG_LOG(DBG_CAT_WARNING, "Beacon auth. counter exhausted or NVM error...");
+        return 1;
+    }
+
+    tba_enabled = true;
+    tba_process();
+
+    DEBUG_LOG(DBG_CAT_BLE, "Beacon auth. on (counter %lu)", tba_counter);
+
+    return 0;
+}
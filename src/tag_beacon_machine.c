@@ -9,6 +9,7 @@
  */
 
 #include "stdio.h"
+#include "em_core.h"
 
 #include "tag_defines.h"
 #include "nvm.h"
@@ -19,7 +20,9 @@
 #include "temperature_machine.h"
 #include "ble_manager_machine.h"
 #include "tag_main_machine.h"
+#include "tag_power_manager.h"
 #include "tag_status_fw_machine.h"
+#include "tag_command.h"
 #include "tag_beacon_machine.h"
 
 
@@ -43,10 +46,29 @@ static tag_sw_timer_t tbm_beacon_timer;
 static volatile tbm_status_t tbm_status;
 static uint32_t tbm_fast_rate_reload;
 static uint32_t tbm_slow_rate_reload;
+static uint16_t tbm_slow_rate_stretch_pct;
+static bool tbm_critical_status_queued;                /* Tag Status in BLE Manager critical queue (not advertised yet) */
+#if defined(TAG_RETAINED_STATE_PRESENT)
+static uint32_t tbm_critical_inflight;                 /* events in BLE Manager critical queue (not advertised yet) */
+#endif
 
 //******************************************************************************
 // Static functions
 //******************************************************************************
+/**
+ * @brief Return slow beacon rate reload value with Energy Budget stretch applied.
+ */
+static uint32_t tbm_get_stretched_slow_rate_reload(void)
+{
+    uint32_t reload = (tbm_slow_rate_reload * tbm_slow_rate_stretch_pct) / 100;
+
+    if (reload > TBM_SLOW_BEACON_RATE_RELOAD_MAX) {
+        reload = TBM_SLOW_BEACON_RATE_RELOAD_MAX;
+    }
+
+    return reload;
+}
+
 char* tbm_get_event_name(tbm_beacon_events_t event)
 {
     switch(event) {
@@ -75,6 +97,9 @@ char* tbm_get_event_name(tbm_beacon_events_t event)
         case TBM_UPTIME_EVT:
             return "Tag Uptime";
 
+        case TBM_POWER_STATS_EVT:
+            return "Power Stats";
+
         case TBM_CMD_ACK_EVT:
             return "Tag Command Acknowledgment";
 
@@ -91,7 +116,7 @@ char* tbm_get_event_name(tbm_beacon_events_t event)
  */
 static tbm_beacon_events_t tbm_get_sync_event(uint8_t bit)
 {
-    return (tbm_status.events & (1 << bit));
+    return ((tbm_status.events & ~tbm_status.event_async_flag) & (1 << bit));
 }
 
 static tbm_beacon_events_t tbm_get_async_event(uint8_t bit)
@@ -106,168 +131,181 @@ static void tbm_clear_event(tbm_beacon_events_t event)
 }
 
 /**
- * @brief Enqueue message and clear TBM event
+ * @brief Commit message reserved in BLE Manager queue and clear TBM event
+ * @param bmm_msg_priority_t
  * @param bmm_msg_t*
  * @param tbm_beacon_events_t
+ * @return 0 if message was enqueued.
  */
-static void tbm_dispatch_msg(bmm_msg_t* msg, tbm_beacon_events_t event)
+static uint32_t tbm_dispatch_msg(bmm_msg_priority_t priority, bmm_msg_t* msg, tbm_beacon_events_t event)
 {
     uint32_t status;
 
-    status = bmm_enqueue_msg(msg);
+    status = bmm_commit_msg(priority, msg);
 
     if (status == 0) {
         // Message was enqueued, we can now clear this TBM event.
         tbm_clear_event(event);
+#if defined(TAG_RETAINED_STATE_PRESENT)
+        if (priority == BMM_MSG_CRITICAL) {
+            tbm_critical_inflight |= event;
+        }
+#endif
         DEBUG_LOG(DBG_CAT_TAG_BEACON, COLOR_BG_BLUE COLOR_B_CYAN "%s" COLOR_RST " beacon message was enqueued...", tbm_get_event_name(event));
     } else {
         DEBUG_LOG(DBG_CAT_WARNING, "Error to enqueue beacon message...");
     }
+
+    return status;
 }
 
-static void tbm_send_firmware_rev_beacon(void)
+static void tbm_send_firmware_rev_beacon(bmm_msg_priority_t priority)
 {
-    volatile uint8_t i = 0;
+    bmm_msg_t *msg = bmm_reserve_msg(priority, BLE_MSG_FIRMWARE_REV, 4);
 
-    if (!bmm_queue_is_full()) {
-        bmm_msg_t msg;
-        msg.type = BLE_MSG_FIRMWARE_REV;
-        msg.data[i++] = firmware_revision[0];  /* most significant digit of FW rev format */
-        msg.data[i++] = firmware_revision[1];
-        msg.data[i++] = firmware_revision[2];
-        msg.data[i++] = firmware_revision[3];
-        msg.length = i + 1;
+    if (msg != NULL) {
+        msg->data[0] = firmware_revision[0];  /* most significant digit of FW rev format */
+        msg->data[1] = firmware_revision[1];
+        msg->data[2] = firmware_revision[2];
+        msg->data[3] = firmware_revision[3];
 
         // Send msg to BLE Manager queue and clear TBM event.
-        tbm_dispatch_msg(&msg, TBM_FIRMWARE_REV_EVT);
+        tbm_dispatch_msg(priority, msg, TBM_FIRMWARE_REV_EVT);
 
     } else {
         DEBUG_LOG(DBG_CAT_WARNING, "BMM message queue is full");
     }
 }
 
-static void tbm_send_tag_ext_status_beacon(void)
+static void tbm_send_tag_ext_status_beacon(bmm_msg_priority_t priority)
 {
-    volatile uint8_t i = 0;
-    volatile uint8_t j;
-    bmm_msg_t msg;
-
-    if (!bmm_queue_is_full()) {
-        tsm_tag_ext_status_t *data = tsm_get_tag_ext_status_beacon_data();
-        msg.type = BLE_MSG_TAG_EXT_STATUS;
-        msg.data[i++] = data->length;
+    tsm_tag_ext_status_t *data = tsm_get_tag_ext_status_beacon_data();
+    bmm_msg_t *msg = bmm_reserve_msg(priority, BLE_MSG_TAG_EXT_STATUS, data->length + 1);
+    uint8_t j;
+
+    if (msg != NULL) {
+        msg->data[0] = data->length;
         for (j = 0; j < data->length; j++) {
-            msg.data[i++] = data->bytes[j];
+            msg->data[j + 1] = data->bytes[j];
         }
-        msg.length = i + 1;
 
         // Send msg to BLE Manager queue and clear TBM event.
-        tbm_dispatch_msg(&msg, TBM_EXT_STATUS_EVT);
+        tbm_dispatch_msg(priority, msg, TBM_EXT_STATUS_EVT);
 
     } else {
         DEBUG_LOG(DBG_CAT_WARNING, "BMM message queue is full");
     }
 }
 
-static void tbm_send_tag_status_beacon(void)
+static void tbm_send_tag_status_beacon(bmm_msg_priority_t priority)
 {
-    volatile uint8_t i = 0;
+    bmm_msg_t *msg = bmm_reserve_msg(priority, BLE_MSG_TAG_STATUS, 1);
 
-    if (!bmm_queue_is_full()) {
+    if (msg != NULL) {
         tsm_tag_status_t *data = tsm_get_tag_status_beacon_data();
-        bmm_msg_t msg;
-        msg.type = BLE_MSG_TAG_STATUS;
-        msg.data[i++] = data->byte;
-        msg.length = i + 1;
+        msg->data[0] = data->byte;
 
         // Send msg to BLE Manager queue and clear TBM event.
-        tbm_dispatch_msg(&msg, TBM_TAG_STATUS_EVT);
+        if ((tbm_dispatch_msg(priority, msg, TBM_TAG_STATUS_EVT) == 0) && (priority == BMM_MSG_CRITICAL)) {
+            tbm_critical_status_queued = true;
+        }
 
     } else {
         DEBUG_LOG(DBG_CAT_WARNING, "BMM message queue is full");
     }
 }
 
-static void tbm_send_lf_beacon(void)
+static void tbm_send_lf_beacon(bmm_msg_priority_t priority)
 {
-    volatile uint8_t i = 0;
+    bmm_msg_t *msg = bmm_reserve_msg(priority, BLE_MSG_LF_FIELD, 2);
 
-    if (!bmm_queue_is_full()) {
+    if (msg != NULL) {
         lfm_lf_beacon_t *data = lfm_get_beacon_data();
-        bmm_msg_t msg;
-        msg.type = BLE_MSG_LF_FIELD;
-        msg.data[i++] = data->lf_data[0];
-        msg.data[i++] = data->lf_data[1];
-        msg.length = i + 1;
+        msg->data[0] = data->lf_data[0];
+        msg->data[1] = data->lf_data[1];
 
         // Send msg to BLE Manager queue and clear TBM event.
-        tbm_dispatch_msg(&msg, TBM_LF_EVT);
+        tbm_dispatch_msg(priority, msg, TBM_LF_EVT);
 
     } else {
         DEBUG_LOG(DBG_CAT_TAG_BEACON, "BMM message queue is full");
     }
 }
 
-static void tbm_send_temperature_beacon(void)
+static void tbm_send_temperature_beacon(bmm_msg_priority_t priority)
 {
-    uint32_t status;
-    volatile uint8_t i = 0;
+    bmm_msg_t *msg = bmm_reserve_msg(priority, BLE_MSG_TEMPERATURE, 1);
 
-    if (!bmm_queue_is_full()) {
+    if (msg != NULL) {
         int8_t temperature = ttm_get_current_temperature();
-        bmm_msg_t msg;
-        msg.type = BLE_MSG_TEMPERATURE;
-        msg.data[i++] = (uint8_t)temperature;
-        msg.length = i + 1;
+        msg->data[0] = (uint8_t)temperature;
 
-        status = bmm_enqueue_msg(&msg);
+        // Send msg to BLE Manager queue and clear TBM event.
+        tbm_dispatch_msg(priority, msg, TBM_TEMPERATURE_EVT);
 
-        if (status == 0) {
-            // Message is queued, we can now clear this event.
-            tbm_clear_event(TBM_TEMPERATURE_EVT);
-            DEBUG_LOG(DBG_CAT_TAG_BEACON, COLOR_BG_BLUE COLOR_B_CYAN "Tag Temperature Beacon" COLOR_RST " was queued...");
-        } else {
-            DEBUG_LOG(DBG_CAT_TAG_BEACON, "BMM queue returned an error...");
-        }
     } else {
         DEBUG_LOG(DBG_CAT_TAG_BEACON, "BMM message queue is full");
     }
 
 }
 
-static void tbm_send_uptime_beacon(void)
+static void tbm_send_uptime_beacon(bmm_msg_priority_t priority)
 {
-    uint32_t status;
-    volatile uint8_t i = 0;
+    bmm_msg_t *msg = bmm_reserve_msg(priority, BLE_MSG_UPTIME, 2);
 
-    if (!bmm_queue_is_full()) {
+    if (msg != NULL) {
         uint16_t uptime_days = tum_get_beacon_data();
-        bmm_msg_t msg;
-        msg.type = BLE_MSG_UPTIME;
-        msg.data[i++] = (uint8_t)(uptime_days >> 8);
-        msg.data[i++] = (uint8_t)(uptime_days);
-        msg.length = i + 1;
-
-        status = bmm_enqueue_msg(&msg);
-
-        if (status == 0) {
-            // Message is queued, we can now clear this event.
-            tbm_clear_event(TBM_UPTIME_EVT);
-            DEBUG_LOG(DBG_CAT_TAG_BEACON, COLOR_BG_BLUE COLOR_B_CYAN "Tag Uptime Beacon" COLOR_RST " was queued...");
-        } else {
-            DEBUG_LOG(DBG_CAT_TAG_BEACON, "BMM queue returned an error...");
-        }
+        msg->data[0] = (uint8_t)(uptime_days >> 8);
+        msg->data[1] = (uint8_t)(uptime_days);
+
+        // Send msg to BLE Manager queue and clear TBM event.
+        tbm_dispatch_msg(priority, msg, TBM_UPTIME_EVT);
+
     } else {
         DEBUG_LOG(DBG_CAT_TAG_BEACON, "BMM message queue is full");
     }
 }
 
-#if 0
-static void tbm_send_cmd_ack_beacon()
+#if defined(TAG_POWER_STATS_BEACON_PRESENT)
+static void tbm_send_power_stats_beacon(bmm_msg_priority_t priority)
 {
-    //to be implemented
+    bmm_msg_t *msg = bmm_reserve_msg(priority, BLE_MSG_POWER_STATS, TPM_POWER_TELEMETRY_LEN);
+
+    if (msg != NULL) {
+        // Power stats since previous message
+        tpm_get_power_telemetry((tpm_power_telemetry_t *)msg->data);
+
+        // Send msg to BLE Manager queue and clear TBM event.
+        tbm_dispatch_msg(priority, msg, TBM_POWER_STATS_EVT);
+
+    } else {
+        DEBUG_LOG(DBG_CAT_TAG_BEACON, "BMM message queue is full");
+    }
+}
+#endif
+
+#if defined(TAG_DOWNLINK_PRESENT)
+static void tbm_send_cmd_ack_beacon(bmm_msg_priority_t priority)
+{
+    bmm_msg_t *msg = bmm_reserve_msg(priority, BLE_MSG_COMMAND_ACK, 4);
+
+    if (msg != NULL) {
+        tcm_cmd_ack_t *data = tcm_get_cmd_ack_beacon_data();
+        msg->data[0] = data->cmd_id;
+        msg->data[1] = data->status;
+        msg->data[2] = (uint8_t)(data->counter >> 8);
+        msg->data[3] = (uint8_t)(data->counter);
+
+        // Send msg to BLE Manager queue and clear TBM event.
+        tbm_dispatch_msg(priority, msg, TBM_CMD_ACK_EVT);
+
+    } else {
+        DEBUG_LOG(DBG_CAT_TAG_BEACON, "BMM message queue is full");
+    }
 }
+#endif
 
+#if 0
 static void tbm_send_fall_detection_beacon()
 {
     //to be implemented
@@ -279,37 +317,44 @@ static void tbm_send_button_beacon()
 }
 #endif
 
-//! @brief Decode pending events, Prioritize messages, Sends messages to BLE Manager Queue
-static void tbm_decode_event(tbm_beacon_events_t event)
+//! @brief Decode pending events, Sends messages to BLE Manager Queue according to priority
+static void tbm_decode_event(tbm_beacon_events_t event, bmm_msg_priority_t priority)
 {
     if (event != 0) {
         switch (event) {
 
             case TBM_LF_EVT:
-                tbm_send_lf_beacon();
+                tbm_send_lf_beacon(priority);
                 break;
 
             case TBM_TEMPERATURE_EVT:
-                tbm_send_temperature_beacon();
+                tbm_send_temperature_beacon(priority);
                 break;
 
             case TBM_FIRMWARE_REV_EVT:
-                tbm_send_firmware_rev_beacon();
+                tbm_send_firmware_rev_beacon(priority);
                 break;
 
             case TBM_EXT_STATUS_EVT:
-                tbm_send_tag_ext_status_beacon();
+                tbm_send_tag_ext_status_beacon(priority);
                 break;
 
             case TBM_CMD_ACK_EVT:
-                //TODO to be implemented
-                //tbm_send_cmd_ack_beacon();
+#if defined(TAG_DOWNLINK_PRESENT)
+                tbm_send_cmd_ack_beacon(priority);
+#endif
                 break;
 
             case TBM_UPTIME_EVT:
-                tbm_send_uptime_beacon();
+                tbm_send_uptime_beacon(priority);
                 break;
 
+#if defined(TAG_POWER_STATS_BEACON_PRESENT)
+            case TBM_POWER_STATS_EVT:
+                tbm_send_power_stats_beacon(priority);
+                break;
+#endif
+
 #if 0 // Feature not supported on UT3
 
             case TBM_FALL_DETECT_EVT:
@@ -332,6 +377,9 @@ static void tbm_decode_event(tbm_beacon_events_t event)
 void tbm_apply_new_settings(tbm_nvm_data_t *b)
 {
     if ((b->fast_rate > 0) && (b->slow_rate > 0)) {
+        // Called from CLI (sleeptimer ISR) and Tag Main Machine
+        CORE_DECLARE_IRQ_STATE;
+        CORE_ENTER_ATOMIC();
 
         // Update reload values
         tbm_fast_rate_reload = b->fast_rate;
@@ -339,13 +387,27 @@ void tbm_apply_new_settings(tbm_nvm_data_t *b)
 
         // Update timers
         tag_sw_timer_reload(&tbm_beacon_timer, tbm_fast_rate_reload);
-        tag_sw_timer_reload(&tbm_beacon_timer, tbm_slow_rate_reload);
+        tag_sw_timer_reload(&tbm_beacon_timer, tbm_get_stretched_slow_rate_reload());
+
+        CORE_EXIT_ATOMIC();
 
     } else {
         DEBUG_LOG(DBG_CAT_WARNING, "Beacon Rate cannot be zero...");
     }
 }
 
+/**
+ * @brief Stretch slow beacon rate (used by Energy Budget Machine governor)
+ * @param stretch_pct (100 means configured slow beacon rate)
+ * @note New value is applied on next slow beacon timer reload.
+ */
+void tbm_set_slow_rate_stretch(uint16_t stretch_pct)
+{
+    if (stretch_pct >= 100) {
+        tbm_slow_rate_stretch_pct = stretch_pct;
+    }
+}
+
 uint16_t tbm_get_fast_beacon_rate(void)
 {
     return (uint16_t)tbm_fast_rate_reload;
@@ -356,6 +418,16 @@ uint16_t tbm_get_slow_beacon_rate(void)
     return (uint16_t)(tbm_slow_rate_reload / 4);
 }
 
+/**
+ * @brief Tag Main Machine tick of next sync beacon
+ * @param tick
+ * @return false if it is not known yet (sync beacon held until periodic queue is advertised).
+ */
+bool tbm_get_sync_beacon_tick(uint32_t *tick)
+{
+    return tag_sw_timer_get_deadline(&tbm_beacon_timer, tick);
+}
+
 /**
  * @brief Sets a msg event flag for Tag Beacon Machine
  * @param tbm_beacon_events_t
@@ -364,6 +436,9 @@ uint16_t tbm_get_slow_beacon_rate(void)
  */
 void tbm_set_event(tbm_beacon_events_t event, bool is_async)
 {
+    // Called from Tag Main Machine and CLI (sleeptimer ISR)
+    CORE_DECLARE_IRQ_STATE;
+    CORE_ENTER_ATOMIC();
     tbm_status.events |= event;
 
     if (is_async) {
@@ -373,8 +448,37 @@ void tbm_set_event(tbm_beacon_events_t event, bool is_async)
         // clear flag
         tbm_status.event_async_flag &= ~event;
     }
+    CORE_EXIT_ATOMIC();
 }
 
+#if defined(TAG_RETAINED_STATE_PRESENT)
+/**
+ * @brief Pending events and sync beacon phase (end of Tag Main Machine run)
+ * @details Critical messages still in BLE Manager queue are kept as pending events, they
+ *     are sent again after a warm reset.
+ * @param r
+ */
+void tbm_get_retained(tbm_retained_t *r)
+{
+    uint32_t deadline;
+
+    r->events = (tbm_status.events | tbm_critical_inflight);
+    r->async_events = (tbm_status.event_async_flag | tbm_critical_inflight);
+    r->beacon_ticks = 0;
+    if (tag_sw_timer_get_deadline(&tbm_beacon_timer, &deadline)) {
+        r->beacon_ticks = (uint16_t)(deadline - tag_sw_timer_get_time());
+    }
+}
+
+//! @brief Restore pending events and sync beacon phase (after @ref tbm_init)
+void tbm_restore(const tbm_retained_t *r)
+{
+    tbm_status.events |= r->events;
+    tbm_status.event_async_flag |= r->async_events;
+    tag_sw_timer_reload(&tbm_beacon_timer, ((r->beacon_ticks != 0) ? r->beacon_ticks : 1));
+}
+#endif
+
 /**
  * @brief Tag Beacon Machine
  * @details
@@ -383,53 +487,73 @@ void tbm_set_event(tbm_beacon_events_t event, bool is_async)
  */
 void tag_beacon_run(void)
 {
+    int8_t bit;
+    bool is_sync_time = false;
 
-    if (bmm_queue_is_empty()) {
-        int8_t bit;
+    // Note: - Async means messages that are not synchronized with "slow" or "fast" beacon rate and will be transmitted immediately.
+    //             They go to BLE Manager critical queue which is always advertised first.
+    //       - Sync means messages that are to be synchronized with "slow" or "fast" beacon rate so it will only be sent
+    //             once 'tbm_beacon_timer' expires. They go to BLE Manager periodic queue.
 
-        // Tick Synchronous Beacon timer
-        tag_sw_timer_tick(&tbm_beacon_timer);
+#if defined(TAG_RETAINED_STATE_PRESENT)
+    if (bmm_queue_is_empty(BMM_MSG_CRITICAL)) {
+        tbm_critical_inflight = 0;
+    }
+#endif
 
-        // Note: - Async means messages that are not synchronized with "slow" or "fast" beacon rate and will be transmitted immediately.
-        //       - Sync means messages that are to be synchronized with "slow" or "fast" beacon rate so it will only be sent
-        //             once 'tbm_beacon_timer' expires.
+    // Tag Status queued for previous async events was advertised.
+    if (bmm_queue_is_empty(BMM_MSG_CRITICAL)) {
+        tbm_critical_status_queued = false;
+    }
 
-        // Check if there are async or sync tag beacon events
-        if ((tbm_status.event_async_flag != 0) || ( tag_sw_timer_is_expired(&tbm_beacon_timer))) {
+    // Sync beacon is held (timer stays expired) while previous periodic messages are not advertised yet.
+    if (bmm_queue_is_empty(BMM_MSG_PERIODIC)) {
+        is_sync_time = tag_sw_timer_is_expired(&tbm_beacon_timer);
+    }
 
-            // First add Tag Status Message (this message is present on every single transmission)
-            // This message also handles some tag features events like tamper, battery low, motion, ambient light sensor, etc.
-            tbm_send_tag_status_beacon();
+    // Check if there are async or sync tag beacon events
+    if ((tbm_status.event_async_flag != 0) || (is_sync_time)) {
 
-            // Then check for async beacon events (these are usually critical events like entering lf field, etc..)
-            if (tbm_status.event_async_flag != 0) {
-                for (bit = 0; bit < TBM_MAX_EVENTS; bit++) {
-                    tbm_beacon_events_t event = tbm_get_async_event(bit);
-                    if (event) {
-                        tbm_decode_event(event);
-                    }
+        // First add Tag Status Message (this message is present on every single transmission)
+        // This message also handles some tag features events like tamper, battery low, motion, ambient light sensor, etc.
+        // Async events retried while critical queue is full share the Tag Status already queued for them.
+        if (tbm_status.event_async_flag != 0) {
+            if (!tbm_critical_status_queued) {
+                tbm_send_tag_status_beacon(BMM_MSG_CRITICAL);
+            }
+        } else {
+            tbm_send_tag_status_beacon(BMM_MSG_PERIODIC);
+        }
+
+        // Then check for async beacon events (these are usually critical events like entering lf field, etc..)
+        // If critical queue is full these events remain pending and will be retried on next tick.
+        if (tbm_status.event_async_flag != 0) {
+            for (bit = 0; bit < TBM_MAX_EVENTS; bit++) {
+                tbm_beacon_events_t event = tbm_get_async_event(bit);
+                if (event) {
+                    tbm_decode_event(event, BMM_MSG_CRITICAL);
                 }
             }
+        }
 
-            // Then check if it is time to send synchronous beacons (these are usually periodic events like staying in field, firmware rev, uptime.. etc)
-            if (tag_sw_timer_is_expired(&tbm_beacon_timer)) {
-                if (tbm_status.events != 0) {
-                    for (bit = 0; bit < TBM_MAX_EVENTS; bit++) {
-                        tbm_beacon_events_t event = tbm_get_sync_event(bit);
-                        if (event) {
-                            tbm_decode_event(event);
-                        }
+        // Then check if it is time to send synchronous beacons (these are usually periodic events like staying in field, firmware rev, uptime.. etc)
+        if (is_sync_time) {
+            if (tbm_status.events != 0) {
+                for (bit = 0; bit < TBM_MAX_EVENTS; bit++) {
+                    tbm_beacon_events_t event = tbm_get_sync_event(bit);
+                    if (event) {
+                        tbm_decode_event(event, BMM_MSG_PERIODIC);
                     }
                 }
             }
+        }
 
-            // Reload Synchronous Beacon timer
-            // Check for feature states and decide if next beacon is "slow" or "fast" interval.
-            if ((lfm_get_lf_status() & (LFM_STAYING_IN_FIELD_FLAG | LFM_ENTERING_FIELD_FLAG))) {
-                tag_sw_timer_reload(&tbm_beacon_timer, tbm_fast_rate_reload);
-            } else {
-                tag_sw_timer_reload(&tbm_beacon_timer, tbm_slow_rate_reload);
-            }
+        // Reload Synchronous Beacon timer
+        // Check for feature states and decide if next beacon is "slow" or "fast" interval.
+        if ((lfm_get_lf_status() & (LFM_STAYING_IN_FIELD_FLAG | LFM_ENTERING_FIELD_FLAG))) {
+            tag_sw_timer_reload(&tbm_beacon_timer, tbm_fast_rate_reload);
+        } else {
+            tag_sw_timer_reload(&tbm_beacon_timer, tbm_get_stretched_slow_rate_reload());
         }
     }
 }
@@ -440,11 +564,22 @@ uint32_t tbm_init(void)
     uint32_t status;
 
     // Init timer with shorter timeout so a message goes right away in a reset or power up.
-    tag_sw_timer_reload(&tbm_beacon_timer, TBM_INIT_BEACON_RATE_SEC);
+#if defined(TAG_FAST_BOOT_PRESENT)
+    tag_sw_timer_reload(&tbm_beacon_timer, 1);
+#else
+    tag_sw_timer_reload(&tbm_beacon_timer, TBM_INIT_BEACON_RATE_SEC_RELOAD);
+#endif
+#if defined(TAG_SHELF_MODE_PRESENT)
+    // Activated out of shelf mode, staff is waiting for this one.
+    if (tpm_is_fast_resume()) {
+        tag_sw_timer_reload(&tbm_beacon_timer, 1);
+    }
+#endif
 
     // Use factory default values (consider we are going to use this)
     tbm_fast_rate_reload = TBM_FAST_BEACON_RATE_RELOAD;
     tbm_slow_rate_reload = TBM_SLOW_BEACON_RATE_RELOAD;
+    tbm_slow_rate_stretch_pct = 100;
 
     // Read Beacon Rate configuration from NVM
     status = nvm_read_tbm_settings(&b);
@@ -456,3 +591,5 @@ uint32_t tbm_init(void)
 
     return 0;
 }
+
+TMM_MACHINE(50, tbm, "Tag Beacon", tbm_init, NULL, 0, 0);
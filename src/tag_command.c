@@ -1,43 +1,392 @@
 /*
  * tag_command.c
  *
+ *  Command handlers are shared by CLI and downlink (connectionless reader commands).
+ *
  */
 
 #include "stdio.h"
 #include "stdbool.h"
+#include "string.h"
+#include "em_core.h"
+#include "sl_bluetooth.h"
 
 #include "dbg_utils.h"
 #include "tag_sw_timer.h"
+#include "nvm.h"
+#include "tag_power_manager.h"
+#include "tag_beacon_machine.h"
+#include "ble_manager_machine.h"
+#include "tag_main_machine.h"
+#if defined(TAG_DOWNLINK_PRESENT)
+#include "tag_beacon_auth.h"
+#endif
+#include "tag_command.h"
 
 
 //******************************************************************************
 // Defines
 //******************************************************************************
+// Downlink frame offsets (frame starts at Frame Type byte)
+#define TCM_DL_ADDRESS_INDEX         (1)
+#define TCM_DL_COUNTER_INDEX         (TCM_DL_ADDRESS_INDEX + TCM_DL_ADDRESS_LEN)
+#define TCM_DL_CMD_ID_INDEX          (TCM_DL_COUNTER_INDEX + TCM_DL_COUNTER_LEN)
+#define TCM_DL_PARAMS_INDEX          (TCM_DL_CMD_ID_INDEX + 1)
 
 //******************************************************************************
 // Data types
 //******************************************************************************
+#if defined(TAG_DOWNLINK_PRESENT)
+typedef struct tcm_dl_cmd_t {
+    uint32_t counter;
+    uint8_t id;
+    uint8_t params_len;
+    uint8_t params[TCM_DL_MAX_PARAMS_LEN];
+} tcm_dl_cmd_t;
+
+typedef struct tcm_dl_stats_t {
+    uint32_t executed;
+    uint32_t duplicated;               /* last command received again (ack is sent again) */
+    uint32_t malformed;
+    uint32_t auth_failed;
+    uint32_t replayed;
+    uint32_t busy;                     /* previous command not executed yet */
+} tcm_dl_stats_t;
+#endif
 
 //******************************************************************************
 // Global variables
 //******************************************************************************
+static tbm_nvm_data_t tcm_tbm_settings;                            /* applied, waiting to be written into NVM */
+
+#if defined(TAG_DOWNLINK_PRESENT)
+static uint32_t tcm_dl_counter;                                    /* last accepted command counter */
+static tcm_dl_cmd_t tcm_dl_cmd;                                    /* written in main context, executed in ISR */
+static volatile bool tcm_dl_pending;
+static volatile bool tcm_dl_ack_repeat;
+static tcm_dl_cmd_t tcm_dl_deferred;                               /* off air command, waiting for its ack to be advertised */
+static bool tcm_dl_deferred_pending;
+static tcm_cmd_ack_t tcm_cmd_ack;
+static tcm_dl_stats_t tcm_dl_stats;
+#endif
 
 //******************************************************************************
 // Static functions
 //******************************************************************************
+#if defined(TAG_SHELF_MODE_PRESENT)
+/**
+ * @brief Enter shelf mode (main context)
+ * @details BLE Stack is halted before NVM is written, operation mode is saved so the tag
+ *     stays shelved over a battery swap. Does not return on success.
+ */
+static void tcm_enter_shelf_mode(void)
+{
+    sl_bt_system_halt(1);
+
+    DEBUG_LOG(DBG_CAT_CLI, "Writing to NVM...");
+    if (nvm_write_tag_op_mode(TPM_OP_MODE_SHELF) != 0) {
+        DEBUG_LOG(DBG_CAT_WARNING, "Shelf mode could not be saved into NVM...");
+        sl_bt_system_halt(0);
+        return;
+    }
+
+    DEBUG_LOG(DBG_CAT_CLI, "Entering shelf mode...");
+    tag_enter_deep_sleep();
+}
+#endif
+
+#if defined(TAG_DOWNLINK_PRESENT)
+static uint16_t tcm_get_u16_le(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t tcm_get_u32_le(const uint8_t *p)
+{
+    return ((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+}
+
+/**
+ * @brief Execute a downlink command (Tag Main Machine ISR context)
+ * @param cmd
+ * @return @ref tcm_cmd_status_t
+ */
+static tcm_cmd_status_t tcm_execute(const tcm_dl_cmd_t *cmd)
+{
+    switch (cmd->id) {
+
+        case TCM_CMD_BEACON_RATE:
+            if (cmd->params_len != 4) {
+                return TCM_CMD_INVALID_PARAM;
+            }
+            if (tcm_cmd_set_beacon_rate(tcm_get_u16_le(&cmd->params[0]), tcm_get_u16_le(&cmd->params[2])) != 0) {
+                return TCM_CMD_INVALID_PARAM;
+            }
+            return TCM_CMD_OK;
+
+        case TCM_CMD_DEEP_SLEEP:
+        case TCM_CMD_CURRENT_DRAW:
+            if (cmd->params_len != ((cmd->id == TCM_CMD_CURRENT_DRAW) ? 4 : 0)) {
+                return TCM_CMD_INVALID_PARAM;
+            }
+            // Tag goes off air, execution waits for the ack to be advertised (see tcm_run).
+            tcm_dl_deferred = *cmd;
+            tcm_dl_deferred_pending = true;
+            return TCM_CMD_OK;
+
+#if defined(TAG_GATT_PROVISIONING_PRESENT)
+        case TCM_CMD_PROVISIONING:
+            if ((cmd->params_len != 2) || (bmm_open_prov_window(tcm_get_u16_le(cmd->params)) != 0)) {
+                return TCM_CMD_INVALID_PARAM;
+            }
+            return TCM_CMD_OK;
+#endif
+
+        default:
+            return TCM_CMD_NOT_SUPPORTED;
+    }
+}
+
+//! @brief Execute off air command once its ack is advertised (Tag Main Machine ISR context)
+static void tcm_run_deferred(void)
+{
+    uint32_t status = 1;
+
+    if (!tcm_dl_deferred_pending || bmm_adv_running || !bmm_queue_is_empty(BMM_MSG_CRITICAL)) {
+        return;
+    }
+
+    tcm_dl_deferred_pending = false;
+
+    switch (tcm_dl_deferred.id) {
+        case TCM_CMD_DEEP_SLEEP:
+            status = tcm_cmd_enter_deep_sleep_mode();
+            break;
+
+        case TCM_CMD_CURRENT_DRAW:
+            status = tcm_cmd_enter_current_draw_mode(tcm_get_u32_le(tcm_dl_deferred.params));
+            break;
+
+        default:
+            break;
+    }
+
+    if (status != 0) {
+        DEBUG_LOG(DBG_CAT_WARNING, "Downlink command 0x%.2X failed...", tcm_dl_deferred.id);
+    }
+}
+#endif
 
 //******************************************************************************
 // Non Static functions
 //******************************************************************************
-void tcm_cmd_enter_deep_sleep_mode(void)
+/**
+ * @brief Write beacon rates into NVM and apply them to Tag Beacon Machine
+ * @param slow_rate (sec)
+ * @param fast_rate (x250 ms)
+ * @return 0 if new rates were applied.
+ */
+uint32_t tcm_cmd_set_beacon_rate(uint16_t slow_rate, uint16_t fast_rate)
 {
-    // Write bit mode to NVM
-    // Stop RTCC
-    // Stop
+    tbm_nvm_data_t b;
+
+    if ((slow_rate == 0) || (fast_rate == 0) || (slow_rate == 0xFFFF) || (fast_rate == 0xFFFF)) {
+        return 1;
+    }
+
+    b.is_erased = false;
+    b.slow_rate = slow_rate;
+    b.fast_rate = fast_rate;
+
+    DEBUG_LOG(DBG_CAT_CLI, "Applying new settings to Tag Beacon Machine...");
+    tbm_apply_new_settings(&b);
+
+    // Called from CLI and Tag Main Machine ISR context, NVM3 is not reentrant.
+    CORE_DECLARE_IRQ_STATE;
+    CORE_ENTER_ATOMIC();
+    tcm_tbm_settings = b;
+    CORE_EXIT_ATOMIC();
+    sl_bt_external_signal(TCM_EXT_SIGNAL_SAVE_BEACON_RATE);
+
+    return 0;
 }
 
-void tcm_cmd_enter_current_draw_mode(void)
+/**
+ * @brief BLE Stack external signals handler (called from BLE Stack event handler, main context)
+ * @details Writes into NVM what commands applied from interrupt context, enters shelf mode.
+ * @param signals
+ */
+void tcm_external_signal_handler(uint32_t signals)
 {
+    tbm_nvm_data_t b;
+    CORE_DECLARE_IRQ_STATE;
+
+    if (signals & TCM_EXT_SIGNAL_SAVE_BEACON_RATE) {
+        CORE_ENTER_CRITICAL();
+        b = tcm_tbm_settings;
+        CORE_EXIT_CRITICAL();
+
+        DEBUG_LOG(DBG_CAT_CLI, "Writing beacon rates to NVM...");
+        if (nvm_write_tbm_settings(&b) != 0) {
+            DEBUG_LOG(DBG_CAT_WARNING, "Beacon rates could not be saved into NVM...");
+        }
+    }
+
+#if defined(TAG_SHELF_MODE_PRESENT)
+    // Last one, does not return
+    if (signals & TCM_EXT_SIGNAL_DEEP_SLEEP) {
+        tcm_enter_shelf_mode();
+    }
+#endif
+}
+
+/**
+ * @brief Request shelf mode (deep sleep until RFSENSE or LF activation)
+ * @details Called from CLI and Tag Main Machine ISR context, NVM write and EM4 entry are
+ *     left to main context (@ref tcm_external_signal_handler).
+ * @return 1 if shelf mode is not supported.
+ */
+uint32_t tcm_cmd_enter_deep_sleep_mode(void)
+{
+#if defined(TAG_SHELF_MODE_PRESENT)
+    sl_bt_external_signal(TCM_EXT_SIGNAL_DEEP_SLEEP);
+    return 0;
+#else
+    return 1;
+#endif
+}
+
+/**
+ * @brief Enter current draw mode (manufacturing tests)
+ * @param reset_delay_ms (if 0 tag will stay in current draw mode until a HW reset)
+ * @return 0
+ */
+uint32_t tcm_cmd_enter_current_draw_mode(uint32_t reset_delay_ms)
+{
+    tpm_enter_current_draw_mode(reset_delay_ms);
+    return 0;
+}
+
+#if defined(TAG_DOWNLINK_PRESENT)
+/**
+ * @brief Authenticate a downlink frame and hand the command over to @ref tcm_run
+ *     (called from BLE Manager scanner report handler, main context)
+ * @param frame downlink frame (from Frame Type byte, MIC included)
+ * @param len
+ * @return 0 if command was accepted (or is a repetition of the last one).
+ */
+uint32_t tcm_post_downlink_cmd(const uint8_t *frame, uint8_t len)
+{
+    uint32_t counter;
+
+    if ((len < TCM_DL_MIN_LEN) || ((len - TCM_DL_MIN_LEN) > TCM_DL_MAX_PARAMS_LEN)) {
+        tcm_dl_stats.malformed++;
+        return 1;
+    }
+
+    if (tcm_dl_pending) {
+        tcm_dl_stats.busy++;
+        return 1;
+    }
+
+    if (tba_verify(frame, len) != 0) {
+        tcm_dl_stats.auth_failed++;
+        return 1;
+    }
+
+    counter = tcm_get_u32_le(&frame[TCM_DL_COUNTER_INDEX]);
+
+    // Reader did not get our ack, send it again without executing the command twice.
+    if ((counter == tcm_dl_counter) && (tcm_cmd_ack.counter == (uint16_t)counter)) {
+        tcm_dl_stats.duplicated++;
+        tcm_dl_ack_repeat = true;
+        tmm_wakeup();
+        return 0;
+    }
+
+    if (counter <= tcm_dl_counter) {
+        tcm_dl_stats.replayed++;
+        return 1;
+    }
+
+    // Counter is stored before execution so the command cannot be replayed after a reset.
+    if (nvm_write_tcm_dl_counter(counter) != 0) {
+        DEBUG_LOG(DBG_CAT_WARNING, "Downlink counter could not be saved into NVM...");
+        return 1;
+    }
+    tcm_dl_counter = counter;
+
+    tcm_dl_cmd.counter = counter;
+    tcm_dl_cmd.id = frame[TCM_DL_CMD_ID_INDEX];
+    tcm_dl_cmd.params_len = (len - TCM_DL_MIN_LEN);
+    memcpy(tcm_dl_cmd.params, &frame[TCM_DL_PARAMS_INDEX], tcm_dl_cmd.params_len);
+    tcm_dl_pending = true;
+    tmm_wakeup();
+
+    return 0;
+}
+
+tcm_cmd_ack_t* tcm_get_cmd_ack_beacon_data(void)
+{
+    return &tcm_cmd_ack;
+}
+
+//! @brief Print downlink statistics (CLI)
+void tcm_print_stats(void)
+{
+    printf("\n  Downlink commands:    executed %lu, repeated %lu (last counter %lu)",
+           tcm_dl_stats.executed,
+           tcm_dl_stats.duplicated,
+           tcm_dl_counter);
+    printf("\n  Downlink rejected:    auth %lu, replay %lu, malformed %lu, busy %lu",
+           tcm_dl_stats.auth_failed,
+           tcm_dl_stats.replayed,
+           tcm_dl_stats.malformed,
+           tcm_dl_stats.busy);
+}
+
+/**
+ * @brief Tag Command Machine (Tag Main Machine ISR context)
+ * @details Executes downlink commands and requests their Command Ack beacon.
+ */
+void tcm_run(void)
+{
+    tcm_run_deferred();
+
+    if (tcm_dl_ack_repeat) {
+        tcm_dl_ack_repeat = false;
+        tbm_set_event(TBM_CMD_ACK_EVT, true);
+    }
+
+    if (!tcm_dl_pending) {
+        return;
+    }
+
+    tcm_cmd_ack.cmd_id = tcm_dl_cmd.id;
+    tcm_cmd_ack.status = (uint8_t)tcm_execute(&tcm_dl_cmd);
+    tcm_cmd_ack.counter = (uint16_t)tcm_dl_cmd.counter;
+    tcm_dl_stats.executed++;
+    tcm_dl_pending = false;
+
+    DEBUG_LOG(DBG_CAT_CLI, "Downlink command 0x%.2X executed, status %d", tcm_cmd_ack.cmd_id, tcm_cmd_ack.status);
+
+    tbm_set_event(TBM_CMD_ACK_EVT, true);
+}
+
+uint32_t tcm_init(void)
+{
+    tcm_dl_pending = false;
+    tcm_dl_ack_repeat = false;
+    tcm_dl_deferred_pending = false;
+    memset(&tcm_dl_stats, 0, sizeof(tcm_dl_stats));
+    memset(&tcm_cmd_ack, 0, sizeof(tcm_cmd_ack));
+
+    if (nvm_read_tcm_dl_counter(&tcm_dl_counter) != 0) {
+        tcm_dl_counter = 0;
+    }
 
+    return 0;
 }
 
+TMM_MACHINE(80, tcm, "Tag Command", tcm_init, NULL, 0, 0);
+#endif
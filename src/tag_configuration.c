@@ -1,27 +1,347 @@
 /*
  * tag_configuration.c
  *
+ *  Batch configuration written over GATT by a provisioning station, applied at once
+ *  and restored from NVM at boot.
+ *
  */
 
+#include "stdio.h"
+#include "stdbool.h"
+#include "string.h"
+#include "em_core.h"
+
 #include "dbg_utils.h"
+#include "nvm.h"
+#include "lf_machine.h"
+#include "tag_beacon_machine.h"
+#include "ble_manager_machine.h"
+#include "tag_main_machine.h"
+#include "tag_beacon_auth.h"
+#include "tag_configuration.h"
 
 
+#if defined(TAG_GATT_PROVISIONING_PRESENT)
 //******************************************************************************
 // Defines
 //******************************************************************************
+#define TCF_FIELD(type)              (1 << (type))
 
 //******************************************************************************
 // Data types
 //******************************************************************************
+typedef struct tcf_stats_t {
+    uint32_t applied;                  /* batches stored and applied */
+    uint32_t rejected;
+    uint8_t last_status;               /* @ref tcf_status_t */
+} tcf_stats_t;
 
 //******************************************************************************
 // Global variables
 //******************************************************************************
+/** Value length by TLV type (0: unknown type) **/
+static const uint8_t tcf_tlv_len[TCF_TLV_MAX] = {
+    [TCF_TLV_BEACON_RATE]    = 4,
+    [TCF_TLV_RF_PROFILE]     = 9,
+    [TCF_TLV_LF_POLICY]      = 3,
+    [TCF_TLV_READER_ACK]     = 4,
+    [TCF_TLV_DOWNLINK]       = 4,
+    [TCF_TLV_SCAN_RSP]       = 1,
+    [TCF_TLV_EXT_ADV]        = 1,
+};
+
+static tcf_nvm_data_t tcf_cfg;                                     /* provisioned configuration (NVM copy) */
+static tcf_stats_t tcf_stats;
 
 //******************************************************************************
 // Static functions
 //******************************************************************************
+static uint16_t tcf_get_u16_le(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t tcf_get_u32_le(const uint8_t *p)
+{
+    return ((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+}
+
+/**
+ * @brief Check one TLV and store it in the configuration record (nothing is applied here)
+ * @param type
+ * @param v TLV value (length was already checked)
+ * @param c configuration record being built
+ * @param b beacon rates (Tag Beacon Machine settings)
+ * @return @ref tcf_status_t
+ */
+static tcf_status_t tcf_parse_tlv(uint8_t type, const uint8_t *v, tcf_nvm_data_t *c, tbm_nvm_data_t *b)
+{
+    tcf_rf_profile_t p;
+
+    switch (type) {
+        case TCF_TLV_BEACON_RATE:
+            b->is_erased = false;
+            b->slow_rate = tcf_get_u16_le(&v[0]);
+            b->fast_rate = tcf_get_u16_le(&v[2]);
+            if ((b->slow_rate == 0) || (b->fast_rate == 0) || (b->slow_rate == 0xFFFF) || (b->fast_rate == 0xFFFF)) {
+                return TCF_ERR_VALUE;
+            }
+            break;
+
+        case TCF_TLV_RF_PROFILE:
+            p.events = v[1];
+            p.min_interval_ms = tcf_get_u16_le(&v[2]);
+            p.max_interval_ms = tcf_get_u16_le(&v[4]);
+            p.channel_map = v[6];
+            p.tx_power = (int16_t)tcf_get_u16_le(&v[7]);
+            if (!bmm_is_adv_config_valid((bmm_rf_profile_t)v[0], p.events, p.min_interval_ms, p.max_interval_ms, p.channel_map, p.tx_power)) {
+                return TCF_ERR_VALUE;
+            }
+            c->rf_profile[v[0]] = p;
+            c->rf_profiles |= (1 << v[0]);
+            break;
+
+        case TCF_TLV_LF_POLICY:
+            c->lf_exit_field_ms = tcf_get_u16_le(&v[0]);
+            c->lf_ta_confirm_n_times = v[2];
+            if ((c->lf_exit_field_ms < LFM_EXIT_FIELD_MIN_MS) ||
+                (c->lf_exit_field_ms > LFM_EXIT_FIELD_MAX_MS) ||
+                (c->lf_ta_confirm_n_times == 0) ||
+                (c->lf_ta_confirm_n_times > LFM_TA_CONFIRM_MAX)) {
+                return TCF_ERR_VALUE;
+            }
+            break;
+
+#if defined(TAG_READER_ACK_PRESENT)
+        case TCF_TLV_READER_ACK:
+            c->ack_enabled = v[0];
+            c->ack_window_ms = tcf_get_u16_le(&v[1]);
+            c->ack_max_attempts = v[3];
+            if ((c->ack_enabled > 1) || (c->ack_window_ms < BMM_SCAN_WINDOW_MIN_MS) || (c->ack_window_ms > BMM_SCAN_WINDOW_MAX_MS)) {
+                return TCF_ERR_VALUE;
+            }
+            break;
+#endif
+
+#if defined(TAG_DOWNLINK_PRESENT)
+        case TCF_TLV_DOWNLINK:
+            c->dl_enabled = v[0];
+            c->dl_window_ms = tcf_get_u16_le(&v[1]);
+            c->dl_period = v[3];
+            if ((c->dl_enabled > 1) || (c->dl_window_ms < BMM_SCAN_WINDOW_MIN_MS) || (c->dl_window_ms > BMM_SCAN_WINDOW_MAX_MS) ||
+                (c->dl_period == 0)) {
+                return TCF_ERR_VALUE;
+            }
+            break;
+#endif
+
+#if defined(TAG_ADV_SCAN_RSP_PRESENT)
+        case TCF_TLV_SCAN_RSP:
+            c->scan_rsp = v[0];
+            if (c->scan_rsp > 1) {
+                return TCF_ERR_VALUE;
+            }
+            break;
+#endif
+
+#if defined(TAG_BLE_EXT_ADV_PRESENT)
+        case TCF_TLV_EXT_ADV:
+            c->ext_adv = v[0];
+            if (c->ext_adv > 1) {
+                return TCF_ERR_VALUE;
+            }
+            break;
+#endif
+
+        default:
+            return TCF_ERR_UNKNOWN_TLV;
+    }
+
+    c->fields |= TCF_FIELD(type);
+    return TCF_OK;
+}
+
+/**
+ * @brief Hand settings over to their machines
+ * @param c configuration record
+ * @param fields TLV types to be applied
+ * @param rf_profiles RF profiles to be applied
+ */
+static void tcf_apply(const tcf_nvm_data_t *c, uint16_t fields, uint8_t rf_profiles)
+{
+    uint8_t p;
+
+    for (p = 0; p < BMM_RF_PROFILE_MAX; p++) {
+        if (rf_profiles & (1 << p)) {
+            bmm_set_adv_config((bmm_rf_profile_t)p,
+                               c->rf_profile[p].events,
+                               c->rf_profile[p].min_interval_ms,
+                               c->rf_profile[p].max_interval_ms,
+                               c->rf_profile[p].channel_map,
+                               c->rf_profile[p].tx_power);
+        }
+    }
+
+    if (fields & TCF_FIELD(TCF_TLV_LF_POLICY)) {
+        lfm_set_policy(c->lf_exit_field_ms, c->lf_ta_confirm_n_times);
+    }
+
+#if defined(TAG_READER_ACK_PRESENT)
+    if (fields & TCF_FIELD(TCF_TLV_READER_ACK)) {
+        bmm_set_ack_config((c->ack_enabled != 0), c->ack_window_ms, c->ack_max_attempts);
+    }
+#endif
+
+#if defined(TAG_DOWNLINK_PRESENT)
+    if (fields & TCF_FIELD(TCF_TLV_DOWNLINK)) {
+        bmm_set_dl_config((c->dl_enabled != 0), c->dl_window_ms, c->dl_period);
+    }
+#endif
+
+#if defined(TAG_ADV_SCAN_RSP_PRESENT)
+    if (fields & TCF_FIELD(TCF_TLV_SCAN_RSP)) {
+        bmm_set_scan_rsp(c->scan_rsp != 0);
+    }
+#endif
+
+#if defined(TAG_BLE_EXT_ADV_PRESENT)
+    if (fields & TCF_FIELD(TCF_TLV_EXT_ADV)) {
+        bmm_set_ext_adv(c->ext_adv != 0);
+    }
+#endif
+}
 
 //******************************************************************************
 // Non Static functions
 //******************************************************************************
+/**
+ * @brief Check, store and apply a configuration batch (called from BLE Stack event handler,
+ *     main context)
+ * @details All or nothing: a bad MIC, a replayed counter or a single bad TLV rejects the
+ *     whole batch. Settings are written into NVM before they are applied, so the tag boots
+ *     with what the station was told.
+ * @param batch signed TLV settings (cmd_tag_config write request value)
+ * @param len
+ * @return @ref tcf_status_t (sent back as ATT error code)
+ */
+tcf_status_t tcf_apply_batch(const uint8_t *batch, uint16_t len)
+{
+    tcf_nvm_data_t c;
+    tbm_nvm_data_t b;
+    tcf_status_t status = TCF_OK;
+    uint16_t fields;
+    uint8_t rf_profiles;
+    uint32_t counter = 0;
+    uint16_t tlv_end = 0;
+    uint16_t i = TCF_BATCH_COUNTER_LEN;
+
+    // Batch is built on top of current configuration, masks only track this batch for now.
+    c = tcf_cfg;
+    c.fields = 0;
+    c.rf_profiles = 0;
+    memset(&b, 0, sizeof(b));
+
+    if ((len <= TCF_BATCH_OVERHEAD_LEN) || (len > TCF_BATCH_MAX_LEN)) {
+        status = TCF_ERR_LENGTH;
+    } else {
+        // Nothing is parsed before the station is authenticated.
+        counter = tcf_get_u32_le(batch);
+        tlv_end = (len - TCF_BATCH_MIC_LEN);
+        if ((tba_verify_config(batch, len) != 0) || (counter <= tcf_cfg.counter)) {
+            status = TCF_ERR_AUTH;
+        }
+    }
+
+    while ((status == TCF_OK) && (i < tlv_end)) {
+        uint8_t type;
+        uint8_t tlv_len;
+
+        if (((tlv_end - i) < TCF_TLV_HEADER_LEN) || ((tlv_end - i - TCF_TLV_HEADER_LEN) < batch[i + 1])) {
+            status = TCF_ERR_LENGTH;
+            break;
+        }
+
+        type = batch[i];
+        tlv_len = batch[i + 1];
+
+        if ((type >= TCF_TLV_MAX) || (tcf_tlv_len[type] == 0)) {
+            status = TCF_ERR_UNKNOWN_TLV;
+        } else if (tlv_len != tcf_tlv_len[type]) {
+            status = TCF_ERR_TLV_LENGTH;
+        } else {
+            status = tcf_parse_tlv(type, &batch[i + TCF_TLV_HEADER_LEN], &c, &b);
+        }
+
+        i += (TCF_TLV_HEADER_LEN + tlv_len);
+    }
+
+    if (status == TCF_OK) {
+        fields = c.fields;
+        rf_profiles = c.rf_profiles;
+        c.fields |= tcf_cfg.fields;
+        c.rf_profiles |= tcf_cfg.rf_profiles;
+        c.counter = counter;
+
+        // Beacon rates keep their own NVM object (also written by CLI and downlink commands).
+        if (nvm_write_tag_configuration(&c, ((fields & TCF_FIELD(TCF_TLV_BEACON_RATE)) ? &b : NULL)) != 0) {
+            status = TCF_ERR_NVM;
+        }
+    }
+
+    tcf_stats.last_status = (uint8_t)status;
+
+    if (status != TCF_OK) {
+        tcf_stats.rejected++;
+        DEBUG_LOG(DBG_CAT_WARNING, "Tag configuration rejected (0x%.2X at byte %d)...", status, i);
+        return status;
+    }
+
+    tcf_cfg = c;
+
+    // Settings reach the machines between two Tag Main Machine ticks.
+    CORE_DECLARE_IRQ_STATE;
+    CORE_ENTER_ATOMIC();
+    if (fields & TCF_FIELD(TCF_TLV_BEACON_RATE)) {
+        tbm_apply_new_settings(&b);
+    }
+    tcf_apply(&tcf_cfg, fields, rf_profiles);
+    CORE_EXIT_ATOMIC();
+    tmm_wakeup();
+
+    tcf_stats.applied++;
+    DEBUG_LOG(DBG_CAT_BLE, "Tag configuration applied (%d bytes, fields 0x%.4X)", len, fields);
+
+    return TCF_OK;
+}
+
+//! @brief Print provisioning statistics (CLI)
+void tcf_print_stats(void)
+{
+    printf("\n  Tag configuration:    applied %lu, rejected %lu (last status 0x%.2X, fields 0x%.4X, counter %lu)",
+           tcf_stats.applied,
+           tcf_stats.rejected,
+           tcf_stats.last_status,
+           tcf_cfg.fields,
+           tcf_cfg.counter);
+}
+
+/**
+ * @brief Restore provisioned configuration (called once all machines are initialized)
+ * @return 0
+ */
+uint32_t tcf_init(void)
+{
+    memset(&tcf_stats, 0, sizeof(tcf_stats));
+
+    if (nvm_read_tag_configuration(&tcf_cfg) != 0) {
+        memset(&tcf_cfg, 0, sizeof(tcf_cfg));
+        return 0;
+    }
+
+    tcf_apply(&tcf_cfg, tcf_cfg.fields, tcf_cfg.rf_profiles);
+
+    return 0;
+}
+
+TMM_MACHINE(90, tcf, "Tag Configuration", tcf_init, NULL, 0, 0);
+#endif
@@ -6,10 +6,14 @@
  * runs every TMM_RTCC_TIMER_PERIOD_MS millisecond based on RTCC timer.
  * It is cooperative multitasking which means every Machine called is responsible
  * to yield back to the main machine super loop.
+ *
+ * In tickless mode (TAG_TICKLESS_PRESENT) it only runs when the earliest machine
+ * deadline is due, or earlier when an asynchronous source calls tmm_wakeup().
  */
 
 #include "stdio.h"
 #include "stdbool.h"
+#include "string.h"
 
 #include "em_common.h"
 #include "em_cmu.h"
@@ -27,28 +31,90 @@
 #include "wdog.h"
 #include "lf_machine.h"
 #include "tag_beacon_machine.h"
-#include "temperature_machine.h"
-#include "battery_machine.h"
-#include "tag_uptime_machine.h"
 #include "ble_manager_machine.h"
 #include "tag_main_machine.h"
-#include "tag_status_fw_machine.h"
+#include "tag_retained_state.h"
+#if defined(TAG_DOWNLINK_PRESENT)
+#include "tag_command.h"
+#endif
 
 
 //******************************************************************************
 // Defines
 //******************************************************************************
+#if defined(TAG_PROFILER_PRESENT)
+//! @brief Run a machine and account its DWT cycles (nested machines are included in their parent)
+#define TMM_PROFILE_STATS(p, call)   do {                                                   \
+                                         uint32_t prof_start = DWT->CYCCNT;                 \
+                                         call;                                              \
+                                         tmm_prof_update((p), (DWT->CYCCNT - prof_start));  \
+                                     } while (0)
+#define TMM_PROFILE(id, call)        TMM_PROFILE_STATS(&tmm_prof_stats[(id)], call)
+#else
+#define TMM_PROFILE_STATS(p, call)   call
+#define TMM_PROFILE(id, call)        call
+#endif
+
+/** Tag Main Machine registry (linker script) **/
+#define TMM_MACHINES_COUNT           ((uint32_t)(__tmm_machines_end__ - __tmm_machines_start__))
 
 //******************************************************************************
 // Data types
 //******************************************************************************
+#if defined(TAG_PROFILER_PRESENT)
+typedef enum tmm_prof_id_t {
+    TMM_PROF_RUN,                     /* whole Tag Main Machine run */
+    TMM_PROF_LF,
+    TMM_PROF_TIMERS,
+    TMM_PROF_SLOW_TASKS,               /* registered slow tasks are listed right after */
+    TMM_PROF_TAG_COMMAND,
+    TMM_PROF_BEACON,
+    TMM_PROF_BLE_MANAGER,
+    TMM_PROF_MAX
+} tmm_prof_id_t;
+
+typedef struct tmm_prof_stats_t {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;                   /* cycles */
+} tmm_prof_stats_t;
+#endif
+
+//! @brief Registered machine run state
+typedef struct tmm_machine_state_t {
+    uint32_t due;                     /* next tick on machine phase */
+    uint32_t last_tick;               /* tick of previous run */
+    uint32_t sec_ticks;               /* ticks not accounted in seconds yet */
+#if defined(TAG_PROFILER_PRESENT)
+    tmm_prof_stats_t prof;
+#endif
+} tmm_machine_state_t;
 
 //******************************************************************************
 // Global shared variables
 //******************************************************************************
 static volatile tmm_modes_t tmm_current_mode;
 static volatile tmm_modes_t tmm_stored_mode;
-static tag_sw_timer_t tmm_slow_timer;
+static uint32_t tmm_tick;                          /* ticks since Tag Main Machine start */
+static uint32_t tmm_tick_rtcc;                     /* RTCC counter value at tmm_tick */
+static uint32_t tmm_elapsed_sec;                   /* whole seconds elapsed since running slow task previous run */
+static bool tmm_started;
+extern const tmm_machine_t __tmm_machines_start__[];
+extern const tmm_machine_t __tmm_machines_end__[];
+static tmm_machine_state_t tmm_machine_state[TMM_MACHINES_MAX];
+#if defined(TAG_PROFILER_PRESENT)
+static tmm_prof_stats_t tmm_prof_stats[TMM_PROF_MAX];
+static const char *tmm_prof_name[TMM_PROF_MAX] = {
+    [TMM_PROF_RUN]           = "Tag Main Machine",
+    [TMM_PROF_LF]            = "  LF",
+    [TMM_PROF_TIMERS]        = "  SW Timers",
+    [TMM_PROF_SLOW_TASKS]    = "  Slow Tasks",
+    [TMM_PROF_TAG_COMMAND]   = "  Tag Command",
+    [TMM_PROF_BEACON]        = "  Tag Beacon",
+    [TMM_PROF_BLE_MANAGER]   = "  BLE Manager",
+};
+#endif
 
 //******************************************************************************
 // Static functions
@@ -62,63 +128,203 @@ static void tmm_set_mode(tmm_modes_t state)
     tmm_current_mode = state;
 }
 
+#if defined(TAG_PROFILER_PRESENT)
+static void tmm_prof_update(tmm_prof_stats_t *p, uint32_t cycles)
+{
+    if (cycles < p->min) {
+        p->min = cycles;
+    }
+    if (cycles > p->max) {
+        p->max = cycles;
+    }
+    p->total += cycles;
+    p->count++;
+}
+
+static void tmm_prof_reset(tmm_prof_stats_t *p)
+{
+    p->count = 0;
+    p->min = UINT32_MAX;
+    p->max = 0;
+    p->total = 0;
+}
+
+static void tmm_prof_print_line(const char *indent, const char *name, const tmm_prof_stats_t *p, uint64_t run_total)
+{
+    int width = (22 - (int)strlen(indent));
+
+    if (p->count == 0) {
+        printf("\n  %s%-*s %10s", indent, width, name, "-");
+        return;
+    }
+    printf("\n  %s%-*s %10lu %10lu %10lu %10lu %5lu%%",
+           indent,
+           width,
+           name,
+           p->count,
+           p->min,
+           (uint32_t)(p->total / p->count),
+           p->max,
+           (uint32_t)((run_total != 0) ? ((p->total * 100) / run_total) : 0));
+}
+#endif
+
+/**
+ *  @brief Advance Tag Main Machine time by the whole ticks elapsed since previous run
+ *  @details A run brought forward by @ref tmm_wakeup may see 0 elapsed ticks.
+ *  @return elapsed ticks
+ */
+static uint32_t tmm_update_time(void)
+{
+    uint32_t elapsed = (RTCC_CounterGet() - tmm_tick_rtcc) / TMM_RTCC_TIMER_RELOAD;
+
+    tmm_tick_rtcc += (elapsed * TMM_RTCC_TIMER_RELOAD);
+    tmm_tick += elapsed;
+
+    return elapsed;
+}
+
+//! @brief First tick after 'tick' on machine phase
+static uint32_t tmm_machine_next_due(const tmm_machine_t *m, uint32_t tick)
+{
+    return (tick + m->period - ((tick + m->period - m->phase) % m->period));
+}
+
+#if defined(TAG_TICKLESS_PRESENT)
+//! @brief A slow task missed its phase tick and still has to run
+static bool tmm_slow_task_is_overdue(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < TMM_MACHINES_COUNT; i++) {
+        if ((__tmm_machines_start__[i].run != NULL) && !TAG_SW_TIMER_IS_BEFORE(tmm_tick, tmm_machine_state[i].due)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+#endif
+
 //! @brief Reload Tag Main Machine RTCC compare
 static void tmm_rtcc_update(void)
 {
-    // Update Tag Main Machine RTCC CC1 value (for next tick)
-    uint32_t timer_offset = ((uint32_t)TMM_RTCC_TIMER_RELOAD) + RTCC_CounterGet();
+    uint32_t next_tick = tmm_tick + 1;
+    uint32_t timer_offset;
+#if defined(TAG_HFXO_PREWARM_PRESENT)
+    uint32_t beacon_tick;
+#endif
+
+#if defined(TAG_TICKLESS_PRESENT)
+    uint32_t deadline;
+
+    // BLE Manager polls its queues and advertising state every tick, otherwise we only
+    // need to run once the earliest machine deadline is due.
+    if ((tmm_get_mode() == TMM_RUNNING) && bmm_is_idle()) {
+        next_tick = tmm_tick + TMM_TICKLESS_MAX_SLEEP_TICKS;
+        if (tag_sw_timer_get_next_deadline(&deadline) && TAG_SW_TIMER_IS_BEFORE(deadline, next_tick)) {
+            next_tick = deadline;
+        }
+        // Slow tasks left behind by a catch-up run one per tick.
+        if (!TAG_SW_TIMER_IS_BEFORE(tmm_tick, next_tick) || tmm_slow_task_is_overdue()) {
+            next_tick = tmm_tick + 1;
+        }
+    }
+#endif
+
+    // Update Tag Main Machine RTCC CC1 value (for next tick), ticks stay on the same grid.
+    timer_offset = tmm_tick_rtcc + ((next_tick - tmm_tick) * TMM_RTCC_TIMER_RELOAD);
+
+    // This run took longer than a tick, do not program a compare value in the past.
+    if ((int32_t)(timer_offset - RTCC_CounterGet()) < TMM_RTCC_MIN_OFFSET) {
+        timer_offset = RTCC_CounterGet() + TMM_RTCC_TIMER_RELOAD;
+    }
+
     RTCC_ChannelCompareValueSet(TMM_RTCC_CC1, timer_offset);
+
+#if defined(TAG_HFXO_PREWARM_PRESENT)
+    // Pre-warm this run did not use is dropped. Next run sends a sync beacon, have HFXO ready
+    // when BLE Manager asks for it.
+    tpm_hfxo_prewarm_release();
+    if ((tmm_get_mode() == TMM_RUNNING) && !bmm_adv_running
+            && tbm_get_sync_beacon_tick(&beacon_tick) && (beacon_tick == next_tick)) {
+        tpm_hfxo_prewarm_schedule(timer_offset);
+    }
+#endif
 }
 
 /**
  *  @brief Tag Main Machine (Slow Tasks)
- *  @details Add here tasks that can run less periodically (on seconds base)
- *  @note Tick period is defined in @ref TMM_DEFAULT_SLOW_TIMER_RELOAD
+ *  @details Registered slow tasks run once per period, each one in its own phase tick, so
+ *      their work is spread over ticks. They act when their own timers expire and
+ *      @ref tmm_get_elapsed_sec tells them how many seconds went by since their previous run.
+ *      At most one slow task runs per tick. Those whose phase tick was slept over (tickless)
+ *      run on the following ticks, most overdue first.
  */
 static void tmm_slow_tasks_run(void)
 {
-    tag_sw_timer_tick(&tmm_slow_timer);
-
-    if (tag_sw_timer_is_expired(&tmm_slow_timer)) {
-
-        // Reload Slow Task Timer
-        tag_sw_timer_reload(&tmm_slow_timer, TMM_SLOW_TASK_TIMER_RELOAD);
-
-        //**********************************************************************
-        // Add below all slow tasks (tick at tmm_slow_timer)
-        //**********************************************************************
+    const tmm_machine_t *m;
+    tmm_machine_state_t *s;
+    uint32_t next = TMM_MACHINES_COUNT;
+    uint32_t i;
+
+    for (i = 0; i < TMM_MACHINES_COUNT; i++) {
+        if ((__tmm_machines_start__[i].run == NULL) || TAG_SW_TIMER_IS_BEFORE(tmm_tick, tmm_machine_state[i].due)) {
+            continue;
+        }
+        if ((next == TMM_MACHINES_COUNT) || TAG_SW_TIMER_IS_BEFORE(tmm_machine_state[i].due, tmm_machine_state[next].due)) {
+            next = i;
+        }
+    }
 
-        // Battery Machine Process
-        //battery_machine_run();
+    if (next == TMM_MACHINES_COUNT) {
+        return;
+    }
 
-        // Tag Firmware Revision Process
-        tag_firmware_rev_run();
+    m = &__tmm_machines_start__[next];
+    s = &tmm_machine_state[next];
 
-        // Tag Uptime Machine Process
-        tag_uptime_run();
+    s->sec_ticks += (tmm_tick - s->last_tick);
+    s->last_tick = tmm_tick;
+    s->due = tmm_machine_next_due(m, tmm_tick);
 
-        // Temperature Machine Process
-        temperature_run();
+    tmm_elapsed_sec = (s->sec_ticks / TMM_TICKS_PER_SEC);
+    s->sec_ticks %= TMM_TICKS_PER_SEC;
 
-        // Tag Extended Status Machine Process
-        tag_extended_status_run();
-    }
+    TMM_PROFILE_STATS(&s->prof, m->run());
 }
 
-//! @brief It calls all the tag machines "init" routines.
+/**
+ * @brief Call registered machines "init" routines (in TMM_MACHINE() order) and schedule
+ *     slow tasks from tick 0
+ * @return 0 if all machines were initialized.
+ */
 static uint32_t tmm_init_machines(void)
 {
+    const tmm_machine_t *m;
     uint32_t status = 0;
+    uint32_t i;
 
-#if TAG_ID == UT3_ID
-    lfm_init();      // LF Machine
-    ttm_init();      // Tag Temp Machine
-    tsm_init();      // Tag Status Machine
-    tbm_init();      // Tag Beacon Machine
-    bmm_init();      // BLE Manager Machine
-    tum_init();      // Tag Uptime Machine
-    //btm_init();    // Battery Machine
-#endif
+    if (TMM_MACHINES_COUNT > TMM_MACHINES_MAX) {
+        DEBUG_LOG(DBG_CAT_TAG_MAIN, "Error %lu machines registered (max %d)", TMM_MACHINES_COUNT, TMM_MACHINES_MAX);
+        DEBUG_TRAP();
+        return 1;
+    }
+
+    memset(tmm_machine_state, 0, sizeof(tmm_machine_state));
+
+    for (i = 0; i < TMM_MACHINES_COUNT; i++) {
+        m = &__tmm_machines_start__[i];
+
+        if ((m->init != NULL) && (m->init() != 0)) {
+            DEBUG_LOG(DBG_CAT_WARNING, "%s init failed...", m->name);
+            status = 1;
+        }
+
+        if (m->run != NULL) {
+            tmm_machine_state[i].due = tmm_machine_next_due(m, 0);
+        }
+    }
 
     return status;
 }
@@ -133,9 +339,6 @@ static void tmm_init(tmm_modes_t mode)
     tmm_set_mode(mode);
     tmm_init_machines();
 
-    // Initiate sw timer for slow tasks
-    tag_sw_timer_reload(&tmm_slow_timer, TMM_SLOW_TASK_TIMER_RELOAD);
-
     // Setup RTCC CC1 Channel for Tag Main Machine SysTick
     RTCC_CCChConf_TypeDef cc1_cfg = RTCC_CH_INIT_COMPARE_DEFAULT;
     cc1_cfg.chMode = rtccCapComChModeCompare;
@@ -145,52 +348,145 @@ static void tmm_init(tmm_modes_t mode)
     cc1_cfg.compBase = rtccCompBaseCnt;
     RTCC_ChannelInit(TMM_RTCC_CC1, &cc1_cfg);
 
+#if defined(TAG_PROFILER_PRESENT)
+    // DWT cycle counter for machines profiling
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    tmm_prof_reset_stats();
+#endif
+
+    // Initiate Tag Main Machine time (machines timers were reloaded at tick 0)
+    tmm_tick = 0;
+    tmm_elapsed_sec = 0;
+    tmm_tick_rtcc = RTCC_CounterGet();
+
     // Initiate RTCC CC1 Compare value
-    uint32_t timer_offset = ((uint32_t)TMM_RTCC_TIMER_RELOAD) + RTCC_CounterGet();
-    RTCC_ChannelCompareValueSet(TMM_RTCC_CC1, timer_offset);
+    RTCC_ChannelCompareValueSet(TMM_RTCC_CC1, (tmm_tick_rtcc + TMM_RTCC_TIMER_RELOAD));
+
+    // Deferred context for machines. Sleeptimer (BURTC) keeps its SDK priority, data shared with
+    // its callbacks (CLI, BLE Manager timers) is accessed in CORE atomic sections.
+    NVIC_SetPriority(TMM_SW_IRQn, TMM_SW_IRQ_PRIORITY);
+    NVIC_ClearPendingIRQ(TMM_SW_IRQn);
+    NVIC_EnableIRQ(TMM_SW_IRQn);
 
     // Enable NVIC and RTCC CC1 Interrupt
     RTCC_IntClear(RTCC_IEN_CC1);
     RTCC_IntEnable(RTCC_IEN_CC1);
     NVIC_ClearPendingIRQ(RTCC_IRQn);
     NVIC_EnableIRQ(RTCC_IRQn);
+
+    tmm_started = true;
 }
 
 //******************************************************************************
 // Non Static functions (Interface)
 //******************************************************************************
-/*!  @brief Tag Main Machine running on RTCC CC Channel 1
- *   @details Tag Main Machine "super loop" entry point. This routine will be called on RTCC
- *       CC1 compare interrupt to process all the synchronous(FW) and asynchronous(HW)
+/*!  @brief Tag Main Machine tick on RTCC CC Channel 1 (RTCC ISR context)
+ *   @details Only posts the run to @ref TMM_SW_IRQn, so RTCC interrupt stays short and
+ *       LF decoder captures (RTCC CC0) are serviced while machines are running.
+ */
+void tag_main_machine_isr(void)
+{
+    NVIC_SetPendingIRQ(TMM_SW_IRQn);
+}
+
+#if defined(TAG_PROFILER_PRESENT)
+/**
+ * @brief Print machines execution time (CLI)
+ * @details DWT cycle counter only runs while the core is clocked, so this is CPU time. LF
+ *     decoder and BLE Stack interrupts preempting a machine are accounted to it.
+ */
+void tmm_prof_print_stats(void)
+{
+    uint64_t run_total = tmm_prof_stats[TMM_PROF_RUN].total;
+    uint32_t i;
+    uint32_t j;
+
+    printf("\n  Core clock: %lu Hz", SystemCoreClockGet());
+    printf("\n  %-22s %10s %10s %10s %10s %6s", "Machine (cycles)", "count", "min", "avg", "max", "share");
+
+    for (i = 0; i < TMM_PROF_MAX; i++) {
+        tmm_prof_print_line("", tmm_prof_name[i], &tmm_prof_stats[i], run_total);
+
+        if (i == TMM_PROF_SLOW_TASKS) {
+            for (j = 0; j < TMM_MACHINES_COUNT; j++) {
+                if (__tmm_machines_start__[j].run != NULL) {
+                    tmm_prof_print_line("    ", __tmm_machines_start__[j].name, &tmm_machine_state[j].prof, run_total);
+                }
+            }
+        }
+    }
+}
+
+void tmm_prof_reset_stats(void)
+{
+    uint32_t i;
+
+    CORE_DECLARE_IRQ_STATE;
+    CORE_ENTER_ATOMIC();
+    for (i = 0; i < TMM_PROF_MAX; i++) {
+        tmm_prof_reset(&tmm_prof_stats[i]);
+    }
+    for (i = 0; i < TMM_MACHINES_MAX; i++) {
+        tmm_prof_reset(&tmm_machine_state[i].prof);
+    }
+    CORE_EXIT_ATOMIC();
+}
+#endif
+
+/*!  @brief Tag Main Machine running on software pended TMM_SW_IRQn
+ *   @details Tag Main Machine "super loop" entry point. This routine will be called after
+ *       RTCC CC1 compare interrupt to process all the synchronous(FW) and asynchronous(HW)
  *       events. Each tag feature should have its own machine "task" that will be called
  *       within this ISRs context. The main tick period is defined at @ref
  *       TMM_RTCC_TIMER_PERIOD_MS.
  *
  *   @note Concept of "task" here is not the same as an RTOS so make sure each call
- *       runs efficiently and fair sharing cpu time.
+ *       runs efficiently and fair sharing cpu time. It runs with interrupts enabled at
+ *       @ref TMM_SW_IRQ_PRIORITY, data shared with other ISRs (LF decoder, BLE
+ *       Stack, sleeptimer callbacks such as CLI) still needs CORE atomic sections.
  *
 *******************************************************************************/
-void tag_main_machine_isr(void)
+void TMM_SW_IRQHandler(void)
 {
+#if defined(TAG_PROFILER_PRESENT)
+    uint32_t prof_run_start = DWT->CYCCNT;
+#endif
+
+    NVIC_ClearPendingIRQ(TMM_SW_IRQn);
 
     tmm_modes_t mode = tmm_get_mode();
 
+    // Machines timers are absolute deadlines, bring time up to date first.
+    tmm_update_time();
+
     switch(mode)
     {
         case TMM_RUNNING:
 
-            lf_run();
-            tmm_slow_tasks_run();
+            // Expire due sw timers (periodic reports are sent from their callbacks)
+            TMM_PROFILE(TMM_PROF_TIMERS, tag_sw_timer_process(tmm_tick));
+
+            TMM_PROFILE(TMM_PROF_LF, lf_run());
+            TMM_PROFILE(TMM_PROF_SLOW_TASKS, tmm_slow_tasks_run());
+#if defined(TAG_DOWNLINK_PRESENT)
+            // Execute downlink commands (their ack is dispatched right below)
+            TMM_PROFILE(TMM_PROF_TAG_COMMAND, tcm_run());
+#endif
 
             //------------------------------------------------------------------
             // Keep below calls together in this order.
             //------------------------------------------------------------------
             // Check for all Beacon Events and dispatch messages to BLE Manager Queue
-            tag_beacon_run();
+            TMM_PROFILE(TMM_PROF_BEACON, tag_beacon_run());
             // Build packet and transmit BLE Advertising Beacons
-            ble_manager_run();
+            TMM_PROFILE(TMM_PROF_BLE_MANAGER, ble_manager_run());
             //printf("\nHFXO %s", ((SystemSYSCLKGet() == 38400000UL) ? "True" : "False"));
             //printf("\nbmm_adv_running = %s", (bmm_adv_running ? "True" : "False"));
+#if defined(TAG_RETAINED_STATE_PRESENT)
+            // Snapshot state for a warm reset (restored by tag_init)
+            trs_save();
+#endif
             break;
 
         case TMM_PAUSED:
@@ -218,6 +514,9 @@ void tag_main_machine_isr(void)
     WDOGn_Feed(WDOG0);
 #endif
 
+#if defined(TAG_PROFILER_PRESENT)
+    tmm_prof_update(&tmm_prof_stats[TMM_PROF_RUN], (DWT->CYCCNT - prof_run_start));
+#endif
 }
 
 tmm_modes_t tmm_get_mode(void)
@@ -251,7 +550,29 @@ uint32_t tmm_get_tick_period_ms(void)
     return (uint32_t)TMM_RTCC_TIMER_PERIOD_MS;
 }
 
-uint32_t tmm_get_slow_tick_period(void)
+//! @brief Current Tag Main Machine time (ticks of TMM_RTCC_TIMER_PERIOD_MS)
+uint32_t tmm_get_tick(void)
 {
-    return (uint32_t)TMM_SLOW_TASK_TIMER_PERIOD_MS;
+    return tmm_tick;
+}
+
+//! @brief Whole seconds elapsed since previous run of the running slow task
+uint32_t tmm_get_elapsed_sec(void)
+{
+    return tmm_elapsed_sec;
+}
+
+/**
+ * @brief Bring next Tag Main Machine run forward (safe to call from any context)
+ * @details Used by asynchronous sources (LF decoder, CLI, BLE Stack events) whose
+ *     data is processed by a machine. It does nothing unless tickless mode is enabled.
+ */
+void tmm_wakeup(void)
+{
+#if defined(TAG_TICKLESS_PRESENT)
+    // A run already in progress runs again once it is over (pending bit is cleared on entry).
+    if (tmm_started) {
+        NVIC_SetPendingIRQ(TMM_SW_IRQn);
+    }
+#endif
 }
@@ -5,18 +5,30 @@
 
 
 #include "em_common.h"
+#include "em_core.h"
+#include "em_cmu.h"
+#include "em_emu.h"
+#include "em_gpio.h"
 #include "stdio.h"
 #include "stdbool.h"
+#include "string.h"
 #include "sl_power_manager.h"
 #include "sl_sleeptimer.h"
+#include "sl_hfxo_manager.h"
 #include "rail.h"
 
 #include "dbg_utils.h"
 #include "lf_decoder.h"
 #include "em_rtcc.h"
 #include "cli.h"
+#include "tag_main_machine.h"
 #include "tag_power_manager.h"
 #include "tag_gpio_mapping.h"
+#if defined(TAG_SHELF_MODE_PRESENT)
+#include "boot.h"
+#include "nvm.h"
+#include "energy_budget_machine.h"
+#endif
 
 
 //******************************************************************************
@@ -28,16 +40,63 @@
 // RFSENSE Sync Word Value.
 #define SYNC_WORD         (0xB16FU)
 
+#if defined(TAG_POWER_STATS_PRESENT)
+#define TPM_EM_MAX                   (3)                /* EM0, EM1, EM2 */
+#define TPM_RTCC_FREQ_HZ             (32768)
+#endif
+
 //******************************************************************************
 // Data types
 //******************************************************************************
+#if defined(TAG_POWER_STATS_PRESENT)
+typedef struct tpm_power_stats_t {
+    uint64_t em_time[TPM_EM_MAX];     /* RTCC counts */
+    uint32_t wakeups[TPM_WAKE_MAX];
+} tpm_power_stats_t;
+#endif
 
 //******************************************************************************
 // Global variables
 //******************************************************************************
-RAIL_Handle_t railHandle;
+RAIL_Handle_t railHandle = RAIL_EFR32_HANDLE;           /* RFSENSE only needs the generic handle */
 static sl_sleeptimer_timer_handle_t tpm_sleeptimer;
 volatile bool sleep_on_isr_exit;
+#if defined(TAG_POWER_STATS_PRESENT)
+static tpm_power_stats_t tpm_power_stats;
+static tpm_power_stats_t tpm_power_stats_report;               /* snapshot at previous telemetry */
+static sl_power_manager_em_t tpm_current_em;
+static uint32_t tpm_em_stamp;                                  /* RTCC counter at tpm_current_em entry */
+static bool tpm_power_stats_started;
+#endif
+#if defined(TAG_SHELF_MODE_PRESENT)
+static bool tpm_fast_resume;                                   /* woken up from shelf mode by an activation */
+#endif
+#if defined(TAG_HFXO_PREWARM_PRESENT)
+static volatile bool tpm_hfxo_prewarmed;                       /* HFXO started ahead, EM1 requirement held until consumed */
+static uint32_t tpm_hfxo_prewarm_count;
+static uint32_t tpm_hfxo_prewarm_used;                         /* crystal was ready when an advertising request came */
+static uint32_t tpm_hfxo_prewarm_late;                         /* advertising request came before crystal was ready */
+#endif
+#if defined(TAG_POWER_STATS_PRESENT)
+static sl_power_manager_em_transition_event_handle_t tpm_em1_event_handle;
+static void tpm_on_em1_transition(sl_power_manager_em_t from, sl_power_manager_em_t to);
+static const sl_power_manager_em_transition_event_info_t tpm_em1_event_info = {
+    .event_mask = (SL_POWER_MANAGER_EVENT_TRANSITION_ENTERING_EM1 | SL_POWER_MANAGER_EVENT_TRANSITION_LEAVING_EM1),
+    .on_event = tpm_on_em1_transition
+};
+/** Radio interrupts (BLE Stack link layer) **/
+static const IRQn_Type tpm_radio_irqs[] = {
+    PROTIMER_IRQn, RAC_SEQ_IRQn, RAC_RSM_IRQn, BUFC_IRQn, FRC_IRQn, FRC_PRI_IRQn, MODEM_IRQn, AGC_IRQn, SYNTH_IRQn
+};
+static const char *tpm_wake_src_name[TPM_WAKE_MAX] = {
+    [TPM_WAKE_LF]            = "LF (RTCC CC0)",
+    [TPM_WAKE_TICK]          = "TMM tick (RTCC CC1)",
+    [TPM_WAKE_BLE]           = "BLE Stack (radio)",
+    [TPM_WAKE_SLEEPTIMER]    = "Sleeptimer (BURTC)",
+    [TPM_WAKE_UART]          = "CLI (UART)",
+    [TPM_WAKE_OTHER]         = "Other",
+};
+#endif
 
 // Configure the receiving node (EFR32XG22) for RF Sense.
 RAIL_RfSenseSelectiveOokConfig_t config = {
@@ -58,12 +117,91 @@ static void tpm_delay_system_reset(sl_sleeptimer_timer_handle_t *handle, void *d
     NVIC_SystemReset();
 }
 
+#if defined(TAG_POWER_STATS_PRESENT)
+/**
+ * @brief Close current energy mode period (interrupts must be masked)
+ * @param em energy mode entered now
+ */
+static void tpm_em_account(sl_power_manager_em_t em)
+{
+    uint32_t now = RTCC_CounterGet();
+
+    tpm_power_stats.em_time[tpm_current_em] += (uint32_t)(now - tpm_em_stamp);
+    tpm_em_stamp = now;
+    tpm_current_em = em;
+}
+
+/**
+ * @brief Find what woke the core up
+ * @details Called right after wake-up with interrupts still masked by Power Manager, so the
+ *     source is still pending. First match wins when several sources are pending.
+ */
+static tpm_wake_src_t tpm_get_wake_source(void)
+{
+    uint32_t i;
+
+    if (NVIC_GetPendingIRQ(RTCC_IRQn)) {
+        uint32_t flags = RTCC_IntGetEnabled();
+        if (flags & RTCC_IF_CC0) {
+            return TPM_WAKE_LF;
+        }
+        if (flags & RTCC_IF_CC1) {
+            return TPM_WAKE_TICK;
+        }
+    }
+
+    for (i = 0; i < (sizeof(tpm_radio_irqs) / sizeof(tpm_radio_irqs[0])); i++) {
+        if (NVIC_GetPendingIRQ(tpm_radio_irqs[i])) {
+            return TPM_WAKE_BLE;
+        }
+    }
+
+    if (NVIC_GetPendingIRQ(BURTC_IRQn)) {
+        return TPM_WAKE_SLEEPTIMER;
+    }
+
+    // CLI iostream instance (SL_IOSTREAM_USART_UART_DEBUG_PERIPHERAL)
+    if (NVIC_GetPendingIRQ(USART1_RX_IRQn)) {
+        return TPM_WAKE_UART;
+    }
+
+    return TPM_WAKE_OTHER;
+}
+
+//! @brief Back in EM0 (interrupts must be masked)
+static void tpm_on_wakeup(void)
+{
+    tpm_em_account(SL_POWER_MANAGER_EM0);
+    tpm_power_stats.wakeups[tpm_get_wake_source()]++;
+}
+
+//! @brief EM1 residency (EM2 is accounted by EFP EM23 hooks)
+static void tpm_on_em1_transition(sl_power_manager_em_t from, sl_power_manager_em_t to)
+{
+    if (to == SL_POWER_MANAGER_EM1) {
+        tpm_em_account(SL_POWER_MANAGER_EM1);
+    } else if (from == SL_POWER_MANAGER_EM1) {
+        tpm_on_wakeup();
+    }
+}
+
+//! @brief Copy power stats with current energy mode period closed
+static void tpm_get_power_stats(tpm_power_stats_t *s)
+{
+    CORE_DECLARE_IRQ_STATE;
+    CORE_ENTER_ATOMIC();
+    tpm_em_account(tpm_current_em);
+    *s = tpm_power_stats;
+    CORE_EXIT_ATOMIC();
+}
+#endif
+
 //******************************************************************************
 // Non Static functions
 //******************************************************************************
 void tag_check_wakeup_from_deep_sleep(void)
 {
-    if(RAIL_IsRfSensed(&railHandle)) {
+    if(RAIL_IsRfSensed(railHandle)) {
         DEBUG_LOG(DBG_CAT_SYSTEM, "Waking up from Deep Sleep (EM4) by RFSENSE...");
     }
 
@@ -71,33 +209,317 @@ void tag_check_wakeup_from_deep_sleep(void)
     // or not..
 }
 
+/**
+ * @brief Enter deep sleep (EM4), only RFSENSE (and AS393x WAKE if routed to an EM4 wake-up pin)
+ *     bring the tag back, through a reset.
+ * @details With TAG_SHELF_MODE_PRESENT energy accounting and shelf flag are kept in BURAM
+ *     (see @ref tpm_shelf_check). Does not return.
+ */
 void tag_enter_deep_sleep(void)
 {
-    RAIL_StartSelectiveOokRfSense(railHandle, &config);
-    sl_power_manager_remove_em_requirement(SL_POWER_MANAGER_EM2);
-    sl_power_manager_add_em_requirement(SL_POWER_MANAGER_EM4);
+    EMU_EM4Init_TypeDef em4_init = EMU_EM4INIT_DEFAULT;
+
     cli_stop();
+    lf_decoder_enable(false);
+    RTCC_Enable(false);
+
+#if defined(TAG_GPIO_AS39_LF_WAKEUP_EM4WU)
+    // AS393x keeps listening, its WAKE pin ends shelf mode (LF activation).
+    as39_antenna_enable(true, false, false);
+    GPIO_EM4EnablePinWakeup(TAG_GPIO_AS39_LF_WAKEUP_EM4WU, TAG_GPIO_AS39_LF_WAKEUP_EM4WU);
+#endif
+
+#if defined(TAG_SHELF_MODE_PRESENT)
+    CMU_ClockEnable(cmuClock_BURAM, true);
+    ebm_retained_save(&BURAM->RET[TPM_BURAM_EBM_REG].REG);
+    BURAM->RET[TPM_BURAM_SHELF_REG].REG = TPM_SHELF_MAGIC;
+#endif
+
+    // Keep GPIO (AS393x SPI chip select, antenna) as they are until wake-up.
+    em4_init.pinRetentionMode = emuPinRetentionLatch;
+    EMU_EM4Init(&em4_init);
+
+    RAIL_StartSelectiveOokRfSense(railHandle, &config);
+
     while(1) {
         EMU_EnterEM4();
     }
 }
 
+#if defined(TAG_SHELF_MODE_PRESENT)
+/**
+ * @brief Shelf mode check, first thing in tag_init (NVM is ready, UART is not)
+ * @details A shelved tag only resumes when RFSENSE or LF activation woke it up. Any other
+ *     reset (battery swap, reset pin, spurious wake-up) sends it back to EM4 before the
+ *     radio or AS393x are touched, except in manufacturing boot mode. GPIO stay latched
+ *     (see @ref tag_enter_deep_sleep) until the tag is known to resume.
+ * @return true if tag resumes from shelf mode (fast resume path, see @ref tpm_is_fast_resume).
+ */
+bool tpm_shelf_check(void)
+{
+    uint8_t op_mode = TPM_OP_MODE_ACTIVE;
+    bool from_em4;
+    bool activated;
+
+    CMU_ClockEnable(cmuClock_BURAM, true);
+
+    // BURAM flag tells an EM4 wake-up from shelf mode, NVM tells a shelved tag after a POR.
+    from_em4 = ((boot_get_reset_cause() & EMU_RSTCAUSE_EM4) && (BURAM->RET[TPM_BURAM_SHELF_REG].REG == TPM_SHELF_MAGIC));
+    if (!from_em4 && ((nvm_read_tag_op_mode(&op_mode) != 0) || (op_mode != TPM_OP_MODE_SHELF))) {
+        EMU_UnlatchPinRetention();
+        return false;
+    }
+
+    activated = (from_em4 && RAIL_IsRfSensed(railHandle));
+#if defined(TAG_GPIO_AS39_LF_WAKEUP_EM4WU)
+    activated |= (from_em4 && ((GPIO_IntGet() & TAG_GPIO_AS39_LF_WAKEUP_EM4WU) != 0));
+#endif
+
+    if (!activated && (boot_get_mode() != BOOT_MANUFACTURING_TEST)) {
+        tag_enter_deep_sleep();
+    }
+
+    // GPIO were configured again by sl_system_init, release the state latched at EM4 entry.
+    EMU_UnlatchPinRetention();
+
+    if (from_em4) {
+        ebm_retained_restore(&BURAM->RET[TPM_BURAM_EBM_REG].REG);
+    }
+    BURAM->RET[TPM_BURAM_SHELF_REG].REG = 0;
+    nvm_write_tag_op_mode(TPM_OP_MODE_ACTIVE);
+
+    tpm_fast_resume = activated;
+    return tpm_fast_resume;
+}
+
+/**
+ * @brief Tag was activated out of shelf mode in this boot
+ * @details Diagnostics (banner, reset cause, AS393x preset) are skipped and the first
+ *     beacon goes on the first Tag Main Machine tick.
+ */
+bool tpm_is_fast_resume(void)
+{
+    return tpm_fast_resume;
+}
+#endif
+
 /**
- * @brief Called right before sleep
+ * @brief Called right before sleep (EM2/EM3, interrupts masked)
  */
 void EMU_EFPEM23PresleepHook(void)
 {
-    /** Add debug code here.. **/
+#if defined(TAG_POWER_STATS_PRESENT)
+    if (tpm_power_stats_started) {
+        tpm_em_account(SL_POWER_MANAGER_EM2);
+    }
+#endif
 }
 
 /**
- * @brief Called right after wake up
+ * @brief Called right after wake up (interrupts still masked, wake-up source is pending)
  */
 void EMU_EFPEM23PostsleepHook(void)
 {
-    /** Add debug code here.. **/
+#if defined(TAG_POWER_STATS_PRESENT)
+    if (tpm_power_stats_started) {
+        tpm_on_wakeup();
+    }
+#endif
 }
 
+#if defined(TAG_HFXO_PREWARM_PRESENT)
+//! @brief Setup RTCC CC2 channel for HFXO pre-warm (after rtcc_init)
+void tpm_hfxo_prewarm_init(void)
+{
+    RTCC_CCChConf_TypeDef cc2_cfg = RTCC_CH_INIT_COMPARE_DEFAULT;
+    cc2_cfg.chMode = rtccCapComChModeCompare;
+    cc2_cfg.compMatchOutAction = rtccCompMatchOutActionPulse;
+    cc2_cfg.prsSel = 0;
+    cc2_cfg.inputEdgeSel = rtccInEdgeNone;
+    cc2_cfg.compBase = rtccCompBaseCnt;
+    RTCC_ChannelInit(TPM_RTCC_CC2, &cc2_cfg);
+
+    tpm_hfxo_prewarmed = false;
+}
+
+//! @brief Drop an unused pre-warm, HFXO goes off on next EM2 entry (TMM context)
+void tpm_hfxo_prewarm_release(void)
+{
+    CORE_DECLARE_IRQ_STATE;
+    CORE_ENTER_ATOMIC();
+    RTCC_IntDisable(RTCC_IEN_CC2);
+    if (tpm_hfxo_prewarmed) {
+        tpm_hfxo_prewarmed = false;
+        sl_power_manager_remove_em_requirement(SL_POWER_MANAGER_EM1);
+    }
+    CORE_EXIT_ATOMIC();
+}
+
+/**
+ * @brief Start HFXO ahead of a Tag Main Machine run that sends a sync beacon (TMM context)
+ * @details BLE Manager takes its EM1 requirement on that run, HFXO is ready by then so
+ *     the advertiser starts without waiting for the crystal. Too close runs are skipped.
+ * @param rtcc_value RTCC counter of the run
+ */
+void tpm_hfxo_prewarm_schedule(uint32_t rtcc_value)
+{
+    uint32_t at = rtcc_value - TPM_HFXO_PREWARM_COUNTS;
+
+    if ((int32_t)(at - RTCC_CounterGet()) < TMM_RTCC_MIN_OFFSET) {
+        return;
+    }
+
+    RTCC_ChannelCompareValueSet(TPM_RTCC_CC2, at);
+    RTCC_IntClear(RTCC_IF_CC2);
+    RTCC_IntEnable(RTCC_IEN_CC2);
+}
+
+/**
+ * @brief RTCC CC2 handler (RTCC ISR context)
+ * @details HFXO start-up is not waited for here, LF decoder shares this ISR. EM1 requirement
+ *     keeps Power Manager from going back to EM2 (which stops HFXO) until BLE Manager takes
+ *     over (@ref tpm_hfxo_prewarm_consume) or the run did not advertise (@ref tpm_hfxo_prewarm_release).
+ */
+void tpm_hfxo_prewarm_isr(void)
+{
+    RTCC_IntDisable(RTCC_IEN_CC2);
+    if (!tpm_hfxo_prewarmed) {
+        sl_power_manager_add_em_requirement(SL_POWER_MANAGER_EM1);
+        tpm_hfxo_prewarmed = true;
+    }
+    sl_hfxo_manager_begin_startup();
+    tpm_hfxo_prewarm_count++;
+}
+
+/**
+ * @brief Advertising request takes the pre-warm (BLE Manager, TMM context, once BLE Manager
+ *     holds its own EM1 requirement)
+ * @return true if HFXO was already running.
+ */
+bool tpm_hfxo_prewarm_consume(void)
+{
+    bool ready = false;
+    CORE_DECLARE_IRQ_STATE;
+
+    CORE_ENTER_ATOMIC();
+    if (tpm_hfxo_prewarmed) {
+        ready = ((HFXO0->STATUS & HFXO_STATUS_RDY) != 0);
+        if (ready) {
+            tpm_hfxo_prewarm_used++;
+        } else {
+            tpm_hfxo_prewarm_late++;
+        }
+        tpm_hfxo_prewarmed = false;
+        sl_power_manager_remove_em_requirement(SL_POWER_MANAGER_EM1);
+    }
+    CORE_EXIT_ATOMIC();
+
+    return ready;
+}
+#endif
+
+#if defined(TAG_POWER_STATS_PRESENT)
+/**
+ * @brief Print energy modes residency and wake-ups by source (CLI)
+ * @details Time is taken from RTCC on every energy mode transition, EM0 includes
+ *     interrupts handling.
+ */
+void tpm_print_power_stats(void)
+{
+    tpm_power_stats_t s;
+    uint64_t total = 0;
+    uint32_t wakeups = 0;
+    uint32_t i;
+
+    tpm_get_power_stats(&s);
+
+    for (i = 0; i < TPM_EM_MAX; i++) {
+        total += s.em_time[i];
+    }
+    for (i = 0; i < TPM_WAKE_MAX; i++) {
+        wakeups += s.wakeups[i];
+    }
+
+    printf("\n  Time accounted:       %lu sec", (uint32_t)(total / TPM_RTCC_FREQ_HZ));
+    for (i = 0; i < TPM_EM_MAX; i++) {
+        printf("\n  EM%lu residency:        %10lu ms  %3lu.%.2lu %%",
+               i,
+               (uint32_t)((s.em_time[i] * 1000) / TPM_RTCC_FREQ_HZ),
+               (uint32_t)((total != 0) ? ((s.em_time[i] * 100) / total) : 0),
+               (uint32_t)((total != 0) ? (((s.em_time[i] * 10000) / total) % 100) : 0));
+    }
+    printf("\n  Wake-ups:             %lu", wakeups);
+    for (i = 0; i < TPM_WAKE_MAX; i++) {
+        printf("\n    %-22s %10lu", tpm_wake_src_name[i], s.wakeups[i]);
+    }
+#if defined(TAG_HFXO_PREWARM_PRESENT)
+    printf("\n  HFXO pre-warm:        %lu (ready on advert %lu, late %lu, lead %d us)",
+           tpm_hfxo_prewarm_count,
+           tpm_hfxo_prewarm_used,
+           tpm_hfxo_prewarm_late,
+           TPM_HFXO_PREWARM_US);
+#endif
+}
+
+void tpm_reset_power_stats(void)
+{
+    CORE_DECLARE_IRQ_STATE;
+    CORE_ENTER_ATOMIC();
+    memset(&tpm_power_stats, 0, sizeof(tpm_power_stats));
+    memset(&tpm_power_stats_report, 0, sizeof(tpm_power_stats_report));
+    tpm_em_stamp = RTCC_CounterGet();
+#if defined(TAG_HFXO_PREWARM_PRESENT)
+    tpm_hfxo_prewarm_count = 0;
+    tpm_hfxo_prewarm_used = 0;
+    tpm_hfxo_prewarm_late = 0;
+#endif
+    CORE_EXIT_ATOMIC();
+}
+
+/**
+ * @brief Power stats since previous call (Power Stats beacon message)
+ * @param t
+ */
+void tpm_get_power_telemetry(tpm_power_telemetry_t *t)
+{
+    tpm_power_stats_t s;
+    uint64_t total = 0;
+    uint64_t active;
+    uint32_t wakeups = 0;
+    uint32_t top = 0;
+    uint32_t n;
+    uint32_t i;
+
+    tpm_get_power_stats(&s);
+
+    for (i = 0; i < TPM_EM_MAX; i++) {
+        total += (s.em_time[i] - tpm_power_stats_report.em_time[i]);
+    }
+    active = (s.em_time[SL_POWER_MANAGER_EM0] - tpm_power_stats_report.em_time[SL_POWER_MANAGER_EM0]) +
+             (s.em_time[SL_POWER_MANAGER_EM1] - tpm_power_stats_report.em_time[SL_POWER_MANAGER_EM1]);
+    active = ((total != 0) ? ((active * 10000) / total) : 0);
+
+    for (i = 0; i < TPM_WAKE_MAX; i++) {
+        n = (s.wakeups[i] - tpm_power_stats_report.wakeups[i]);
+        if (n > (s.wakeups[top] - tpm_power_stats_report.wakeups[top])) {
+            top = i;
+        }
+        wakeups += n;
+    }
+    if (wakeups > UINT16_MAX) {
+        wakeups = UINT16_MAX;
+    }
+
+    t->active_bp[0] = (uint8_t)(active >> 8);
+    t->active_bp[1] = (uint8_t)(active);
+    t->wakeups[0] = (uint8_t)(wakeups >> 8);
+    t->wakeups[1] = (uint8_t)(wakeups);
+    t->top_wake_src = (uint8_t)top;
+
+    tpm_power_stats_report = s;
+}
+#endif
+
 
 void tpm_schedule_system_reset(uint32_t timeout_ms)
 {
@@ -184,3 +606,16 @@ void tag_power_settings(void)
     // Tell Power Manager if we want to stay awake in main context or go to sleep immediately after an ISR.
     tag_sleep_on_isr_exit(true);
 }
+
+#if defined(TAG_POWER_STATS_PRESENT)
+/**
+ * @brief Start energy modes residency and wake-ups accounting (RTCC must be running)
+ */
+void tpm_power_stats_init(void)
+{
+    tpm_current_em = SL_POWER_MANAGER_EM0;
+    tpm_reset_power_stats();
+    sl_power_manager_subscribe_em_transition_event(&tpm_em1_event_handle, &tpm_em1_event_info);
+    tpm_power_stats_started = true;
+}
+#endif
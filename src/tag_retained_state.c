@@ -0,0 +1,125 @@
+/*
+ * tag_retained_state.c
+ *
+ *  Application state kept over warm resets (see tag_retained_state.h).
+ *
+ */
+
+#include "stdbool.h"
+#include "stdio.h"
+#include "stddef.h"
+#include "string.h"
+#include "em_common.h"
+#include "em_core.h"
+#include "em_emu.h"
+
+#include "dbg_utils.h"
+#include "boot.h"
+#include "lf_machine.h"
+#include "tag_beacon_machine.h"
+#include "tag_retained_state.h"
+
+#if defined(TAG_RETAINED_STATE_PRESENT)
+
+//******************************************************************************
+// Defines
+//******************************************************************************
+#define TRS_CRC32_POLY               (0xEDB88320UL)
+
+//******************************************************************************
+// Data types
+//******************************************************************************
+typedef struct trs_block_t {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t length;                  /* sizeof(trs_state_t) */
+    trs_state_t state;
+    uint32_t crc;                     /* CRC-32 from version to end of state */
+} trs_block_t;
+
+//******************************************************************************
+// Global variables
+//******************************************************************************
+// Keep this in .custom section to survive non POR resets (same as 'uptime').
+trs_block_t __attribute__ ((section(".custom"))) trs_block;
+
+//******************************************************************************
+// Static functions
+//******************************************************************************
+static uint32_t trs_crc32(const uint8_t *data, uint32_t len)
+{
+    uint32_t crc = 0xFFFFFFFFUL;
+    uint32_t i;
+
+    while (len--) {
+        crc ^= *data++;
+        for (i = 0; i < 8; i++) {
+            crc = (crc >> 1) ^ (TRS_CRC32_POLY & (0UL - (crc & 1)));
+        }
+    }
+
+    return ~crc;
+}
+
+static uint32_t trs_block_crc(void)
+{
+    return trs_crc32((const uint8_t *)&trs_block.version, (offsetof(trs_block_t, crc) - offsetof(trs_block_t, version)));
+}
+
+//******************************************************************************
+// Non Static functions
+//******************************************************************************
+/**
+ * @brief Save application state (end of every Tag Main Machine run, TMM context)
+ * @details A reset in the middle leaves a block with a bad CRC, state is then lost as
+ *     it would be without this module.
+ */
+void trs_save(void)
+{
+    trs_state_t s;
+
+    // Padding bytes are part of the CRC
+    memset(&s, 0, sizeof(s));
+    lfm_get_retained(&s.lf);
+    tbm_get_retained(&s.beacon);
+
+    trs_block.magic = TRS_MAGIC;
+    trs_block.version = TRS_VERSION;
+    trs_block.length = sizeof(trs_state_t);
+    trs_block.state = s;
+    trs_block.crc = trs_block_crc();
+}
+
+/**
+ * @brief Validate and restore application state (tag_init, machines initialized)
+ * @details Power-On Reset or a block from another firmware layout is dropped.
+ * @return true if state was restored.
+ */
+bool trs_restore(void)
+{
+    bool valid;
+
+    valid = (((boot_get_reset_cause() & EMU_RSTCAUSE_POR) == 0) &&
+             (trs_block.magic == TRS_MAGIC) &&
+             (trs_block.version == TRS_VERSION) &&
+             (trs_block.length == sizeof(trs_state_t)) &&
+             (trs_block.crc == trs_block_crc()));
+
+    if (!valid) {
+        memset(&trs_block, 0, sizeof(trs_block));
+        return false;
+    }
+
+    CORE_DECLARE_IRQ_STATE;
+    CORE_ENTER_ATOMIC();
+    lfm_restore(&trs_block.state.lf);
+    tbm_restore(&trs_block.state.beacon);
+    CORE_EXIT_ATOMIC();
+
+    DEBUG_LOG(DBG_CAT_SYSTEM, "Retained state restored (LF status 0x%.2X, events 0x%.4lX)",
+              trs_block.state.lf.status, trs_block.state.beacon.events);
+
+    return true;
+}
+
+#endif
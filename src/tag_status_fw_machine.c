@@ -16,7 +16,9 @@
 #include "tag_defines.h"
 #include "tag_beacon_machine.h"
 #include "tag_sw_timer.h"
+#include "tag_main_machine.h"
 #include "version.h"
+#include "energy_budget_machine.h"
 #include "tag_status_fw_machine.h"
 
 //******************************************************************************
@@ -55,9 +57,48 @@ static void tsm_update_tag_extended_status(void)
     // Get LF Gain Reduction Setting
     tsm_tag_ext_status.lf_gain = as39_get_gain_setting(); // values (0, 0dBm), (1, -4dBm), (2, -16dBm), (3, -24dBm)
 
-    // For now we only have 5 bytes..
-    tsm_tag_ext_status.length = 5;
+    // Get projected remaining battery life (Energy Budget Machine)
+    uint16_t remaining_life_days = ebm_get_remaining_life_days();
+    tsm_tag_ext_status.remaining_life_days[0] = (uint8_t)(remaining_life_days >> 8);
+    tsm_tag_ext_status.remaining_life_days[1] = (uint8_t)(remaining_life_days);
 
+    tsm_tag_ext_status.length = 7;
+}
+
+/**
+ * @brief Tag Extended Status Report (periodic sw timer callback)
+ */
+static void tsm_extended_status_report(tag_sw_timer_t *timer)
+{
+    (void)(timer);
+
+    // Updated Tag Extended Status Data
+    tsm_update_tag_extended_status();
+
+    // Send Asynchronous Tag Beacon Event to Tag Beacon Machine (this message will be sent immediately)
+    //tbm_set_event(TBM_EXT_STATUS_EVT, true);
+
+    // Send Sync Tag Beacon Event to Tag Beacon Machine (this message will synchronize with the slow or fast beacon rate)
+    tbm_set_event(TBM_EXT_STATUS_EVT, false);
+
+#if defined(TAG_POWER_STATS_BEACON_PRESENT)
+    // Power stats go in their own message, Tag Extended Status must fit a secured legacy ADV_PDU.
+    tbm_set_event(TBM_POWER_STATS_EVT, false);
+#endif
+}
+
+/**
+ * @brief Tag Firmware Revision Report (periodic sw timer callback)
+ */
+static void tsm_firmware_rev_report(tag_sw_timer_t *timer)
+{
+    (void)(timer);
+
+    // Send Asynchronous Tag Firmware Revision Beacon Event to Tag Beacon Machine (this message will be sent immediately)
+    //tbm_set_event(TBM_FIRMWARE_REV_EVT, true);
+
+    // Send Synchronous Tag Firmware Revision Beacon Event to Tag Beacon Machine (this message will synchronize with the slow or fast beacon rate)
+    tbm_set_event(TBM_FIRMWARE_REV_EVT, false);
 }
 
 /**
@@ -122,62 +163,38 @@ void tsm_clear_tag_status_flag(tsm_tag_status_flags_t flag)
     tsm_update_tag_status(flag, 0);
 }
 
-/**
- * @brief Tag Extended Status Report (Slow Task)
- */
-void tag_extended_status_run(void)
-{
-    tag_sw_timer_tick(&extended_status_timer);
-
-    if (tag_sw_timer_is_expired(&extended_status_timer)) {
-
-        // Updated Tag Extended Status Data
-        tsm_update_tag_extended_status();
-
-        // Send Asynchronous Tag Beacon Event to Tag Beacon Machine (this message will be sent immediately)
-        //tbm_set_event(TBM_EXT_STATUS_EVT, true);
-
-        // Send Sync Tag Beacon Event to Tag Beacon Machine (this message will synchronize with the slow or fast beacon rate)
-        tbm_set_event(TBM_EXT_STATUS_EVT, false);
-
-        // Reload Tag Extended Status report timer
-        tag_sw_timer_reload(&extended_status_timer, TMM_TAG_EXT_STATUS_PERIOD_SEC);
-    }
-}
-
-/**
- * @brief Tag Firmware Revision Report (Slow Task)
- */
-void tag_firmware_rev_run(void)
-{
-    tag_sw_timer_tick(&fw_revision_timer);
-
-    if (tag_sw_timer_is_expired(&fw_revision_timer)) {
-
-        // Send Asynchronous Tag Firmware Revision Beacon Event to Tag Beacon Machine (this message will be sent immediately)
-        //tbm_set_event(TBM_FIRMWARE_REV_EVT, true);
-
-        // Send Synchronous Tag Firmware Revision Beacon Event to Tag Beacon Machine (this message will synchronize with the slow or fast beacon rate)
-        tbm_set_event(TBM_FIRMWARE_REV_EVT, false);
-
-        // Reload Firmware Rev report timer
-        tag_sw_timer_reload(&fw_revision_timer, TMM_TAG_FW_REV_PERIOD_SEC);
-    }
-}
-
 /**
  * @brief Tag Status Machine Init
  */
 uint32_t tsm_init(void)
 {
+    uint32_t ext_status_first = TMM_TAG_EXT_STATUS_PERIOD_SEC_STARTUP_ONLY;
+    uint32_t fw_rev_first = TMM_TAG_FW_REV_PERIOD_SEC_STARTUP_ONLY;
+
     // Init Tag Extended Status Byte
     tsm_update_tag_extended_status();
 
+#if defined(TAG_FAST_BOOT_PRESENT)
+    // Watchdog or brown-out reset, no start-up reports so location engine does not see it.
+    if (boot_is_silent_reset()) {
+        ext_status_first = TMM_TAG_EXT_STATUS_PERIOD_SEC;
+        fw_rev_first = TMM_TAG_FW_REV_PERIOD_SEC;
+    }
+#endif
+
     // Init Tag Extended Status Report Timer
-    tag_sw_timer_reload(&extended_status_timer, TMM_TAG_EXT_STATUS_PERIOD_SEC_STARTUP_ONLY);
+    tag_sw_timer_start(&extended_status_timer,
+                       TMM_SEC_TO_TICKS(ext_status_first),
+                       TMM_SEC_TO_TICKS(TMM_TAG_EXT_STATUS_PERIOD_SEC),
+                       tsm_extended_status_report);
 
     // Init Tag Firmware Rev Report Timer
-    tag_sw_timer_reload(&fw_revision_timer, TMM_TAG_FW_REV_PERIOD_SEC_STARTUP_ONLY);
+    tag_sw_timer_start(&fw_revision_timer,
+                       TMM_SEC_TO_TICKS(fw_rev_first),
+                       TMM_SEC_TO_TICKS(TMM_TAG_FW_REV_PERIOD_SEC),
+                       tsm_firmware_rev_report);
 
     return 0;
 }
+
+TMM_MACHINE(40, tsm, "Tag Status", tsm_init, NULL, 0, 0);
@@ -9,6 +9,7 @@
 #include "sl_sleeptimer.h"
 
 #include "tag_sw_timer.h"
+#include "tag_main_machine.h"
 #include "boot.h"
 #include "tag_beacon_machine.h"
 #include "dbg_utils.h"
@@ -38,24 +39,28 @@ tum_uptime_t __attribute__ ((section(".custom"))) uptime;
 //******************************************************************************
 // Static functions
 //******************************************************************************
-static void tum_uptime_process(void)
+static void tum_uptime_process(uint32_t elapsed_sec)
 {
-    uptime.secs++;
+    uint32_t secs = uptime.secs + elapsed_sec;
+    uint32_t mins = uptime.mins + (secs / 60);
+    uint32_t hours = uptime.hours + (mins / 60);
+
+    uptime.secs = (secs % 60);
+    uptime.mins = (mins % 60);
+    uptime.hours = (hours % 24);
+    uptime.days += (hours / 24);
+}
 
-    if (uptime.secs == 60) {
-        uptime.secs = 0;
-        uptime.mins++;
+//! @brief Send Uptime Report Event (periodic sw timer callback)
+static void tum_uptime_report(tag_sw_timer_t *timer)
+{
+    (void)(timer);
 
-        if (uptime.mins == 60) {
-            uptime.mins = 0;
-            uptime.hours++;
+    // Send Async Tag Uptime Beacon
+    //tbm_set_event(TBM_UPTIME_EVT, true);
 
-            if (uptime.hours == 24) {
-                uptime.hours = 0;
-                uptime.days++;
-            }
-        }
-    }
+    // Send Sync Tag Uptime Beacon
+    tbm_set_event(TBM_UPTIME_EVT, false);
 }
 
 //******************************************************************************
@@ -78,32 +83,24 @@ uint16_t tum_get_beacon_data(void)
 
 /**
  * @brief Tag Uptime Machine
- * @details Keep track of number of days running, Sends Uptime Report Event to Tag Beacon Machine
+ * @details Keep track of number of days running (Uptime Report Event is sent by its own sw timer)
  */
 void tag_uptime_run(void)
 {
-    tag_sw_timer_tick(&uptime_report_tmr);
-
-    tum_uptime_process();
-
-    // Check if it is time to report uptime message.
-    if (tag_sw_timer_is_expired(&uptime_report_tmr)) {
-        tag_sw_timer_reload(&uptime_report_tmr, TUM_TIMER_PERIOD_SEC);
-
-        // Send Async Tag Uptime Beacon
-        //tbm_set_event(TBM_UPTIME_EVT, true);
-
-        // Send Sync Tag Uptime Beacon
-        tbm_set_event(TBM_UPTIME_EVT, false);
-    }
+    tum_uptime_process(tmm_get_elapsed_sec());
 }
 
 uint32_t tum_init(void)
 {
-    tag_sw_timer_reload(&uptime_report_tmr, TUM_TIMER_PERIOD_SEC);
+    tag_sw_timer_start(&uptime_report_tmr,
+                       TMM_SEC_TO_TICKS(TUM_TIMER_PERIOD_SEC),
+                       TMM_SEC_TO_TICKS(TUM_TIMER_PERIOD_SEC),
+                       tum_uptime_report);
     return 0;
 }
 
+TMM_MACHINE(70, tum, "Uptime", tum_init, tag_uptime_run, TMM_SLOW_TASK_PERIOD, 1);
+
 /**
  * @brief Initialize uptime only when Power-On Reset happens otherwise it would not mean anything.
  * @details 'uptime' is placed in RAM section .custom so it will not be zeroed during c startup.
@@ -14,6 +14,7 @@
 #include "stdbool.h"
 #include "dbg_utils.h"
 #include "tag_sw_timer.h"
+#include "tag_main_machine.h"
 #include "temperature_machine.h"
 #include "tag_beacon_machine.h"
 
@@ -40,13 +41,6 @@ static tag_sw_timer_t ttm_read_timer;
 //******************************************************************************
 // Static Functions
 //******************************************************************************
-static void ttm_tick(void)
-{
-    // Tick Temperature Report Timer
-    tag_sw_timer_tick(&ttm_report_timer);
-    tag_sw_timer_tick(&ttm_read_timer);
-}
-
 static void ttm_read_temperature(void)
 {
     volatile float temp_celsius = EMU_TemperatureGet();
@@ -87,9 +81,6 @@ int8_t ttm_get_current_temperature(void)
  */
 void temperature_run(void)
 {
-    // Update TTM machine timers
-    ttm_tick();
-
     // Tag Temperature Reading (timer)
     if (tag_sw_timer_is_expired(&ttm_read_timer)) {
 
@@ -112,11 +103,11 @@ void temperature_run(void)
             tbm_set_event(TBM_TEMPERATURE_EVT, true);
 
             // Reload TTM report timer (since we are anticipating the message here)
-            tag_sw_timer_reload(&ttm_report_timer, TTM_REPORT_TIMER_RELOAD);
+            tag_sw_timer_reload(&ttm_report_timer, TMM_SEC_TO_TICKS(TTM_REPORT_TIMER_RELOAD));
         }
 
         // Reload TTM sensor read timer
-        tag_sw_timer_reload(&ttm_read_timer, TTM_READ_TIMER_RELOAD);
+        tag_sw_timer_reload(&ttm_read_timer, TMM_SEC_TO_TICKS(TTM_READ_TIMER_RELOAD));
     }
 
     // Tag Temperature Message reporting (timer)
@@ -129,20 +120,22 @@ void temperature_run(void)
         tbm_set_event(TBM_TEMPERATURE_EVT, false);
 
         // Reload TTM Report Timer
-        tag_sw_timer_reload(&ttm_report_timer, TTM_REPORT_TIMER_RELOAD);
+        tag_sw_timer_reload(&ttm_report_timer, TMM_SEC_TO_TICKS(TTM_REPORT_TIMER_RELOAD));
     }
 }
 
 uint32_t ttm_init(void)
 {
     // Init TTM Report Timer period
-    tag_sw_timer_reload(&ttm_report_timer, TTM_REPORT_TIMER_RELOAD);
+    tag_sw_timer_reload(&ttm_report_timer, TMM_SEC_TO_TICKS(TTM_REPORT_TIMER_RELOAD));
 
     // Init TTM Read Timer period
-    tag_sw_timer_reload(&ttm_read_timer, TTM_READ_TIMER_RELOAD);
+    tag_sw_timer_reload(&ttm_read_timer, TMM_SEC_TO_TICKS(TTM_READ_TIMER_RELOAD));
 
     // Read current temperature
     ttm_read_temperature();
 
     return 0;
 }
+
+TMM_MACHINE(20, ttm, "Temperature", ttm_init, temperature_run, TMM_SLOW_TASK_PERIOD, 2);
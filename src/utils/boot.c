@@ -13,26 +13,61 @@
 #include "em_cmu.h"
 #include "em_gpio.h"
 #include "sl_udelay.h"
+#include "sl_sleeptimer.h"
+#include "string.h"
 
 #include "dbg_utils.h"
 #include "tag_defines.h"
 #include "tag_gpio_mapping.h"
+#include "tag_power_manager.h"
 #include "boot.h"
 
 
 //******************************************************************************
 // Defines
 //******************************************************************************
+/** Resets the tag recovers from on its own (no start-up reports, see @ref boot_is_silent_reset) **/
+#define BOOT_SILENT_RESET_CAUSES     (EMU_RSTCAUSE_WDOG0 | EMU_RSTCAUSE_LOCKUP | EMU_RSTCAUSE_DVDDBOD | \
+                                      EMU_RSTCAUSE_AVDDBOD | EMU_RSTCAUSE_DECBOD)
+
+#if defined(TAG_BOOT_TRACE_PRESENT)
+#define BOOT_TRACE_MAGIC             (0x42545231)   /* "BTR1" */
+#endif
 
 //******************************************************************************
 // Data types
 //******************************************************************************
+#if defined(TAG_BOOT_TRACE_PRESENT)
+typedef struct boot_trace_t {
+    uint32_t magic;
+    uint32_t reset_cause;
+    uint32_t marked;                          /* boot_phase_t bit mask */
+    uint32_t phase_us[BOOT_PHASE_MAX];        /* end of phase, from boot_init */
+} boot_trace_t;
+#endif
 
 //******************************************************************************
 // Global variables
 //******************************************************************************
 static uint8_t boot_mode;
 static uint32_t reset_cause;
+#if defined(TAG_BOOT_TRACE_PRESENT)
+// Keep this in .custom section, previous boot trace tells where a reset boot was stuck.
+static boot_trace_t __attribute__ ((section(".custom"))) boot_trace[2];     /* this boot, previous boot */
+static uint32_t boot_trace_cycles;                                         /* DWT at previous mark */
+static uint32_t boot_trace_core_mhz;                                       /* core clock when DWT was started */
+static uint32_t boot_trace_ticks;                                          /* sleeptimer at previous mark */
+static uint32_t boot_trace_us;
+static const char *boot_phase_name[BOOT_PHASE_MAX] = {
+    [BOOT_PHASE_BOOT_INIT]        = "boot_init",
+    [BOOT_PHASE_SYSTEM_INIT]      = "sl_system_init",
+    [BOOT_PHASE_AS39_INIT]        = "as39_init",
+    [BOOT_PHASE_RTCC_INIT]        = "rtcc_init",
+    [BOOT_PHASE_LF_DECODER_INIT]  = "lf_decoder_init",
+    [BOOT_PHASE_TMM_START]        = "tmm_start",
+    [BOOT_PHASE_FIRST_ADV]        = "first advert",
+};
+#endif
 
 //******************************************************************************
 // Static functions
@@ -70,6 +105,47 @@ static void boot_select(void)
 #endif
 }
 
+#if defined(TAG_BOOT_TRACE_PRESENT)
+//! @brief Start boot trace (DWT cycles from now, previous trace is kept over non POR resets)
+static void boot_trace_start(void)
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    boot_trace_core_mhz = (SystemCoreClockGet() / 1000000);
+
+    if ((boot_trace[0].magic == BOOT_TRACE_MAGIC) && !(reset_cause & EMU_RSTCAUSE_POR)) {
+        boot_trace[1] = boot_trace[0];
+    } else {
+        memset(&boot_trace[1], 0, sizeof(boot_trace[1]));
+    }
+
+    memset(&boot_trace[0], 0, sizeof(boot_trace[0]));
+    boot_trace[0].magic = BOOT_TRACE_MAGIC;
+    boot_trace[0].reset_cause = reset_cause;
+    boot_trace_cycles = 0;
+    boot_trace_us = 0;
+}
+
+static void boot_trace_print_one(const boot_trace_t *t, const char *title)
+{
+    uint32_t i;
+
+    if (t->magic != BOOT_TRACE_MAGIC) {
+        return;
+    }
+
+    printf("\n  %s (reset cause 0x%.4lX):", title, t->reset_cause);
+    for (i = 0; i < BOOT_PHASE_MAX; i++) {
+        if (t->marked & (1UL << i)) {
+            printf("\n    %-22s %10lu us", boot_phase_name[i], t->phase_us[i]);
+        } else {
+            printf("\n    %-22s %10s", boot_phase_name[i], "-");
+        }
+    }
+}
+#endif
+
 static void _boot_print_reset_cause(const char *msg)
 {
     if(dbg_is_log_enabled()) {
@@ -124,6 +200,61 @@ void boot_print_reset_cause(void)
     }
 }
 
+/**
+ * @brief Reset the tag recovers from on its own (watchdog, lockup, brown-out)
+ * @details Location engine should not see these, tag resumes beaconing without start-up reports.
+ */
+bool boot_is_silent_reset(void)
+{
+    return (((reset_cause & BOOT_SILENT_RESET_CAUSES) != 0) && ((reset_cause & (EMU_RSTCAUSE_POR | EMU_RSTCAUSE_PIN)) == 0));
+}
+
+#if defined(TAG_BOOT_TRACE_PRESENT)
+/**
+ * @brief Timestamp the end of a boot phase (only its first end is kept)
+ * @details DWT stops while the core sleeps, so sleeptimer is used once it runs (after
+ *     sl_system_init). DWT cycles are converted with the core clock DWT was started with,
+ *     sl_system_init switches to a faster clock so its span is an upper bound.
+ * @param phase
+ */
+void boot_trace_mark(boot_phase_t phase)
+{
+    uint32_t now;
+
+    if (boot_trace[0].marked & (1UL << phase)) {
+        return;
+    }
+
+    if (boot_trace[0].marked & (1UL << BOOT_PHASE_SYSTEM_INIT)) {
+        now = sl_sleeptimer_get_tick_count();
+        boot_trace_us += (uint32_t)(((uint64_t)(now - boot_trace_ticks) * 1000000) / sl_sleeptimer_get_timer_frequency());
+        boot_trace_ticks = now;
+    } else {
+        now = DWT->CYCCNT;
+        boot_trace_us += ((now - boot_trace_cycles) / boot_trace_core_mhz);
+        boot_trace_cycles = now;
+        if (phase == BOOT_PHASE_SYSTEM_INIT) {
+            boot_trace_ticks = sl_sleeptimer_get_tick_count();
+        }
+    }
+
+    boot_trace[0].phase_us[phase] = boot_trace_us;
+    boot_trace[0].marked |= (1UL << phase);
+}
+
+bool boot_trace_is_marked(boot_phase_t phase)
+{
+    return ((boot_trace[0].marked & (1UL << phase)) != 0);
+}
+
+//! @brief Print boot trace of this boot and of the previous one (CLI)
+void boot_trace_print(void)
+{
+    boot_trace_print_one(&boot_trace[0], "Boot trace");
+    boot_trace_print_one(&boot_trace[1], "Previous boot trace");
+}
+#endif
+
 uint8_t boot_get_mode(void)
 {
     return boot_mode;
@@ -131,6 +262,7 @@ uint8_t boot_get_mode(void)
 
 void boot_init(void)
 {
+    bool skip_select = false;
     CORE_DECLARE_IRQ_STATE;
     CORE_ENTER_CRITICAL();
 
@@ -140,8 +272,27 @@ void boot_init(void)
     // Clear reset cause flags
     RMU_ResetCauseClear();
 
+#if defined(TAG_BOOT_TRACE_PRESENT)
+    boot_trace_start();
+#endif
+
     // Get HW Boot Select Mode
     boot_mode = 0;
-    boot_select();
+#if defined(TAG_SHELF_MODE_PRESENT)
+    // Nobody drives boot select pins on a wake-up from shelf mode, skip its delays.
+    CMU_ClockEnable(cmuClock_BURAM, true);
+    skip_select |= ((reset_cause & EMU_RSTCAUSE_EM4) && (BURAM->RET[TPM_BURAM_SHELF_REG].REG == TPM_SHELF_MAGIC));
+#endif
+#if defined(TAG_FAST_BOOT_PRESENT)
+    // Same after a watchdog or brown-out reset (SERMAC boot select goes through reset pin).
+    skip_select |= boot_is_silent_reset();
+#endif
+    if (skip_select) {
+        boot_mode = BOOT_DEFAULT;
+    } else {
+        boot_select();
+    }
     CORE_EXIT_CRITICAL();
+
+    BOOT_TRACE_MARK(BOOT_PHASE_BOOT_INIT);
 }
@@ -16,7 +16,12 @@
 #include "lf_decoder.h"
 #include "tag_main_machine.h"
 #include "tag_beacon_machine.h"
+#include "ble_manager_machine.h"
+#if defined(TAG_BEACON_AUTH_PRESENT)
+#include "tag_beacon_auth.h"
+#endif
 #include "tag_power_manager.h"
+#include "tag_command.h"
 #include "nvm.h"
 #include "boot.h"
 #include "cli.h"
@@ -108,6 +113,44 @@ static uint32_t cli_decode_mac_addr(void)
     return status;
 }
 
+#if defined(TAG_BEACON_AUTH_PRESENT)
+static uint32_t cli_decode_auth_key(void)
+{
+    uint8_t i;
+    uint32_t status;
+    unsigned int k;
+    uint8_t key[TBA_KEY_LEN];
+    char *ptr;
+
+    // Key is expected as 32 hex digits right after "ble auth key ".
+    ptr = strstr(cmd.data, "key ");
+
+    if ((ptr != NULL) && (strlen(ptr + 4) == (TBA_KEY_LEN * 2))) {
+        ptr += 4;
+        status = 0;
+        for (i = 0; i < TBA_KEY_LEN; i++) {
+            if (sscanf(&ptr[i * 2], "%2X", &k) != 1) {
+                status = 1;
+                break;
+            }
+            key[i] = (uint8_t)k;
+        }
+        if (status == 0) {
+            // Counter carries on across keys, re-provisioning a key must never reuse its keystream.
+            status = nvm_write_tba_key(key);
+#if defined(TAG_DOWNLINK_PRESENT)
+            status |= nvm_write_tcm_dl_counter(0);
+#endif
+        }
+        memset(key, 0, sizeof(key));
+    } else {
+        status = 1;
+    }
+
+    return status;
+}
+#endif
+
 static void cli_process_manufacturing_command(void)
 {
     memset(cmd.data,'\0',sizeof(cmd.data));
@@ -128,7 +171,7 @@ static void cli_process_manufacturing_command(void)
         ret = sscanf(cmd.data, "%*s %*s %*s %lu", &reset_delay_timeout);
 
         if (ret == 1) {
-            tpm_enter_current_draw_mode(reset_delay_timeout);
+            tcm_cmd_enter_current_draw_mode(reset_delay_timeout);
             SEND_RSP(DATA_ACK);
             DEBUG_LOG(DBG_CAT_CLI, "Entering current draw mode, argument = %lu msec", reset_delay_timeout);
         } else {
@@ -136,6 +179,16 @@ static void cli_process_manufacturing_command(void)
             DEBUG_LOG(DBG_CAT_WARNING, "Syntax error...");
         }
 
+#if defined(TAG_SHELF_MODE_PRESENT)
+    // enter shelf mode --------------------------------------------------------
+    } else if (strstr(cmd.data, "shelf mode") != NULL) {
+
+        SEND_RSP(DATA_ACK);
+        if (tcm_cmd_enter_deep_sleep_mode() != 0) {
+            DEBUG_LOG(DBG_CAT_WARNING, "Shelf mode not supported...");
+        }
+#endif
+
     // write/read custom mac address to NVM ------------------------------------
     } else if (strstr(cmd.data, "write mac") != NULL) {
 
@@ -187,6 +240,8 @@ static void cli_process_manufacturing_command(void)
                "|                                                             <value> = 0 Tag stays in this mode until a manual reset\n"                                    \
                "|                                                             <value> = 1-99999 Tag will automatically reset into 'NORMAL MODE' after timeout (in ms)\n"    \
                "|   -----------------------------------------------------------------------------------------\n"          \
+               "|   shelf mode                                       -> Deep sleep until RFSENSE/LF activation\n"        \
+               "|   -----------------------------------------------------------------------------------------\n"          \
                "|   write mac <address>                              -> Write MAC address into NVM.\n"                    \
                "|                                                             <address> format -> XX:XX:XX:XX:XX:XX\n"    \
                "|   read mac                                         -> Read MAC address\n"                               \
@@ -304,30 +359,186 @@ static void cli_process_command(void)
         ret = sscanf(cmd.data, "%*s %*s %*s %lu %lu", &slow_rate, &fast_rate);
 
         if (ret == 2) {
-            if ( (slow_rate > 0) &&
-                 (fast_rate > 0) &&
-                 (slow_rate < 0xFFFF) &&
-                 (fast_rate < 0xFFFF) ) {
+            // Same handler as downlink command (writes into NVM and applies)
+            if ( (slow_rate >= 0xFFFF) ||
+                 (fast_rate >= 0xFFFF) ||
+                 (tcm_cmd_set_beacon_rate((uint16_t)slow_rate, (uint16_t)fast_rate) != 0) ) {
+                DEBUG_LOG(DBG_CAT_WARNING, "Error, value range must be 1 to 65353");
+            }
+        } else {
+            DEBUG_LOG(DBG_CAT_WARNING, "Syntax error... unexpected command");
+        }
 
-                tbm_nvm_data_t b;
+    // ble statistics ----------------------------------------------------------
+    } else if (strcmp(cmd.data, "ble stats") == 0) {
+        bmm_print_stats();
 
-                b.is_erased = false;
-                b.slow_rate = (uint16_t)slow_rate;
-                b.fast_rate = (uint16_t)fast_rate;
+    } else if (strcmp(cmd.data, "ble stats reset") == 0) {
+        bmm_reset_stats();
+        printf(COLOR_B_WHITE"\n\n-> BLE statistics cleared...\n");
 
-                DEBUG_LOG(DBG_CAT_CLI, "Writing to NVM...");
-                nvm_write_tbm_settings(&b);
+    // lf decoder statistics ---------------------------------------------------
+    } else if (strcmp(cmd.data, "lf stats") == 0) {
+        lf_decoder_print_stats();
 
-                DEBUG_LOG(DBG_CAT_CLI, "Applying new settings to Tag Beacon Machine...");
-                tbm_apply_new_settings(&b);
+    } else if (strcmp(cmd.data, "lf stats reset") == 0) {
+        lf_decoder_reset_stats();
 
-            } else {
-                DEBUG_LOG(DBG_CAT_WARNING, "Error, value range must be 1 to 65353");
-            }
+#if defined(TAG_PROFILER_PRESENT)
+    // tag main machine profiler -----------------------------------------------
+    } else if (strcmp(cmd.data, "prof") == 0) {
+        tmm_prof_print_stats();
+
+    } else if (strcmp(cmd.data, "prof reset") == 0) {
+        tmm_prof_reset_stats();
+#endif
+
+#if defined(TAG_BOOT_TRACE_PRESENT)
+    // boot phases timestamps --------------------------------------------------
+    } else if (strcmp(cmd.data, "boot trace") == 0) {
+        boot_trace_print();
+#endif
+
+#if defined(TAG_POWER_STATS_PRESENT)
+    // energy modes residency and wake-ups -------------------------------------
+    } else if (strcmp(cmd.data, "pm stats") == 0) {
+        tpm_print_power_stats();
+
+    } else if (strcmp(cmd.data, "pm stats reset") == 0) {
+        tpm_reset_power_stats();
+#endif
+
+    // ble advertising set policy (RF profiles) --------------------------------
+    } else if (strstr(cmd.data, "ble adv cfg") != NULL) {
+
+        int ret;
+        uint32_t profile;
+        uint32_t retx;
+        uint32_t min_interval;
+        uint32_t max_interval;
+        uint32_t channel_map;
+        long tx_power;
+
+        ret = sscanf(cmd.data, "%*s %*s %*s %lu %lu %lu %lu %lu %ld", &profile, &retx, &min_interval, &max_interval, &channel_map, &tx_power);
+
+        // Range check before narrowing, out of range values must not wrap into valid ones.
+        if ((ret == 6) && (retx <= 0xFF) && (channel_map <= 0xFF) &&
+            (min_interval >= BMM_ADV_MIN_INTERVAL_MS) && (max_interval <= BMM_ADV_MAX_INTERVAL_MS) &&
+            (min_interval <= max_interval) && (tx_power >= INT16_MIN) && (tx_power <= INT16_MAX) &&
+            (bmm_set_adv_config((bmm_rf_profile_t)profile,
+                                (uint8_t)retx,
+                                (uint16_t)min_interval,
+                                (uint16_t)max_interval,
+                                (uint8_t)channel_map,
+                                (int16_t)tx_power) == 0)) {
+            DEBUG_LOG(DBG_CAT_CLI, "New RF profile will be applied on next advertising...");
         } else {
-            DEBUG_LOG(DBG_CAT_WARNING, "Syntax error... unexpected command");
+            DEBUG_LOG(DBG_CAT_WARNING, "Syntax error... ble adv cfg <profile> <events> <min ms> <max ms> <channel map> <tx power> (interval %d-%d ms, min <= max)", BMM_ADV_MIN_INTERVAL_MS, BMM_ADV_MAX_INTERVAL_MS);
         }
 
+#if defined(TAG_BLE_EXT_ADV_PRESENT)
+    // ble extended advertising on/off -----------------------------------------
+    } else if (strcmp(cmd.data, "ble ext adv on") == 0) {
+        bmm_set_ext_adv(true);
+        printf(COLOR_B_WHITE"\n\n-> BLE extended advertising enabled...\n");
+
+    } else if (strcmp(cmd.data, "ble ext adv off") == 0) {
+        bmm_set_ext_adv(false);
+        printf(COLOR_B_WHITE"\n\n-> BLE extended advertising disabled (legacy only)...\n");
+#endif
+
+#if defined(TAG_ADV_SCAN_RSP_PRESENT)
+    // ble scan response on/off ------------------------------------------------
+    } else if (strcmp(cmd.data, "ble scan rsp on") == 0) {
+        bmm_set_scan_rsp(true);
+        // Send commissioning data again so scan response gets filled right away.
+        tbm_set_event(TBM_FIRMWARE_REV_EVT, false);
+        tbm_set_event(TBM_EXT_STATUS_EVT, false);
+        printf(COLOR_B_WHITE"\n\n-> BLE scan response enabled...\n");
+
+    } else if (strcmp(cmd.data, "ble scan rsp off") == 0) {
+        bmm_set_scan_rsp(false);
+        printf(COLOR_B_WHITE"\n\n-> BLE scan response disabled (all data in ADV_PDU)...\n");
+#endif
+
+#if defined(TAG_READER_ACK_PRESENT)
+    // ble reader acknowledgment -----------------------------------------------
+    } else if (strstr(cmd.data, "ble ack on") != NULL) {
+
+        int ret;
+        uint32_t window_ms;
+        uint32_t attempts;
+
+        ret = sscanf(cmd.data, "%*s %*s %*s %lu %lu", &window_ms, &attempts);
+
+        if ((ret == 2) && (window_ms <= 0xFFFF) && (attempts <= 0xFF) &&
+            (bmm_set_ack_config(true, (uint16_t)window_ms, (uint8_t)attempts) == 0)) {
+            printf(COLOR_B_WHITE"\n\n-> BLE reader ack enabled (critical messages)...\n");
+        } else {
+            DEBUG_LOG(DBG_CAT_WARNING, "Syntax error... ble ack on <window ms> <attempts>");
+        }
+
+    } else if (strcmp(cmd.data, "ble ack off") == 0) {
+        bmm_set_ack_config(false, BMM_ACK_WINDOW_DEFAULT_MS, 0);
+        printf(COLOR_B_WHITE"\n\n-> BLE reader ack disabled (blind retransmissions)...\n");
+#endif
+
+#if defined(TAG_DOWNLINK_PRESENT)
+    // ble downlink slots ------------------------------------------------------
+    } else if (strstr(cmd.data, "ble dl on") != NULL) {
+
+        int ret;
+        uint32_t window_ms;
+        uint32_t period;
+
+        ret = sscanf(cmd.data, "%*s %*s %*s %lu %lu", &window_ms, &period);
+
+        if ((ret == 2) && (window_ms <= 0xFFFF) && (period <= 0xFF) &&
+            (bmm_set_dl_config(true, (uint16_t)window_ms, (uint8_t)period) == 0)) {
+            printf(COLOR_B_WHITE"\n\n-> BLE downlink enabled (requires beacon auth. key)...\n");
+        } else {
+            DEBUG_LOG(DBG_CAT_WARNING, "Syntax error... ble dl on <window ms> <period>");
+        }
+
+    } else if (strcmp(cmd.data, "ble dl off") == 0) {
+        bmm_set_dl_config(false, BMM_DL_WINDOW_DEFAULT_MS, BMM_DL_PERIOD_DEFAULT);
+        printf(COLOR_B_WHITE"\n\n-> BLE downlink disabled...\n");
+#endif
+
+#if defined(TAG_GATT_PROVISIONING_PRESENT)
+    // ble provisioning window -------------------------------------------------
+    } else if (strstr(cmd.data, "ble prov") != NULL) {
+
+        int ret;
+        uint32_t window_sec;
+
+        ret = sscanf(cmd.data, "%*s %*s %lu", &window_sec);
+
+        if ((ret == 1) && (window_sec <= 0xFFFF) && (bmm_open_prov_window((uint16_t)window_sec) == 0)) {
+            printf(COLOR_B_WHITE"\n\n-> BLE provisioning window %s...\n", ((window_sec != 0) ? "open (connectable)" : "closed"));
+        } else {
+            DEBUG_LOG(DBG_CAT_WARNING, "Syntax error... ble prov <window sec>");
+        }
+#endif
+
+#if defined(TAG_BEACON_AUTH_PRESENT)
+    // ble authenticated beacons -----------------------------------------------
+    } else if (strstr(cmd.data, "ble auth key") != NULL) {
+        if (cli_decode_auth_key() == 0) {
+            DEBUG_LOG(DBG_CAT_CLI, "New beacon auth. key was saved into NVM... rebooting to apply new settings");
+            tpm_schedule_system_reset(1000);
+        } else {
+            DEBUG_LOG(DBG_CAT_WARNING, "Syntax error... expected key format -> 32 hex digits (AES-128)");
+        }
+
+    } else if (strcmp(cmd.data, "ble auth bench") == 0) {
+        if (bmm_adv_running) {
+            DEBUG_LOG(DBG_CAT_WARNING, "BLE advertising in progress, try again...");
+        } else {
+            tba_benchmark();
+        }
+#endif
+
     // stop cli ----------------------------------------------------------------
     } else if (strcmp(cmd.data, "cli stop") == 0) {
         cli_stop();
@@ -364,6 +575,35 @@ static void cli_process_command(void)
                "                                                             <slow> - 1 to 65353 (x1 sec)\n"             \
                "                                                             <fast> - 1 to 65353 (x250 mS)\n"            \
                "   -----------------------------------------------------------------------------------------\n"          \
+               "   ble stats               [reset]                  -> Show/clear advertising statistics\n"             \
+               "   ble ext adv             [on, off]                -> BLE 5 extended advertising on/off\n"             \
+               "   ble scan rsp            [on, off]                -> FW rev./ext. status in scan response on/off\n"   \
+               "   ble adv cfg <profile> <events> <min> <max> <map> <power>\n"                                           \
+               "                                                    -> RF profile by message class (not stored in NVM)\n" \
+               "                                                             <profile> - 0 routine, 1 standard, 2 alarm\n" \
+               "                                                             <events> - 1 to 255 adv. events per beacon\n" \
+               "                                                             <min> <max> - 20 to 10000 (x1 mS)\n"       \
+               "                                                             <map> - 1 to 7 (bit0: CH37 ... bit2: CH39)\n" \
+               "                                                             <power> - TX power (x0.1 dBm)\n"          \
+               "   ble ack on <window> <attempts>                   -> Scan for reader ack after critical adverts\n"   \
+               "                                                             <window> - 10 to 500 (x1 mS)\n"           \
+               "                                                             <attempts> - 0 (RF profile events) to 255\n" \
+               "   ble ack off                                      -> Blind retransmissions of critical adverts\n"    \
+               "   ble dl on <window> <period>                      -> Scan for reader commands after adverts\n"       \
+               "                                                             <window> - 10 to 500 (x1 mS)\n"           \
+               "                                                             <period> - 1 to 255 (adv. sets per window)\n" \
+               "   ble dl off                                       -> No downlink windows\n"                          \
+               "   ble prov <window>                                -> Connectable adverts for GATT provisioning\n"   \
+               "                                                             <window> - 0 (close) to 600 (x1 sec)\n"  \
+               "   ble auth key <key>                               -> Write beacon auth. key into NVM and reset\n"     \
+               "                                                             <key> - 32 hex digits (AES-128)\n"        \
+               "   ble auth bench                                   -> Beacon auth. per packet cost\n"                  \
+               "   -----------------------------------------------------------------------------------------\n"          \
+               "   lf stats                [reset]                  -> Show/clear LF captures and worst latency\n"     \
+               "   prof                    [reset]                  -> Show/clear machines execution time (dev.)\n"    \
+               "   pm stats                [reset]                  -> Show/clear EM0/EM1/EM2 time and wake-ups\n"     \
+               "   boot trace                                       -> Show boot phases time (this and previous boot)\n" \
+               "   -----------------------------------------------------------------------------------------\n"          \
                "   cli stop                                         -> Stop cli process\n"                               \
                "   git info                                         -> Show git info\n"                                  \
                "   reset                                            -> System reset\n"                                   \
@@ -465,6 +705,8 @@ static void cli_run_fsm(sl_sleeptimer_timer_handle_t *handle, void *data)
             } else {
                 cli_process_command();
             }
+            // Let machines pick up whatever the command changed
+            tmm_wakeup();
         }
     }
 }
@@ -498,6 +740,11 @@ void cli_start(void)
         DEBUG_LOG(DBG_CAT_SYSTEM, "Starting CLI process...");
     }
 
+#if defined(TAG_BOOT_TRACE_PRESENT)
+    boot_trace_print();
+    printf("\n");
+#endif
+
 #endif
 }
 
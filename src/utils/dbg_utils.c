@@ -17,6 +17,7 @@
 #include "tag_beacon_machine.h"
 #include "ble_manager_machine.h"
 #include "temperature_machine.h"
+#include "energy_budget_machine.h"
 #include "boot.h"
 #include "version.h"
 #include "dbg_utils.h"
@@ -86,18 +87,120 @@ void dbg_print_banner(void)
 #else
     printf(COLOR_B_WHITE "%35s | %s\n", "CLI", COLOR_B_RED "Disabled");
 #endif
+
+#if defined(TAG_ADV_LOCAL_NAME_SHORTENED)
+    printf(COLOR_B_WHITE "%35s | %s\n", "Adv. Local Name", COLOR_B_GREEN "Shortened");
+#elif defined(TAG_ADV_LOCAL_NAME_PRESENT)
+    printf(COLOR_B_WHITE "%35s | %s\n", "Adv. Local Name", COLOR_B_GREEN "Complete");
+#else
+    printf(COLOR_B_WHITE "%35s | %s\n", "Adv. Local Name", COLOR_B_RED "Disabled");
+#endif
+
+#if defined(TAG_BLE_EXT_ADV_PRESENT)
+    printf(COLOR_B_WHITE "%35s | %s\n", "BLE Extended Advertising", COLOR_B_GREEN "Enabled");
+#else
+    printf(COLOR_B_WHITE "%35s | %s\n", "BLE Extended Advertising", COLOR_B_RED "Disabled");
+#endif
+
+#if defined(TAG_ADV_SCAN_RSP_PRESENT)
+    printf(COLOR_B_WHITE "%35s | %s\n", "Scan Response Offload", COLOR_B_GREEN "Enabled");
+#else
+    printf(COLOR_B_WHITE "%35s | %s\n", "Scan Response Offload", COLOR_B_RED "Disabled");
+#endif
+
+#if defined(TAG_BEACON_AUTH_PRESENT)
+    printf(COLOR_B_WHITE "%35s | %s\n", "Authenticated Beacons", COLOR_B_GREEN "Enabled");
+#else
+    printf(COLOR_B_WHITE "%35s | %s\n", "Authenticated Beacons", COLOR_B_RED "Disabled");
+#endif
+
+#if defined(TAG_READER_ACK_PRESENT)
+    printf(COLOR_B_WHITE "%35s | %s\n", "Reader Acknowledgment", COLOR_B_GREEN "Enabled");
+#else
+    printf(COLOR_B_WHITE "%35s | %s\n", "Reader Acknowledgment", COLOR_B_RED "Disabled");
+#endif
+
+#if defined(TAG_DOWNLINK_PRESENT)
+    printf(COLOR_B_WHITE "%35s | %s\n", "Downlink Commands", COLOR_B_GREEN "Enabled");
+#else
+    printf(COLOR_B_WHITE "%35s | %s\n", "Downlink Commands", COLOR_B_RED "Disabled");
+#endif
+
+#if defined(TAG_GATT_PROVISIONING_PRESENT)
+    printf(COLOR_B_WHITE "%35s | %s\n", "GATT Provisioning", COLOR_B_GREEN "Enabled");
+#else
+    printf(COLOR_B_WHITE "%35s | %s\n", "GATT Provisioning", COLOR_B_RED "Disabled");
+#endif
+
+#if defined(TAG_TICKLESS_PRESENT)
+    printf(COLOR_B_WHITE "%35s | %s\n", "Tickless Main Machine", COLOR_B_GREEN "Enabled");
+#else
+    printf(COLOR_B_WHITE "%35s | %s\n", "Tickless Main Machine", COLOR_B_RED "Disabled");
+#endif
+
+#if defined(TAG_PROFILER_PRESENT)
+    printf(COLOR_B_WHITE "%35s | %s\n", "Machines Profiler", COLOR_B_GREEN "Enabled");
+#else
+    printf(COLOR_B_WHITE "%35s | %s\n", "Machines Profiler", COLOR_B_RED "Disabled");
+#endif
+
+#if defined(TAG_HFXO_PREWARM_PRESENT)
+    printf(COLOR_B_WHITE "%35s | %s\n", "HFXO Pre-warm", COLOR_B_GREEN "Enabled");
+#else
+    printf(COLOR_B_WHITE "%35s | %s\n", "HFXO Pre-warm", COLOR_B_RED "Disabled");
+#endif
+
+#if defined(TAG_SHELF_MODE_PRESENT)
+    printf(COLOR_B_WHITE "%35s | %s\n", "Shelf Mode", COLOR_B_GREEN "Enabled");
+#else
+    printf(COLOR_B_WHITE "%35s | %s\n", "Shelf Mode", COLOR_B_RED "Disabled");
+#endif
+
+#if defined(TAG_BOOT_TRACE_PRESENT)
+    printf(COLOR_B_WHITE "%35s | %s\n", "Boot Trace", COLOR_B_GREEN "Enabled");
+#else
+    printf(COLOR_B_WHITE "%35s | %s\n", "Boot Trace", COLOR_B_RED "Disabled");
+#endif
+
+#if defined(TAG_FAST_BOOT_PRESENT)
+    printf(COLOR_B_WHITE "%35s | %s\n", "Fast Boot", COLOR_B_GREEN "Enabled");
+#else
+    printf(COLOR_B_WHITE "%35s | %s\n", "Fast Boot", COLOR_B_RED "Disabled");
+#endif
+
+#if defined(TAG_RETAINED_STATE_PRESENT)
+    printf(COLOR_B_WHITE "%35s | %s\n", "Retained State", COLOR_B_GREEN "Enabled");
+#else
+    printf(COLOR_B_WHITE "%35s | %s\n", "Retained State", COLOR_B_RED "Disabled");
+#endif
+
+#if defined(TAG_POWER_STATS_PRESENT)
+    printf(COLOR_B_WHITE "%35s | %s\n", "Power Stats", COLOR_B_GREEN "Enabled");
+#else
+    printf(COLOR_B_WHITE "%35s | %s\n", "Power Stats", COLOR_B_RED "Disabled");
+#endif
+
+#if defined(TAG_POWER_STATS_BEACON_PRESENT)
+    printf(COLOR_B_WHITE "%35s | %s\n", "Power Stats Beacon", COLOR_B_GREEN "Enabled");
+#else
+    printf(COLOR_B_WHITE "%35s | %s\n", "Power Stats Beacon", COLOR_B_RED "Disabled");
+#endif
     printf(COLOR_WHITE     "-------------------------------------------------------------------------\n");
 
     printf(COLOR_B_WHITE "%35s | %s\n", "Logs", (dbg_is_log_enabled() ? COLOR_B_GREEN "On" : COLOR_B_RED "Off"));
     printf(COLOR_B_WHITE "%35s | %s\n", "Traps", (dbg_is_trap_enabled() ? COLOR_B_GREEN "On" : COLOR_B_RED "Off"));
     printf(COLOR_B_WHITE "%35s |"COLOR_CYAN" %5d msec\n", "TMM Tick", TMM_RTCC_TIMER_PERIOD_MS);
-    printf(COLOR_B_WHITE "%35s |"COLOR_CYAN" %5d msec\n", "TTM Slow Tasks Tick", TMM_SLOW_TASK_TIMER_PERIOD_MS);
+#if defined(TAG_TICKLESS_PRESENT)
+    printf(COLOR_B_WHITE "%35s |"COLOR_CYAN" %5d sec\n", "TMM Max Sleep", TMM_TICKLESS_MAX_SLEEP_SEC);
+#endif
     uint16_t fast_rate_int = (tbm_get_fast_beacon_rate() / 4);
     uint16_t fast_rate_frac = ((tbm_get_fast_beacon_rate() % 4) * 250);
     printf(COLOR_B_WHITE "%35s |"COLOR_CYAN" %5d.%d sec\n", "Beacon Rate (Fast)", fast_rate_int, fast_rate_frac);
     printf(COLOR_B_WHITE "%35s |"COLOR_CYAN" %5d sec\n", "Beacon Rate (Slow)", tbm_get_slow_beacon_rate());
     printf(COLOR_B_WHITE "%35s |"COLOR_CYAN" %5d sec\n", "Temperature Report Rate", (int)(TTM_REPORT_TIMER_RELOAD));
     printf(COLOR_B_WHITE "%35s |"COLOR_CYAN" %5d sec\n", "Uptime Beacon Rate", (int)(TUM_TIMER_PERIOD_SEC));
+    printf(COLOR_B_WHITE "%35s |"COLOR_CYAN" %5d days\n", "Battery Life Target", (int)(EBM_TARGET_LIFETIME_DAYS));
+    printf(COLOR_B_WHITE "%35s |"COLOR_CYAN" %5d days\n", "Battery Life Projection", (int)ebm_get_remaining_life_days());
     printf(COLOR_B_WHITE "%35s |"COLOR_CYAN"    %s\n", "Current Uptime", uptime);
 
     printf(COLOR_WHITE "-------------------------------------------------------------------------\n\n");
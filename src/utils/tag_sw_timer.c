@@ -4,34 +4,233 @@
  */
 
 #include "stdio.h"
+#include "em_core.h"
 #include "tag_sw_timer.h"
 
-//! @brief Tick sw timer
-void tag_sw_timer_tick(tag_sw_timer_t *timer)
+#define TAG_SW_TIMER_WHEEL_MASK              (TAG_SW_TIMER_WHEEL_SLOTS - 1)
+
+static tag_sw_timer_t *tag_sw_timer_wheel[TAG_SW_TIMER_WHEEL_SLOTS];
+static uint32_t tag_sw_timer_now;                 /* last processed time (Tag Main Machine ticks) */
+static uint32_t tag_sw_timer_count;               /* timers in the wheel */
+
+//! @brief Insert running timer in its wheel slot (interrupts must be masked)
+static void tag_sw_timer_link(tag_sw_timer_t *timer)
 {
-    if (timer->value > 0) {
-        --timer->value;
+    tag_sw_timer_t **slot = &tag_sw_timer_wheel[timer->deadline & TAG_SW_TIMER_WHEEL_MASK];
+
+    timer->prev = NULL;
+    timer->next = *slot;
+    if (*slot != NULL) {
+        (*slot)->prev = timer;
     }
+    *slot = timer;
+    timer->state = TAG_SW_TIMER_RUNNING;
+    tag_sw_timer_count++;
 }
 
-//! @brief Check if sw timer value expired (equals 0)
-bool tag_sw_timer_is_expired(tag_sw_timer_t *timer)
+//! @brief Remove running timer from its wheel slot (interrupts must be masked)
+static void tag_sw_timer_unlink(tag_sw_timer_t *timer)
+{
+    if (timer->state != TAG_SW_TIMER_RUNNING) {
+        return;
+    }
+
+    if (timer->prev != NULL) {
+        timer->prev->next = timer->next;
+    } else {
+        tag_sw_timer_wheel[timer->deadline & TAG_SW_TIMER_WHEEL_MASK] = timer->next;
+    }
+    if (timer->next != NULL) {
+        timer->next->prev = timer->prev;
+    }
+    timer->next = NULL;
+    timer->prev = NULL;
+    timer->state = TAG_SW_TIMER_STOPPED;
+    tag_sw_timer_count--;
+}
+
+//! @brief Handle a timer taken out of the wheel by @ref tag_sw_timer_process
+static void tag_sw_timer_expire(tag_sw_timer_t *timer)
 {
-    return (timer->value == 1? true : false);
+    if (timer->period != 0) {
+        // Skip periods missed while sleeping, ticks stay on the original grid.
+        do {
+            timer->deadline += timer->period;
+        } while (!TAG_SW_TIMER_IS_BEFORE(tag_sw_timer_now, timer->deadline));
+
+        CORE_DECLARE_IRQ_STATE;
+        CORE_ENTER_ATOMIC();
+        tag_sw_timer_link(timer);
+        CORE_EXIT_ATOMIC();
+    } else {
+        timer->state = ((timer->callback != NULL) ? TAG_SW_TIMER_STOPPED : TAG_SW_TIMER_EXPIRED);
+    }
+
+    if (timer->callback != NULL) {
+        timer->callback(timer);
+    }
 }
 
-//! @brief Reload sw timer value
+/**
+ * @brief Start sw timer
+ * @param timer
+ * @param ticks Tag Main Machine ticks from now (0 stops the timer)
+ * @param period auto-reload (ticks), 0 for one-shot. Periodic timers need a callback.
+ * @param callback called from Tag Main Machine context on expiry, NULL for polled timers
+ */
+void tag_sw_timer_start(tag_sw_timer_t *timer, uint32_t ticks, uint32_t period, tag_sw_timer_callback_t callback)
+{
+    timer->period = ((callback != NULL) ? period : 0);
+    timer->callback = callback;
+    tag_sw_timer_reload(timer, ticks);
+}
+
+/**
+ * @brief Reload sw timer (period and callback are kept)
+ * @param timer
+ * @param reload_value Tag Main Machine ticks from now (0 stops the timer)
+ */
 void tag_sw_timer_reload(tag_sw_timer_t *timer, uint32_t reload_value)
 {
-    timer->value = reload_value + 1;
+    CORE_DECLARE_IRQ_STATE;
+    CORE_ENTER_ATOMIC();
+
+    tag_sw_timer_unlink(timer);
+    timer->state = TAG_SW_TIMER_STOPPED;
+
+    if (reload_value != 0) {
+        timer->deadline = tag_sw_timer_now + reload_value;
+        tag_sw_timer_link(timer);
+    }
+
+    CORE_EXIT_ATOMIC();
+}
+
+void tag_sw_timer_stop(tag_sw_timer_t *timer)
+{
+    CORE_DECLARE_IRQ_STATE;
+    CORE_ENTER_ATOMIC();
+    tag_sw_timer_unlink(timer);
+    timer->state = TAG_SW_TIMER_STOPPED;
+    CORE_EXIT_ATOMIC();
+}
+
+//! @brief Check if polled sw timer deadline was reached (until it is reloaded or stopped)
+bool tag_sw_timer_is_expired(tag_sw_timer_t *timer)
+{
+    return (timer->state == TAG_SW_TIMER_EXPIRED ? true : false);
 }
 
 bool tag_sw_timer_is_running(tag_sw_timer_t *timer)
 {
-    return (timer->value > 1 ? true : false);
+    return (timer->state == TAG_SW_TIMER_RUNNING ? true : false);
 }
 
 bool tag_sw_timer_is_stopped(tag_sw_timer_t *timer)
 {
-    return (timer->value == 0 ? true : false);
+    return (timer->state == TAG_SW_TIMER_STOPPED ? true : false);
+}
+
+/**
+ * @brief Deadline of a running sw timer
+ * @param timer
+ * @param deadline Tag Main Machine ticks
+ * @return false if timer is not running.
+ */
+bool tag_sw_timer_get_deadline(tag_sw_timer_t *timer, uint32_t *deadline)
+{
+    if (timer->state != TAG_SW_TIMER_RUNNING) {
+        return false;
+    }
+
+    *deadline = timer->deadline;
+    return true;
+}
+
+/**
+ * @brief Advance time and expire due timers (called by Tag Main Machine before running its machines)
+ * @details Only the wheel slots of the elapsed ticks are visited (all of them once after a
+ *     sleep longer than a wheel round). Due timers are taken out first and handled after,
+ *     so callbacks may start or stop any timer.
+ * @param now Tag Main Machine ticks
+ */
+void tag_sw_timer_process(uint32_t now)
+{
+    tag_sw_timer_t *expired = NULL;
+    tag_sw_timer_t *timer;
+    tag_sw_timer_t *next;
+    uint32_t slot = tag_sw_timer_now + 1;
+    uint32_t slots = now - tag_sw_timer_now;
+
+    if (slots > TAG_SW_TIMER_WHEEL_SLOTS) {
+        slots = TAG_SW_TIMER_WHEEL_SLOTS;
+    }
+
+    tag_sw_timer_now = now;
+
+    CORE_DECLARE_IRQ_STATE;
+    CORE_ENTER_ATOMIC();
+    while ((slots-- > 0) && (tag_sw_timer_count > 0)) {
+        for (timer = tag_sw_timer_wheel[slot & TAG_SW_TIMER_WHEEL_MASK]; timer != NULL; timer = next) {
+            next = timer->next;
+            if (!TAG_SW_TIMER_IS_BEFORE(now, timer->deadline)) {
+                tag_sw_timer_unlink(timer);
+                timer->next = expired;
+                expired = timer;
+            }
+        }
+        slot++;
+    }
+    CORE_EXIT_ATOMIC();
+
+    for (timer = expired; timer != NULL; timer = next) {
+        next = timer->next;
+        timer->next = NULL;
+        tag_sw_timer_expire(timer);
+    }
+}
+
+uint32_t tag_sw_timer_get_time(void)
+{
+    return tag_sw_timer_now;
+}
+
+/**
+ * @brief Earliest deadline of running timers
+ * @details Timers due within one wheel round are found in their own slot, walking slots
+ *     from now on. All slots are only searched when none of them is.
+ * @param deadline
+ * @return false if no timer is running.
+ */
+bool tag_sw_timer_get_next_deadline(uint32_t *deadline)
+{
+    tag_sw_timer_t *timer;
+    uint32_t tick;
+    uint32_t i;
+    bool found = false;
+
+    if (tag_sw_timer_count == 0) {
+        return false;
+    }
+
+    for (i = 1; i <= TAG_SW_TIMER_WHEEL_SLOTS; i++) {
+        tick = tag_sw_timer_now + i;
+        for (timer = tag_sw_timer_wheel[tick & TAG_SW_TIMER_WHEEL_MASK]; timer != NULL; timer = timer->next) {
+            if (timer->deadline == tick) {
+                *deadline = tick;
+                return true;
+            }
+        }
+    }
+
+    for (i = 0; i < TAG_SW_TIMER_WHEEL_SLOTS; i++) {
+        for (timer = tag_sw_timer_wheel[i]; timer != NULL; timer = timer->next) {
+            if (!found || TAG_SW_TIMER_IS_BEFORE(timer->deadline, *deadline)) {
+                *deadline = timer->deadline;
+                found = true;
+            }
+        }
+    }
+
+    return found;
 }